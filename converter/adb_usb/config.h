@@ -46,6 +46,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define ADB_DDR         DDRD
 #define ADB_DATA_BIT    0
 //#define ADB_PSW_BIT     1       // optional
+/* Receive data with Timer1 input capture instead of busy wait, interrupts are
+ * served during transaction and polling goes on without waiting for device data.
+ * Data line should be on ICP1 pin(PD4: ADB_DATA_BIT 4). Not with SLEEP_LED_ENABLE(Timer1). */
+//#define ADB_USE_ICP
+
+/* polling interval(ms): while active, normal and idle */
+#ifndef ADB_POLL_ACTIVE
+#define ADB_POLL_ACTIVE         8
+#endif
+#ifndef ADB_POLL_INTERVAL
+#define ADB_POLL_INTERVAL       12
+#endif
+#ifndef ADB_POLL_IDLE
+#define ADB_POLL_IDLE           24
+#endif
+/* time(ms) after last data to move to normal and idle interval */
+#ifndef ADB_POLL_ACTIVE_TIME
+#define ADB_POLL_ACTIVE_TIME    1000
+#endif
+#ifndef ADB_POLL_IDLE_TIME
+#define ADB_POLL_IDLE_TIME      10000
+#endif
+/* slots to rotate first device to poll */
+#ifndef ADB_POLL_ROTATE
+#define ADB_POLL_ROTATE         8
+#endif
 
 /* key combination for command */
 #ifndef __ASSEMBLER__
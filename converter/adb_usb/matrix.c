@@ -31,6 +31,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "led.h"
 #include "timer.h"
 #include "wait.h"
+#include "keycode.h"
+#include "command.h"
 
 
 
@@ -38,15 +40,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 static bool has_media_keys = false;
 static bool is_iso_layout = false;
 
-#if ADB_MOUSE_ENABLE
+#ifdef ADB_MOUSE_ENABLE
 #define dmprintf(fmt, ...)  do { /* if (debug_mouse) */ xprintf("M:" fmt, ##__VA_ARGS__); } while (0)
 static uint16_t mouse_cpi = 100;
 static void mouse_init(uint8_t addr);
+static void mouse_process(uint8_t *buf, uint8_t len);
 #endif
 
 // matrix state buffer(1:on, 0:off)
 static matrix_row_t matrix[MATRIX_ROWS];
 
+static uint16_t adb_poll(void);
+static uint8_t  poll_talks;     // Talks issued in polling slot in progress, 0 if none
+
 static void register_key(uint8_t key);
 
 static void device_scan(void)
@@ -261,27 +267,25 @@ detect_again:
 #define MAX(X, Y) ((X) > (Y) ? (X) : (Y))
 
 static report_mouse_t mouse_report = {};
+static int8_t mouseacc;
+static uint16_t mouse_ms;
 
+// mouse is polled by scheduler in matrix_scan()
 void adb_mouse_task(void)
 {
-    uint8_t len;
-    uint8_t buf[5];
-    int16_t x, y;
-    static int8_t mouseacc;
-
-    /* tick of last polling */
-    static uint16_t tick_ms;
-
-    // polling with 12ms interval
-    if (timer_elapsed(tick_ms) < 12) return;
-    tick_ms = timer_read();
-
     static uint16_t detect_ms;
+    // don't disturb Talk of polling slot in progress
+    if (poll_talks) return;
     if (timer_elapsed(detect_ms) > 1000) {
         detect_ms = timer_read();
         // check new device on addr3
         mouse_init(ADB_ADDR_MOUSE);
     }
+}
+
+static void mouse_process(uint8_t *buf, uint8_t len)
+{
+    int16_t x, y;
 
     // Extended Mouse Protocol data can be 2-5 bytes
     // https://developer.apple.com/library/archive/technotes/hw/hw_01.html#Extended
@@ -295,13 +299,14 @@ void adb_mouse_task(void)
     //   b--: Button state.(0: on, 1: off)
     //   x--: X axis movement.
     //   y--: Y axis movement.
-    len = adb_host_talk_buf(ADB_ADDR_MOUSE_POLL, ADB_REG_0, buf, sizeof(buf));
 
     // If nothing received reset mouse acceleration, and quit.
-    if (len < 2) {
+    // Mouse is not polled every slot, reset also when data is not continuous.
+    if (len < 2 || timer_elapsed(mouse_ms) > ADB_POLL_IDLE) {
         mouseacc = 1;
-        return;
-    };
+    }
+    if (len < 2) return;
+    mouse_ms = timer_read();
     dmprintf("[%02X %02X %02X %02X %02X]\n", buf[0], buf[1], buf[2], buf[3], buf[4]);
 
     // Store off-buttons and 0-movements in unused bytes
@@ -315,7 +320,7 @@ void adb_mouse_task(void)
         if (buf[len - 1] & 0x04) xneg = true;
     }
 
-    for (int8_t i = len; i < sizeof(buf); i++) {
+    for (int8_t i = len; i < 5; i++) {
         buf[i] = 0x88;
         if (yneg) buf[i] |= 0x70;
         if (xneg) buf[i] |= 0x07;
@@ -362,6 +367,177 @@ void adb_mouse_task(void)
 }
 #endif
 
+/*
+ * Device polling
+ *
+ * One slot of Talk commands is issued every interval. A slot starts with the
+ * device which sent data last and goes on to next device only when Service
+ * Request(SRQ) is signaled, so usually a Talk per slot is enough. Keyboard
+ * codes end the slot while mouse data doesn't, so that a moving mouse can't
+ * delay keys for more than a slot.
+ *
+ * Interval is shortened while devices are active and lengthened when idle.
+ */
+enum { DEV_KEYBOARD, DEV_APPLIANCE, DEV_MOUSE, DEV_COUNT };
+static const uint8_t dev_addr[DEV_COUNT] = {
+    ADB_ADDR_KEYBOARD, ADB_ADDR_APPLIANCE, ADB_ADDR_MOUSE_POLL
+};
+
+static uint8_t  poll_dev = DEV_KEYBOARD;    // device polled first in slot
+static uint16_t poll_ms;                    // time of last slot
+static uint32_t active_ms;                  // time of last data
+static uint8_t  keys_down;
+
+/* key latency: time from last slot keyboard could report to its data */
+static uint16_t kbd_ready_ms;
+static uint16_t latency_max;
+static uint32_t latency_sum;
+static uint16_t latency_count;
+
+static bool dev_enabled(uint8_t dev)
+{
+    switch (dev) {
+        case DEV_KEYBOARD:  return true;
+        case DEV_APPLIANCE: return has_media_keys;
+#ifdef ADB_MOUSE_ENABLE
+        case DEV_MOUSE:     return true;
+#endif
+        default:            return false;
+    }
+}
+
+static uint8_t next_dev(uint8_t dev)
+{
+    do {
+        dev = (dev + 1) % DEV_COUNT;
+    } while (!dev_enabled(dev));
+    return dev;
+}
+
+static uint16_t poll_interval(void)
+{
+    if (keys_down) return ADB_POLL_ACTIVE;
+    uint32_t idle = timer_read32() - active_ms;
+    if (idle < ADB_POLL_ACTIVE_TIME) return ADB_POLL_ACTIVE;
+    if (idle < ADB_POLL_IDLE_TIME) return ADB_POLL_INTERVAL;
+    return ADB_POLL_IDLE;
+}
+
+/* Adjustable keyboard media keys */
+static uint16_t media_codes(uint16_t codes)
+{
+    xprintf("m:%04X ", codes);
+    // key1
+    switch (codes & 0x7f ) {
+    case 0x00:  // Mic
+        codes = (codes & ~0x007f) | 0x42;
+        break;
+    case 0x01:  // Mute
+        codes = (codes & ~0x007f) | 0x4a;
+        break;
+    case 0x02:  // Volume down
+        codes = (codes & ~0x007f) | 0x49;
+        break;
+    case 0x03:  // Volume Up
+        codes = (codes & ~0x007f) | 0x48;
+        break;
+    case 0x7F:  // no code
+        break;
+    default:
+        xprintf("ERROR: media key1\n");
+        return 0;
+    }
+    // key0
+    switch ((codes >> 8) & 0x7f ) {
+    case 0x00:  // Mic
+        codes = (codes & ~0x7f00) | (0x42 << 8);
+        break;
+    case 0x01:  // Mute
+        codes = (codes & ~0x7f00) | (0x4a << 8);
+        break;
+    case 0x02:  // Volume down
+        codes = (codes & ~0x7f00) | (0x49 << 8);
+        break;
+    case 0x03:  // Volume Up
+        codes = (codes & ~0x7f00) | (0x48 << 8);
+        break;
+    default:
+        xprintf("ERROR: media key0\n");
+        return 0;
+    }
+    return codes;
+}
+
+/* returns codes from keyboard or appliance, 0 if none
+ *
+ * Talk of a slot is collected in a later call when data is received in background(ADB_USE_ICP).
+ */
+static uint16_t adb_poll(void)
+{
+    static uint8_t slot;
+    static uint8_t dev;
+    static bool kbd_polled;
+    uint16_t codes = 0;
+
+    if (!poll_talks) {
+        if (timer_elapsed(poll_ms) < poll_interval()) return 0;
+        poll_ms = timer_read();
+
+        // rotate first device now and then in case a device fails to signal SRQ
+        if (++slot % ADB_POLL_ROTATE == 0) poll_dev = next_dev(poll_dev);
+
+        dev = poll_dev;
+        kbd_polled = false;
+        adb_host_talk_start(dev_addr[dev], ADB_REG_0);
+        poll_talks = 1;
+    }
+
+    for (;;) {
+        uint8_t buf[5];
+        int8_t len = adb_host_talk_result(buf, sizeof(buf));
+        if (len < 0) return 0;      // device is still sending
+        bool srq = adb_host_srq();
+        bool done = !srq;
+        if (dev == DEV_KEYBOARD) kbd_polled = true;
+
+        if (dev == DEV_MOUSE) {
+#ifdef ADB_MOUSE_ENABLE
+            mouse_process(buf, len);
+            if (len) {
+                active_ms = timer_read32();
+                poll_dev = dev;
+            }
+#endif
+        } else if (len == 2) {
+            codes = buf[0]<<8 | buf[1];
+            if (dev == DEV_APPLIANCE) {
+                codes = media_codes(codes);
+            } else {
+                xprintf("%04X ", codes);
+
+                uint16_t latency = timer_elapsed(kbd_ready_ms);
+                if (latency > latency_max) latency_max = latency;
+                latency_sum += latency;
+                latency_count++;
+            }
+            active_ms = timer_read32();
+            // other device requesting service goes first in next slot
+            poll_dev = (srq ? next_dev(dev) : dev);
+            done = true;
+        }
+
+        if (done || poll_talks >= DEV_COUNT) {
+            // keyboard could not have had pending data before this point
+            if (kbd_polled || !srq) kbd_ready_ms = timer_read();
+            poll_talks = 0;
+            return codes;
+        }
+        dev = next_dev(dev);
+        adb_host_talk_start(dev_addr[dev], ADB_REG_0);
+        poll_talks++;
+    }
+}
+
 uint8_t matrix_scan(void)
 {
     /* extra_key is volatile and more convoluted than necessary because gcc refused
@@ -374,64 +550,12 @@ uint8_t matrix_scan(void)
     uint16_t codes;
     uint8_t key0, key1;
 
-    /* tick of last polling */
-    static uint16_t tick_ms;
-
     codes = extra_key;
     extra_key = 0xFFFF;
 
     if ( codes == 0xFFFF )
     {
-        // polling with 12ms interval
-        if (timer_elapsed(tick_ms) < 12) return 0;
-        tick_ms = timer_read();
-
-        codes = adb_host_kbd_recv(ADB_ADDR_KEYBOARD);
-        if (codes) xprintf("%04X ", codes);
-
-        // Adjustable keybaord media keys
-        if (codes == 0 && has_media_keys &&
-                (codes = adb_host_kbd_recv(ADB_ADDR_APPLIANCE))) {
-            xprintf("m:%04X ", codes);
-            // key1
-            switch (codes & 0x7f ) {
-            case 0x00:  // Mic
-                codes = (codes & ~0x007f) | 0x42;
-                break;
-            case 0x01:  // Mute
-                codes = (codes & ~0x007f) | 0x4a;
-                break;
-            case 0x02:  // Volume down
-                codes = (codes & ~0x007f) | 0x49;
-                break;
-            case 0x03:  // Volume Up
-                codes = (codes & ~0x007f) | 0x48;
-                break;
-            case 0x7F:  // no code
-                break;
-            default:
-                xprintf("ERROR: media key1\n");
-                return 0x11;
-            }
-            // key0
-            switch ((codes >> 8) & 0x7f ) {
-            case 0x00:  // Mic
-                codes = (codes & ~0x7f00) | (0x42 << 8);
-                break;
-            case 0x01:  // Mute
-                codes = (codes & ~0x7f00) | (0x4a << 8);
-                break;
-            case 0x02:  // Volume down
-                codes = (codes & ~0x7f00) | (0x49 << 8);
-                break;
-            case 0x03:  // Volume Up
-                codes = (codes & ~0x7f00) | (0x48 << 8);
-                break;
-            default:
-                xprintf("ERROR: media key0\n");
-                return 0x10;
-            }
-        }
+        codes = adb_poll();
     }
     key0 = codes>>8;
     key1 = codes&0xFF;
@@ -514,12 +638,30 @@ static void register_key(uint8_t key)
     col = key&0x07;
     row = (key>>3)&0x0F;
     if (key&0x80) {
+        if (matrix[row] & (1<<col)) keys_down--;
         matrix[row] &= ~(1<<col);
     } else {
+        if (!(matrix[row] & (1<<col))) keys_down++;
         matrix[row] |=  (1<<col);
     }
 }
 
+/* Polling interval and key latency */
+bool command_extra(uint8_t code)
+{
+    switch (code) {
+        case KC_L:
+            xprintf("\npoll:%ums keys:%u latency avg:%ums max:%ums count:%u\n",
+                    poll_interval(), keys_down,
+                    (latency_count ? (uint16_t)(latency_sum / latency_count) : 0),
+                    latency_max, latency_count);
+            latency_sum = 0; latency_count = 0; latency_max = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
 void led_set(uint8_t usb_led)
 {
     adb_host_kbd_led(ADB_ADDR_KEYBOARD, ~usb_led);
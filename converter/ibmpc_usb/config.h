@@ -28,8 +28,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define DESCRIPTION     convert IBM PC keyboard to USB
 
 
+/* Secondary port: two keyboards on one converter, see pin configuration below */
+//#define IBMPC_SECONDARY
+
+
 /* matrix size */
+#ifdef IBMPC_SECONDARY
+#define MATRIX_ROWS 32  // port: bit 7, keycode bit: 6-3
+#else
 #define MATRIX_ROWS 16  // keycode bit: 6-3
+#endif
 #define MATRIX_COLS 8   // keycode bit: 2-0
 
 
@@ -79,24 +87,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
     IBMPC_RST_DDR  |=  (1<<IBMPC_RST_BIT2);  \
 } while (0)
 
-/* interrupt for clock line */
-#define IBMPC_INT_INIT()  do {  \
-    EICRA |= ((1<<ISC11) |      \
-              (0<<ISC10));      \
-} while (0)
-
-/* NOTE: clear flag and enabling to ditch unwanted interrupt */
-#define IBMPC_INT_ON()  do {    \
-    EIFR  |= (1<<INTF1);        \
-    EIMSK |= (1<<INT1);         \
-} while (0)
-
-#define IBMPC_INT_OFF() do {    \
-    EIMSK &= ~(1<<INT1);        \
-} while (0)
-
+/* interrupt for clock line: INT1 falling edge */
+#define IBMPC_INT_BIT     INT1
+#define IBMPC_INT_ISC     (1<<ISC11)
 #define IBMPC_INT_VECT    INT1_vect
 
+#ifdef IBMPC_SECONDARY
+/* secondary port: Clock PD3(INT3), Data PD2 and no reset line */
+#define IBMPC_CLOCK_PORT2 PORTD
+#define IBMPC_CLOCK_PIN2  PIND
+#define IBMPC_CLOCK_DDR2  DDRD
+#define IBMPC_CLOCK_BIT2  3
+#define IBMPC_DATA_PORT2  PORTD
+#define IBMPC_DATA_PIN2   PIND
+#define IBMPC_DATA_DDR2   DDRD
+#define IBMPC_DATA_BIT2   2
+#define IBMPC_INT_BIT2    INT3
+#define IBMPC_INT_ISC2    (1<<ISC31)
+#define IBMPC_INT_VECT2   INT3_vect
+#endif
+
 #else
 #error "No pin configuration in config.h"
 #endif
@@ -26,66 +26,176 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "matrix.h"
 #include "timer.h"
 #include "action.h"
+#include "keycode.h"
+#include "command.h"
+#include "progmem.h"
 #include "ibmpc_usb.h"
 #include "ibmpc.h"
 
 
-static void matrix_make(uint8_t code);
-static void matrix_break(uint8_t code);
-
-static int8_t process_cs1(uint8_t code);
-static int8_t process_cs2(uint8_t code);
-static int8_t process_cs3(uint8_t code);
+/* keyboard recognition and scan code reading states */
+enum {
+    INIT,
+    WAIT_SETTLE,
+    AT_RESET,
+    AT_RESET_SEND,
+    AT_RESET_DONE,
+    XT_RESET,
+    XT_RESET_WAIT,
+    XT_RESET_DONE,
+    WAIT_AA,
+    WAIT_AABF,
+    WAIT_AABFBF,
+    READ_ID,
+    READ_ID_ACK,
+    READ_ID_1ST,
+    READ_ID_2ND,
+    SETUP_KIND,
+    SETUP_CS3,
+    SETUP,
+    LOOP,
+    COMMAND,
+    DISABLED,
+};
+
+/* per-port converter state: each port has its own keyboard and matrix rows */
+typedef struct {
+    ibmpc_t *host;
+    uint8_t id;                 // port number: matrix rows from id*PORT_MATRIX_ROWS
+    uint8_t state;
+    uint16_t init_time;
+    uint8_t current_protocol;
+    uint8_t cs_state;           // state of process_csN()
+
+    /* command to keyboard: see port_command() */
+    uint8_t cmd[2];
+    uint8_t cmd_len;
+    uint8_t cmd_next;           // state after command
+    int16_t cmd_result;         // response to last byte, -1 on error
+    bool cmd_sent;
+    uint16_t cmd_time;
+
+    uint8_t led;                // IBMPC_LED_* to send in LOOP
+    bool led_pending;
+} port_t;
+
+static port_t ports[IBMPC_PORTS];
+
+
+static void matrix_make(port_t *port, uint8_t code);
+static void matrix_break(port_t *port, uint8_t code);
+static void matrix_clear_port(port_t *port);
+
+static int8_t process_cs1(port_t *port, uint8_t code);
+static int8_t process_cs2(port_t *port, uint8_t code);
+static int8_t process_cs3(port_t *port, uint8_t code);
+static void cs_init(void);
 
 
 static uint8_t matrix[MATRIX_ROWS];
 #define ROW(code)      ((code>>3)&0x0F)
 #define COL(code)      (code&0x07)
+#define PORT_ROW(port, code)    ((port)->id * PORT_MATRIX_ROWS + ROW(code))
+
+/* Entry of code translation tables: zero means no translation for the code */
+#define XLAT(code)     (0x80|(code))
 
-static int16_t read_wait(uint16_t wait_ms)
+
+/*
+ * Scan code decoder
+ *
+ * Prefix, break and Pause sequences of each code set are described as transition
+ * rules in flash and run by cs_process(). Rules are grouped by state; the first
+ * rule of each state is looked up in index built by cs_index() and rules of the
+ * state are searched in order from it. A rule matches when (code & mask) == match,
+ * the last rule of a state has mask 00 to match any code. The rule of codes
+ * 00-7F comes first in a state when it can so that most codes match at once.
+ */
+typedef struct {
+    uint8_t state;
+    uint8_t match;
+    uint8_t mask;
+    uint8_t next;       // next state
+    uint8_t action;
+    uint8_t key;        // key of CS_FIXED
+} cs_rule_t;
+
+#define IS(code)        (code), 0xFF
+#define LOW             0x00, 0x80      // codes 00-7F
+#define HIGH            0x80, 0x80      // codes 80-FF
+#define ANY             0x00, 0x00
+#define CS_END          0xFF            // state of rule to end table
+
+/* action */
+#define CS_NONE         0x00
+#define CS_MAKE         0x01
+#define CS_BREAK        0x02
+#define CS_CLEAR        0x04            // release keys of the port
+#define CS_ERROR        0x08            // initialize keyboard again
+#define CS_FIXED        0x10            // key is rule key instead of code
+#define CS_XLAT         0x20            // key is translated code, error when no translation(FF)
+
+/* index of first rule of each state, FF when the state has no rule */
+static void cs_index(const cs_rule_t *rules, uint8_t *index, uint8_t states)
 {
-    uint16_t start = timer_read();
-    int16_t code;
-    while ((code = ibmpc_host_recv()) == -1 && timer_elapsed(start) < wait_ms);
-    return code;
+    for (uint8_t s = 0; s < states; s++) index[s] = 0xFF;
+    for (uint8_t i = 0, s; (s = pgm_read_byte(&rules[i].state)) != CS_END; i++) {
+        if (s < states && index[s] == 0xFF) index[s] = i;
+    }
 }
 
-static uint16_t read_keyboard_id(void)
+static int8_t cs_process(port_t *port, uint8_t code, const cs_rule_t *rules,
+                         const uint8_t *index, uint8_t states,
+                         uint8_t (*xlat)(uint8_t code), uint8_t cs)
 {
-    uint16_t id = 0;
-    int16_t  code = 0;
+    uint8_t state = port->cs_state;
 
-    // temporary fix Z-150 AT should response with ID
-    if (ibmpc_protocol == IBMPC_PROTOCOL_AT_Z150) return 0xFFFD;
-
-    // Disable
-    //code = ibmpc_host_send(0xF5);
-
-    // Read ID
-    code = ibmpc_host_send(0xF2);
-    if (code == -1) { id = 0xFFFF; goto DONE; }     // XT or No keyboard
-    if (code != 0xFA) { id = 0xFFFE; goto DONE; }   // Broken PS/2?
+    if (state >= states || index[state] == 0xFF) {
+        port->cs_state = 0;
+        return 0;
+    }
+    const cs_rule_t *r = &rules[index[state]];
+    while ((code & pgm_read_byte(&r->mask)) != pgm_read_byte(&r->match)) r++;
 
-    // ID takes 500ms max TechRef [8] 4-41
-    code = read_wait(500);
-    if (code == -1) { id = 0x0000; goto DONE; }     // AT
-    id = (code & 0xFF)<<8;
+    uint8_t action = pgm_read_byte(&r->action);
+    port->cs_state = pgm_read_byte(&r->next);
 
-    // Mouse responds with one-byte 00, this returns 00FF [y] p.14
-    code = read_wait(500);
-    id |= code & 0xFF;
+    // plain make and break codes
+    if (action == CS_MAKE) {
+        matrix_make(port, code & 0x7F);
+        return 0;
+    }
+    if (action == CS_BREAK) {
+        matrix_break(port, code & 0x7F);
+        return 0;
+    }
 
-DONE:
-    // Enable
-    //code = ibmpc_host_send(0xF4);
+    uint8_t key = code & 0x7F;
+    if (action & CS_FIXED) key = pgm_read_byte(&r->key);
+    if (action & CS_XLAT) {
+        key = xlat(code);
+        if (key == 0xFF) action = CS_ERROR;
+    }
 
-    return id;
+    if (action & CS_MAKE) matrix_make(port, key);
+    if (action & CS_BREAK) matrix_break(port, key);
+    if (action & CS_CLEAR) matrix_clear_port(port);
+    if (action & CS_ERROR) {
+        xprintf("!CS%u_%u_%02X!\n", cs, state, code);
+        return -1;
+    }
+    return 0;
 }
 
+
 void hook_early_init(void)
 {
-    ibmpc_host_init();
-    ibmpc_host_enable();
+    // initialize reset pin to HiZ
+    IBMPC_RST_HIZ();
+    for (uint8_t i = 0; i < IBMPC_PORTS; i++) {
+        ibmpc_host_init(&ibmpc_host[i]);
+        ibmpc_host_enable(&ibmpc_host[i]);
+    }
 }
 
 void matrix_init(void)
@@ -95,9 +205,98 @@ void matrix_init(void)
     // initialize matrix state: all keys off
     for (uint8_t i=0; i < MATRIX_ROWS; i++) matrix[i] = 0x00;
 
+    cs_init();
+    for (uint8_t i = 0; i < IBMPC_PORTS; i++) {
+        ports[i].host = &ibmpc_host[i];
+        ports[i].id = i;
+        ports[i].state = INIT;
+    }
     return;
 }
 
+/*
+ * Command to keyboard
+ *
+ * Bytes are sent one by one in COMMAND state without blocking; each is clocked in
+ * by ISR and its response is read with ibmpc_host_recv(). State goes to 'next'
+ * when the last byte is answered or when a byte is not answered with ACK, with the
+ * response in cmd_result or -1 when keyboard doesn't clock in or respond.
+ */
+static void port_command(port_t *port, uint8_t next, uint8_t len, uint8_t cmd0, uint8_t cmd1)
+{
+    port->cmd[0] = cmd0;
+    port->cmd[1] = cmd1;
+    port->cmd_len = len;
+    port->cmd_next = next;
+    port->cmd_result = -1;
+    port->state = COMMAND;
+
+    // first byte
+    port->cmd_len--;
+    port->cmd_sent = false;
+    port->cmd_time = timer_read();
+    ibmpc_host_send_start(port->host, port->cmd[0]);
+}
+
+static void port_command_task(port_t *port)
+{
+    ibmpc_t *host = port->host;
+
+    if (!port->cmd_sent) {
+        if (ibmpc_host_sending(host)) {
+            // keyboard should start clocking in 10ms[5]p.50 and transfer takes 2ms
+            if (timer_elapsed(port->cmd_time) > 15) {
+                ibmpc_host_isr_clear(host);
+                ibmpc_host_enable(host);
+                goto DONE;
+            }
+            return;
+        }
+        port->cmd_sent = true;
+        port->cmd_time = timer_read();
+    }
+
+    int16_t code = ibmpc_host_recv(host);
+    if (code == -1) {
+        // Command may take 25ms/20ms at most([5]p.46, [3]p.21)
+        if (timer_elapsed(port->cmd_time) > 25) goto DONE;
+        return;
+    }
+    port->cmd_result = code;
+    if (code == 0xFA && port->cmd_len) {
+        // next byte
+        port->cmd_result = -1;
+        port->cmd_len--;
+        port->cmd_sent = false;
+        port->cmd_time = timer_read();
+        ibmpc_host_send_start(host, port->cmd[1]);
+        return;
+    }
+DONE:
+    port->state = port->cmd_next;
+}
+
+/* LED command is sent in LOOP when receive buffer is empty */
+static void port_set_led(port_t *port, uint8_t led)
+{
+    port->led = led;
+    port->led_pending = true;
+}
+
+static uint8_t ibmpc_led(uint8_t usb_led)
+{
+    // TODO: PC_TERMINAL_IBM_RT support
+    uint8_t led = 0;
+    if (usb_led &  (1<<USB_LED_SCROLL_LOCK))
+        led |= (1<<IBMPC_LED_SCROLL_LOCK);
+    if (usb_led &  (1<<USB_LED_NUM_LOCK))
+        led |= (1<<IBMPC_LED_NUM_LOCK);
+    if (usb_led &  (1<<USB_LED_CAPS_LOCK))
+        led |= (1<<IBMPC_LED_CAPS_LOCK);
+    return led;
+}
+
+
 /*
  * keyboard recognition
  *
@@ -107,101 +306,99 @@ void matrix_init(void)
  *      c. ID is AB 83: PS/2 keyboard CodeSet2
  *      d. ID is BF BF: Terminal keyboard CodeSet3
  *      e. error on recv: maybe broken PS/2
+ *      f. ID is 00, 03 or 04: mouse, not supported and the port is disabled
+ *
+ * Keyboard ID is read and commands are sent without blocking so that other port
+ * is still serviced meanwhile.
  */
-uint8_t current_protocol = 0;
-uint16_t keyboard_id = 0x0000;
-keyboard_kind_t keyboard_kind = NONE;
-uint8_t matrix_scan(void)
+uint16_t keyboard_id[IBMPC_PORTS];
+keyboard_kind_t keyboard_kind[IBMPC_PORTS];
+static void port_scan(port_t *port)
 {
-    // scan code reading states
-    static enum {
-        INIT,
-        WAIT_SETTLE,
-        AT_RESET,
-        XT_RESET,
-        XT_RESET_WAIT,
-        XT_RESET_DONE,
-        WAIT_AA,
-        WAIT_AABF,
-        WAIT_AABFBF,
-        READ_ID,
-        SETUP,
-        LOOP,
-    } state = INIT;
-    static uint16_t init_time;
-
-
-    if (ibmpc_error) {
-        xprintf("\nERR:%02X ISR:%04X ", ibmpc_error, ibmpc_isr_debug);
+    ibmpc_t *host = port->host;
+    uint8_t n = port->id;
+
+    if (host->error) {
+        xprintf("\nERR%u:%02X ISR:%04X ", n, host->error, host->isr_debug);
 
         // when recv error, neither send error nor buffer full
-        if (!(ibmpc_error & (IBMPC_ERR_SEND | IBMPC_ERR_FULL))) {
+        if (!(host->error & (IBMPC_ERR_SEND | IBMPC_ERR_FULL))) {
             // keyboard init again
-            if (state == LOOP) {
+            if (port->state == LOOP) {
                 xprintf("[RST] ");
-                state = INIT;
+                port->state = INIT;
             }
         }
 
         // clear or process error
-        ibmpc_error = IBMPC_ERR_NONE;
-        ibmpc_isr_debug = 0;
+        host->error = IBMPC_ERR_NONE;
+        host->isr_debug = 0;
     }
 
     // check protocol change AT/XT
-    if (ibmpc_protocol && ibmpc_protocol != current_protocol) {
-        xprintf("\nPRT:%02X ISR:%04X ", ibmpc_protocol, ibmpc_isr_debug);
+    if (host->protocol && host->protocol != port->current_protocol) {
+        xprintf("\nPRT%u:%02X ISR:%04X ", n, host->protocol, host->isr_debug);
 
         // protocol change between AT and XT indicates that
         // keyboard is hotswapped or something goes wrong.
         // This requires initializing keyboard again probably.
-        if (((current_protocol&IBMPC_PROTOCOL_XT) && (ibmpc_protocol&IBMPC_PROTOCOL_AT)) ||
-            ((current_protocol&IBMPC_PROTOCOL_AT) && (ibmpc_protocol&IBMPC_PROTOCOL_XT))) {
-            if (state == LOOP) {
+        if (((port->current_protocol&IBMPC_PROTOCOL_XT) && (host->protocol&IBMPC_PROTOCOL_AT)) ||
+            ((port->current_protocol&IBMPC_PROTOCOL_AT) && (host->protocol&IBMPC_PROTOCOL_XT))) {
+            if (port->state == LOOP) {
                 xprintf("[CHG] ");
-                state = INIT;
+                port->state = INIT;
             }
         }
 
-        current_protocol = ibmpc_protocol;
-        ibmpc_isr_debug = 0;
+        port->current_protocol = host->protocol;
+        host->isr_debug = 0;
     }
 
-    switch (state) {
+    switch (port->state) {
         case INIT:
-            ibmpc_host_disable();
+            ibmpc_host_disable(host);
 
             xprintf("I%u ", timer_read());
-            keyboard_kind = NONE;
-            keyboard_id = 0x0000;
-            current_protocol = 0;
+            keyboard_kind[n] = NONE;
+            keyboard_id[n] = 0x0000;
+            port->current_protocol = 0;
+            port->cs_state = 0;
+            port->led_pending = false;
 
-            matrix_clear();
-            clear_keyboard();
+            // keys of this port are released by matrix change, other port is kept
+            matrix_clear_port(port);
 
-            init_time = timer_read();
-            state = WAIT_SETTLE;
+            port->init_time = timer_read();
+            port->state = WAIT_SETTLE;
             break;
         case WAIT_SETTLE:
             // wait for keyboard to settle after plugin
-            if (timer_elapsed(init_time) > 1000) {
-                state = AT_RESET;
+            if (timer_elapsed(port->init_time) > 1000) {
+                port->state = AT_RESET;
             }
             break;
         case AT_RESET:
-            ibmpc_host_isr_clear();
-            ibmpc_host_enable();
-            wait_ms(1); // keyboard can't respond to command without this
+            ibmpc_host_isr_clear(host);
+            ibmpc_host_enable(host);
+            port->init_time = timer_read();
+            port->state = AT_RESET_SEND;
+            break;
+        case AT_RESET_SEND:
+            // keyboard can't respond to command without this
+            if (timer_elapsed(port->init_time) < 2) break;
 
             // SKIDATA-2-DE(and some other keyboards?) stores 'Code Set' setting in nonvlatile memory
             // and keeps it until receiving reset. Sending reset here may be useful to clear it, perhaps.
             // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#select-alternate-scan-codesf0
 
             // reset command
-            if (0xFA == ibmpc_host_send(0xFF)) {
-                state = WAIT_AA;
+            port_command(port, AT_RESET_DONE, 1, 0xFF, 0);
+            break;
+        case AT_RESET_DONE:
+            if (0xFA == port->cmd_result) {
+                port->state = WAIT_AA;
             } else {
-                state = XT_RESET;
+                port->state = XT_RESET;
             }
             xprintf("A%u ", timer_read());
             break;
@@ -210,25 +407,25 @@ uint8_t matrix_scan(void)
             // XT: hard reset 500ms for IBM XT Type-1 keyboard and clones
             // XT: soft reset 20ms min
             // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-XT-Keyboard-Protocol#keyboard-soft-reset
-            ibmpc_host_disable();   // soft reset: Clock Lo/Data Hi
-            IBMPC_RST_LO();         // hard reset: Reset pin Lo
+            ibmpc_host_disable(host);   // soft reset: Clock Lo/Data Hi
+            if (n == 0) IBMPC_RST_LO(); // hard reset: Reset pin Lo, only on primary port
 
-            init_time = timer_read();
-            state = XT_RESET_WAIT;
+            port->init_time = timer_read();
+            port->state = XT_RESET_WAIT;
             break;
         case XT_RESET_WAIT:
-            if (timer_elapsed(init_time) > 500) {
-                state = XT_RESET_DONE;
+            if (timer_elapsed(port->init_time) > 500) {
+                port->state = XT_RESET_DONE;
             }
             break;
         case XT_RESET_DONE:
-            IBMPC_RST_HIZ();        // hard reset: Reset pin HiZ
-            ibmpc_host_isr_clear();
-            ibmpc_host_enable();    // soft reset: idle(Clock Hi/Data Hi)
+            if (n == 0) IBMPC_RST_HIZ();    // hard reset: Reset pin HiZ
+            ibmpc_host_isr_clear(host);
+            ibmpc_host_enable(host);    // soft reset: idle(Clock Hi/Data Hi)
 
             xprintf("X%u ", timer_read());
-            init_time = timer_read();
-            state = WAIT_AA;
+            port->init_time = timer_read();
+            port->state = WAIT_AA;
             break;
         case WAIT_AA:
             // 1) Read BAT code and ID on keybaord power-up
@@ -239,110 +436,164 @@ uint8_t matrix_scan(void)
             // This can happen in case of keyboard hotswap, unstable hardware, signal integrity problem or bug
 
             /* wait until keyboard sends any code without 10000ms timeout
-            if (timer_elapsed(init_time) > 10000) {
-                state = READ_ID;
+            if (timer_elapsed(port->init_time) > 10000) {
+                port->state = READ_ID;
             }
             */
-            if (ibmpc_host_recv() != -1) {  // wait for AA
+            if (ibmpc_host_recv(host) != -1) {  // wait for AA
                 xprintf("W%u ", timer_read());
-                init_time = timer_read();
-                state = WAIT_AABF;
+                port->init_time = timer_read();
+                port->state = WAIT_AABF;
             }
             break;
         case WAIT_AABF:
             // NOTE: we can omit to wait BF BF
             // ID takes 500ms max? TechRef [8] 4-41, though 1ms is enough for 122-key Terminal 6110345
-            if (timer_elapsed(init_time) > 500) {
-                state = READ_ID;
+            if (timer_elapsed(port->init_time) > 500) {
+                port->state = READ_ID;
             }
-            if (ibmpc_host_recv() != -1) {  // wait for BF
+            if (ibmpc_host_recv(host) != -1) {  // wait for BF
                 xprintf("W%u ", timer_read());
-                init_time = timer_read();
-                state = WAIT_AABFBF;
+                port->init_time = timer_read();
+                port->state = WAIT_AABFBF;
             }
             break;
         case WAIT_AABFBF:
-            if (timer_elapsed(init_time) > 500) {
-                state = READ_ID;
+            if (timer_elapsed(port->init_time) > 500) {
+                port->state = READ_ID;
             }
-            if (ibmpc_host_recv() != -1) {  // wait for BF
+            if (ibmpc_host_recv(host) != -1) {  // wait for BF
                 xprintf("W%u ", timer_read());
-                state = READ_ID;
+                port->state = READ_ID;
             }
             break;
         case READ_ID:
-            keyboard_id = read_keyboard_id();
-            xprintf("R%u ", timer_read());
+            port->state = SETUP_KIND;
 
-            if (0x0000 == keyboard_id) {            // CodeSet2 AT(IBM PC AT 84-key)
-                keyboard_kind = PC_AT;
-            } else if (0xFFFF == keyboard_id) {     // CodeSet1 XT
-                keyboard_kind = PC_XT;
-            } else if (0xFFFE == keyboard_id) {     // CodeSet2 PS/2 fails to response?
-                keyboard_kind = PC_AT;
-            } else if (0xFFFD == keyboard_id) {     // Zenith Z-150 AT
-                keyboard_kind = PC_AT_Z150;
-            } else if (0x00FF == keyboard_id) {     // Mouse is not supported
-                xprintf("Mouse: not supported\n");
-                keyboard_kind = NONE;
+            // temporary fix Z-150 AT should response with ID
+            if (host->protocol == IBMPC_PROTOCOL_AT_Z150) { keyboard_id[n] = 0xFFFD; break; }
+
+            // Disable
+            //code = ibmpc_host_send(host, 0xF5);
+
+            // Read ID
+            port_command(port, READ_ID_ACK, 1, 0xF2, 0);
+            break;
+        case READ_ID_ACK:
+            port->state = SETUP_KIND;
+            if (port->cmd_result == -1) { keyboard_id[n] = 0xFFFF; break; }     // XT or No keyboard
+            if (port->cmd_result != 0xFA) { keyboard_id[n] = 0xFFFE; break; }   // Broken PS/2?
+
+            port->init_time = timer_read();
+            port->state = READ_ID_1ST;
+            break;
+        case READ_ID_1ST:
+            // ID takes 500ms max TechRef [8] 4-41
+            {
+                int16_t code = ibmpc_host_recv(host);
+                if (code != -1) {
+                    keyboard_id[n] = (code & 0xFF)<<8;
+                    port->init_time = timer_read();
+                    port->state = READ_ID_2ND;
+                } else if (timer_elapsed(port->init_time) > 500) {
+                    keyboard_id[n] = 0x0000;    // AT
+                    port->state = SETUP_KIND;
+                }
+            }
+            break;
+        case READ_ID_2ND:
+            // Mouse responds with one-byte 00, this returns 00FF [y] p.14
+            {
+                int16_t code = ibmpc_host_recv(host);
+                if (code != -1 || timer_elapsed(port->init_time) > 500) {
+                    keyboard_id[n] |= code & 0xFF;
+                    port->state = SETUP_KIND;
+                }
+            }
+            break;
+        case SETUP_KIND:
+            // Enable
+            //code = ibmpc_host_send(host, 0xF4);
+            xprintf("R%u ", timer_read());
+            port->state = SETUP;
+
+            if (0x0000 == keyboard_id[n]) {            // CodeSet2 AT(IBM PC AT 84-key)
+                keyboard_kind[n] = PC_AT;
+            } else if (0xFFFF == keyboard_id[n]) {     // CodeSet1 XT
+                keyboard_kind[n] = PC_XT;
+            } else if (0xFFFE == keyboard_id[n]) {     // CodeSet2 PS/2 fails to response?
+                keyboard_kind[n] = PC_AT;
+            } else if (0xFFFD == keyboard_id[n]) {     // Zenith Z-150 AT
+                keyboard_kind[n] = PC_AT_Z150;
+            } else if (0x00FF == keyboard_id[n] ||
+                       0x03FF == keyboard_id[n] ||
+                       0x04FF == keyboard_id[n]) {     // Mouse is not supported
+                // 2-byte buffer of ibmpc.c can't keep data FF(-1 in movement)
+                xprintf("\nID%u:%04X Mouse: not supported ", n, keyboard_id[n]);
+                keyboard_kind[n] = NONE;
+                ibmpc_host_disable(host);
+                port->state = DISABLED;
 #ifdef G80_2551_SUPPORT
-            } else if (0xAB86 == keyboard_id ||
-                       0xAB85 == keyboard_id) {     // For G80-2551 and other 122-key terminal
+            } else if (0xAB86 == keyboard_id[n] ||
+                       0xAB85 == keyboard_id[n]) {     // For G80-2551 and other 122-key terminal
                 // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#ab86
                 // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#ab85
 
-                if ((0xFA == ibmpc_host_send(0xF0)) &&
-                    (0xFA == ibmpc_host_send(0x03))) {
-                    // switch to code set 3
-                    keyboard_kind = PC_TERMINAL;
-                } else {
-                    keyboard_kind = PC_AT;
-                }
+                // switch to code set 3
+                port_command(port, SETUP_CS3, 2, 0xF0, 0x03);
 #endif
-            } else if (0xBFB0 == keyboard_id) {     // IBM RT Keyboard
+            } else if (0xBFB0 == keyboard_id[n]) {     // IBM RT Keyboard
                 // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#bfb0
                 // TODO: LED indicator fix
-                //keyboard_kind = PC_TERMINAL_IBM_RT;
-                keyboard_kind = PC_TERMINAL;
-            } else if (0xAB00 == (keyboard_id & 0xFF00)) {  // CodeSet2 PS/2
-                keyboard_kind = PC_AT;
-            } else if (0xBF00 == (keyboard_id & 0xFF00)) {  // CodeSet3 Terminal
-                keyboard_kind = PC_TERMINAL;
+                //keyboard_kind[n] = PC_TERMINAL_IBM_RT;
+                keyboard_kind[n] = PC_TERMINAL;
+            } else if (0xAB00 == (keyboard_id[n] & 0xFF00)) {  // CodeSet2 PS/2
+                keyboard_kind[n] = PC_AT;
+            } else if (0xBF00 == (keyboard_id[n] & 0xFF00)) {  // CodeSet3 Terminal
+                keyboard_kind[n] = PC_TERMINAL;
             } else {
-                keyboard_kind = PC_AT;
+                keyboard_kind[n] = PC_AT;
             }
-
-            xprintf("\nID:%04X(%s) ", keyboard_id, KEYBOARD_KIND_STR(keyboard_kind));
-
-            state = SETUP;
             break;
+#ifdef G80_2551_SUPPORT
+        case SETUP_CS3:
+            keyboard_kind[n] = (0xFA == port->cmd_result ? PC_TERMINAL : PC_AT);
+            port->state = SETUP;
+            break;
+#endif
         case SETUP:
+            xprintf("\nID%u:%04X(%s) ", n, keyboard_id[n], KEYBOARD_KIND_STR(keyboard_kind[n]));
             xprintf("S%u ", timer_read());
-            switch (keyboard_kind) {
+            port->state = LOOP;
+            switch (keyboard_kind[n]) {
                 case PC_XT:
                     break;
                 case PC_AT:
-                    led_set(host_keyboard_leds());
+                    port_set_led(port, ibmpc_led(host_keyboard_leds()));
                     break;
                 case PC_AT_Z150:
                     // TODO: do not set indicators temporarily for debug
                     break;
                 case PC_TERMINAL:
-                    // Set all keys to make/break type
-                    ibmpc_host_send(0xF8);
                     // This should not be harmful
-                    led_set(host_keyboard_leds());
+                    port_set_led(port, ibmpc_led(host_keyboard_leds()));
+                    // Set all keys to make/break type
+                    port_command(port, LOOP, 1, 0xF8, 0);
                     break;
                 default:
                     break;
             }
-            state = LOOP;
             xprintf("L%u ", timer_read());
+            break;
         case LOOP:
             {
-                uint16_t code = ibmpc_host_recv();
+                uint16_t code = ibmpc_host_recv(host);
                 if (code == -1) {
-                    // no code
+                    // no code: send LED command now, its response doesn't mix with scan codes
+                    if (port->led_pending) {
+                        port->led_pending = false;
+                        port_command(port, LOOP, 2, IBMPC_SET_LED, port->led);
+                    }
                     break;
                 }
 
@@ -351,33 +602,43 @@ uint8_t matrix_scan(void)
                 // Scan Code Set 2 and 3: 0x00
                 // Buffer full(IBMPC_ERR_FULL): 0xFF
                 if (code == 0x00 || code == 0xFF) {
-                    // clear stuck keys
-                    matrix_clear();
-                    clear_keyboard();
+                    // clear stuck keys of this port
+                    matrix_clear_port(port);
 
                     xprintf("\n[OVR] ");
                     break;
                 }
 
-                switch (keyboard_kind) {
+                switch (keyboard_kind[n]) {
                     case PC_XT:
-                        if (process_cs1(code) == -1) state = INIT;
+                        if (process_cs1(port, code) == -1) port->state = INIT;
                         break;
                     case PC_AT:
                     case PC_AT_Z150:
-                        if (process_cs2(code) == -1) state = INIT;
+                        if (process_cs2(port, code) == -1) port->state = INIT;
                         break;
                     case PC_TERMINAL:
-                        if (process_cs3(code) == -1) state = INIT;
+                        if (process_cs3(port, code) == -1) port->state = INIT;
                         break;
                     default:
                         break;
                 }
             }
             break;
+        case COMMAND:
+            port_command_task(port);
+            break;
+        case DISABLED:
         default:
             break;
     }
+}
+
+uint8_t matrix_scan(void)
+{
+    for (uint8_t i = 0; i < IBMPC_PORTS; i++) {
+        port_scan(&ports[i]);
+    }
     return 1;
 }
 
@@ -404,21 +665,26 @@ uint8_t matrix_key_count(void)
 
 
 inline
-static void matrix_make(uint8_t code)
+static void matrix_make(port_t *port, uint8_t code)
 {
-    if (!matrix_is_on(ROW(code), COL(code))) {
-        matrix[ROW(code)] |= 1<<COL(code);
+    if (!matrix_is_on(PORT_ROW(port, code), COL(code))) {
+        matrix[PORT_ROW(port, code)] |= 1<<COL(code);
     }
 }
 
 inline
-static void matrix_break(uint8_t code)
+static void matrix_break(port_t *port, uint8_t code)
 {
-    if (matrix_is_on(ROW(code), COL(code))) {
-        matrix[ROW(code)] &= ~(1<<COL(code));
+    if (matrix_is_on(PORT_ROW(port, code), COL(code))) {
+        matrix[PORT_ROW(port, code)] &= ~(1<<COL(code));
     }
 }
 
+static void matrix_clear_port(port_t *port)
+{
+    for (uint8_t i=0; i < PORT_MATRIX_ROWS; i++) matrix[port->id * PORT_MATRIX_ROWS + i] = 0x00;
+}
+
 void matrix_clear(void)
 {
     for (uint8_t i=0; i < MATRIX_ROWS; i++) matrix[i] = 0x00;
@@ -426,27 +692,39 @@ void matrix_clear(void)
 
 void led_set(uint8_t usb_led)
 {
-    // Sending before keyboard recognition may be harmful for XT keyboard
-    if (keyboard_kind == NONE) return;
-
-    // XT keyobard doesn't support any command and it is harmful perhaps
-    // https://github.com/tmk/tmk_keyboard/issues/635#issuecomment-626993437
-    if (keyboard_kind == PC_XT) return;
-
-    // It should be safe to send the command to keyboards with AT protocol
-    // - IBM Terminal doesn't support the command and response with 0xFE but it is not harmful.
-    // - Some other Terminals like G80-2551 supports the command.
-    //   https://geekhack.org/index.php?topic=103648.msg2894921#msg2894921
+    for (uint8_t i = 0; i < IBMPC_PORTS; i++) {
+        // Sending before keyboard recognition may be harmful for XT keyboard
+        if (keyboard_kind[i] == NONE) continue;
+
+        // XT keyobard doesn't support any command and it is harmful perhaps
+        // https://github.com/tmk/tmk_keyboard/issues/635#issuecomment-626993437
+        if (keyboard_kind[i] == PC_XT) continue;
+
+        // It should be safe to send the command to keyboards with AT protocol
+        // - IBM Terminal doesn't support the command and response with 0xFE but it is not harmful.
+        // - Some other Terminals like G80-2551 supports the command.
+        //   https://geekhack.org/index.php?topic=103648.msg2894921#msg2894921
+        // sent in matrix_scan() without blocking
+        port_set_led(&ports[i], ibmpc_led(usb_led));
+    }
+}
 
-    // TODO: PC_TERMINAL_IBM_RT support
-    uint8_t ibmpc_led = 0;
-    if (usb_led &  (1<<USB_LED_SCROLL_LOCK))
-        ibmpc_led |= (1<<IBMPC_LED_SCROLL_LOCK);
-    if (usb_led &  (1<<USB_LED_NUM_LOCK))
-        ibmpc_led |= (1<<IBMPC_LED_NUM_LOCK);
-    if (usb_led &  (1<<USB_LED_CAPS_LOCK))
-        ibmpc_led |= (1<<IBMPC_LED_CAPS_LOCK);
-    ibmpc_host_set_led(ibmpc_led);
+/* Port status and statistics */
+bool command_extra(uint8_t code)
+{
+    switch (code) {
+        case KC_I:
+            for (uint8_t i = 0; i < IBMPC_PORTS; i++) {
+                xprintf("\nPort%u: %04X(%s) PRT:%02X recv:%u err:%u latency_max:%ums", i,
+                        keyboard_id[i], KEYBOARD_KIND_STR(keyboard_kind[i]),
+                        ibmpc_host[i].protocol, ibmpc_host[i].recv_count,
+                        ibmpc_host[i].error_count, ibmpc_host[i].recv_latency_max);
+            }
+            print("\n");
+            return true;
+        default:
+            return false;
+    }
 }
 
 
@@ -488,130 +766,87 @@ void led_set(uint8_t usb_led)
  *     5E  Volume Down*     6E  F23x                7E  Keypad,x
  *     5F  Volume Up*       6F  Keypad Enter*       7F  Keypad/ *
  */
+static const uint8_t PROGMEM cs1_e0code_table[0x80] = {
+    // Original IBM XT keyboard doesn't use E0-codes probably
+    // Some XT compatilble keyobards need these keys?
+    [0x37] = XLAT(0x54), // Print Screen
+    [0x46] = XLAT(0x55), // Ctrl + Pause
+    [0x5B] = XLAT(0x5A), // Left  GUI
+    [0x5C] = XLAT(0x5B), // Right GUI
+    [0x5D] = XLAT(0x5C), // Application
+    [0x20] = XLAT(0x5D), // Mute
+    [0x2E] = XLAT(0x5E), // Volume Down
+    [0x30] = XLAT(0x5F), // Volume Up
+    [0x48] = XLAT(0x60), // Up
+    [0x4B] = XLAT(0x61), // Left
+    [0x50] = XLAT(0x62), // Down
+    [0x4D] = XLAT(0x63), // Right
+    [0x1C] = XLAT(0x6F), // Keypad Enter
+    [0x52] = XLAT(0x71), // Insert
+    [0x53] = XLAT(0x72), // Delete
+    [0x47] = XLAT(0x74), // Home
+    [0x4F] = XLAT(0x75), // End
+    [0x49] = XLAT(0x77), // Page Up
+    [0x51] = XLAT(0x78), // Page Down
+    [0x1D] = XLAT(0x7A), // Right Ctrl
+    [0x38] = XLAT(0x7C), // Right Alt
+    [0x35] = XLAT(0x7F), // Keypad /
+
+    // Shared matrix cell with other keys
+    [0x5E] = XLAT(0x70), // Power (KANA)
+    [0x5F] = XLAT(0x79), // Sleep (HENKAN)
+    [0x63] = XLAT(0x7B), // Wake  (MUHENKAN)
+};
+
 static uint8_t cs1_e0code(uint8_t code) {
-    switch(code) {
-        // Original IBM XT keyboard doesn't use E0-codes probably
-        // Some XT compatilble keyobards need these keys?
-        case 0x37: return 0x54; // Print Screen
-        case 0x46: return 0x55; // Ctrl + Pause
-        case 0x5B: return 0x5A; // Left  GUI
-        case 0x5C: return 0x5B; // Right GUI
-        case 0x5D: return 0x5C; // Application
-        case 0x20: return 0x5D; // Mute
-        case 0x2E: return 0x5E; // Volume Down
-        case 0x30: return 0x5F; // Volume Up
-        case 0x48: return 0x60; // Up
-        case 0x4B: return 0x61; // Left
-        case 0x50: return 0x62; // Down
-        case 0x4D: return 0x63; // Right
-        case 0x1C: return 0x6F; // Keypad Enter
-        case 0x52: return 0x71; // Insert
-        case 0x53: return 0x72; // Delete
-        case 0x47: return 0x74; // Home
-        case 0x4F: return 0x75; // End
-        case 0x49: return 0x77; // Page Up
-        case 0x51: return 0x78; // Page Down
-        case 0x1D: return 0x7A; // Right Ctrl
-        case 0x38: return 0x7C; // Right Alt
-        case 0x35: return 0x7F; // Keypad /
-
-        // Shared matrix cell with other keys
-        case 0x5E: return 0x70; // Power (KANA)
-        case 0x5F: return 0x79; // Sleep (HENKAN)
-        case 0x63: return 0x7B; // Wake  (MUHENKAN)
+    code &= 0x7F;
+    uint8_t c = pgm_read_byte(&cs1_e0code_table[code]);
+    if (c) return c & 0x7F;
 
-        default:
-           xprintf("!CS1_E0_%02X!\n", code);
-           return code;
-    }
-    return 0x00;
+    xprintf("!CS1_E0_%02X!\n", code);
+    return code;
 }
 
-static int8_t process_cs1(uint8_t code)
+enum {
+    CS1_INIT,
+    CS1_E0,
+    // Pause: E1 1D 45, E1 9D C5 [a]
+    CS1_E1,
+    CS1_E1_1D,
+    CS1_E1_9D,
+    CS1_STATES
+};
+
+static const cs_rule_t PROGMEM cs1_rules[] = {
+    // state        code        next        action
+    { CS1_INIT,     LOW,        CS1_INIT,   CS_MAKE },
+    { CS1_INIT,     IS(0xE0),   CS1_E0,     CS_NONE },
+    { CS1_INIT,     IS(0xE1),   CS1_E1,     CS_NONE },
+    { CS1_INIT,     ANY,        CS1_INIT,   CS_BREAK },
+
+    // ignore fake shift
+    { CS1_E0,       IS(0x2A),   CS1_INIT,   CS_NONE },
+    { CS1_E0,       IS(0x36),   CS1_INIT,   CS_NONE },
+    { CS1_E0,       LOW,        CS1_INIT,   CS_MAKE | CS_XLAT },
+    { CS1_E0,       IS(0xAA),   CS1_INIT,   CS_NONE },
+    { CS1_E0,       IS(0xB6),   CS1_INIT,   CS_NONE },
+    { CS1_E0,       ANY,        CS1_INIT,   CS_BREAK | CS_XLAT },
+
+    { CS1_E1,       IS(0x1D),   CS1_E1_1D,  CS_NONE },
+    { CS1_E1,       IS(0x9D),   CS1_E1_9D,  CS_NONE },
+    { CS1_E1,       ANY,        CS1_INIT,   CS_NONE },
+    { CS1_E1_1D,    IS(0x45),   CS1_INIT,   CS_MAKE | CS_FIXED, 0x55 },     // Pause
+    { CS1_E1_1D,    ANY,        CS1_INIT,   CS_NONE },
+    { CS1_E1_9D,    IS(0xC5),   CS1_INIT,   CS_BREAK | CS_FIXED, 0x55 },    // Pause
+    { CS1_E1_9D,    ANY,        CS1_INIT,   CS_NONE },
+    { CS_END },
+};
+
+static uint8_t cs1_index[CS1_STATES];
+
+static int8_t process_cs1(port_t *port, uint8_t code)
 {
-    static enum {
-        INIT,
-        E0,
-        // Pause: E1 1D 45, E1 9D C5 [a]
-        E1,
-        E1_1D,
-        E1_9D,
-    } state = INIT;
-
-    switch (state) {
-        case INIT:
-            switch (code) {
-                case 0xE0:
-                    state = E0;
-                    break;
-                case 0xE1:
-                    state = E1;
-                    break;
-                default:
-                    if (code < 0x80)
-                        matrix_make(code);
-                    else
-                        matrix_break(code & 0x7F);
-                    break;
-            }
-            break;
-        case E0:
-            switch (code) {
-                case 0x2A:
-                case 0xAA:
-                case 0x36:
-                case 0xB6:
-                    //ignore fake shift
-                    state = INIT;
-                    break;
-                default:
-                    if (code < 0x80)
-                        matrix_make(cs1_e0code(code));
-                    else
-                        matrix_break(cs1_e0code(code & 0x7F));
-                    state = INIT;
-                    break;
-            }
-            break;
-        case E1:
-            switch (code) {
-                case 0x1D:
-                    state = E1_1D;
-                    break;
-                case 0x9D:
-                    state = E1_9D;
-                    break;
-                default:
-                    state = INIT;
-                    break;
-            }
-            break;
-        case E1_1D:
-            switch (code) {
-                case 0x45:
-                    matrix_make(0x55); // Pause
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-                    break;
-            }
-            break;
-        case E1_9D:
-            switch (code) {
-                case 0xC5:
-                    matrix_break(0x55); // Pause
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-                    break;
-            }
-            break;
-        default:
-            state = INIT;
-    }
-    return 0;
+    return cs_process(port, code, cs1_rules, cs1_index, CS1_STATES, cs1_e0code, 1);
 }
 
 
@@ -679,227 +914,131 @@ static int8_t process_cs1(uint8_t code)
  * These two Korean keys need exceptional handling and are not supported for now.
  *
  */
+static const uint8_t PROGMEM cs2_e0code_table[0x80] = {
+    // E0 prefixed codes translation See [a].
+    [0x11] = XLAT(0x0F), // right alt
+    [0x14] = XLAT(0x17), // right control
+    [0x1F] = XLAT(0x19), // left GUI
+    [0x27] = XLAT(0x1F), // right GUI
+    [0x2F] = XLAT(0x5C), // apps
+    [0x4A] = XLAT(0x60), // keypad /
+    [0x5A] = XLAT(0x62), // keypad enter
+    [0x69] = XLAT(0x27), // end
+    [0x6B] = XLAT(0x53), // cursor left
+    [0x6C] = XLAT(0x2F), // home
+    [0x70] = XLAT(0x39), // insert
+    [0x71] = XLAT(0x37), // delete
+    [0x72] = XLAT(0x3F), // cursor down
+    [0x74] = XLAT(0x47), // cursor right
+    [0x75] = XLAT(0x4F), // cursor up
+    [0x7A] = XLAT(0x56), // page down
+    [0x7D] = XLAT(0x5E), // page up
+    [0x7C] = XLAT(0x7F), // Print Screen
+    [0x7E] = XLAT(0x00), // Control'd Pause
+
+    [0x21] = XLAT(0x65), // volume down
+    [0x32] = XLAT(0x6E), // volume up
+    [0x23] = XLAT(0x6F), // mute
+    [0x10] = XLAT(0x08), // (WWW search)     -> F13
+    [0x18] = XLAT(0x10), // (WWW favourites) -> F14
+    [0x20] = XLAT(0x18), // (WWW refresh)    -> F15
+    [0x28] = XLAT(0x20), // (WWW stop)       -> F16
+    [0x30] = XLAT(0x28), // (WWW forward)    -> F17
+    [0x38] = XLAT(0x30), // (WWW back)       -> F18
+    [0x3A] = XLAT(0x38), // (WWW home)       -> F19
+    [0x40] = XLAT(0x40), // (my computer)    -> F20
+    [0x48] = XLAT(0x48), // (email)          -> F21
+    [0x2B] = XLAT(0x50), // (calculator)     -> F22
+    [0x34] = XLAT(0x08), // (play/pause)     -> F13
+    [0x3B] = XLAT(0x10), // (stop)           -> F14
+    [0x15] = XLAT(0x18), // (previous track) -> F15
+    [0x4D] = XLAT(0x20), // (next track)     -> F16
+    [0x50] = XLAT(0x28), // (media select)   -> F17
+    [0x5E] = XLAT(0x50), // (ACPI wake)      -> F22
+    [0x3F] = XLAT(0x57), // (ACPI sleep)     -> F23
+    [0x37] = XLAT(0x5F), // (ACPI power)     -> F24
+
+    // https://github.com/tmk/tmk_keyboard/pull/636
+    [0x03] = XLAT(0x18), // Help        DEC LK411 -> F15
+    [0x04] = XLAT(0x08), // F13         DEC LK411
+    [0x0B] = XLAT(0x20), // Do          DEC LK411 -> F16
+    [0x0C] = XLAT(0x10), // F14         DEC LK411
+    [0x0D] = XLAT(0x19), // LCompose    DEC LK411 -> LGUI
+    [0x79] = XLAT(0x6D), // KP-         DEC LK411 -> PCMM
+    //[0x83] = XLAT(0x28), // F17       DEC LK411: E0-prefixed code over 7F is rejected in process_cs2()
+};
+
 static uint8_t cs2_e0code(uint8_t code) {
-    switch(code) {
-        // E0 prefixed codes translation See [a].
-        case 0x11: return 0x0F; // right alt
-        case 0x14: return 0x17; // right control
-        case 0x1F: return 0x19; // left GUI
-        case 0x27: return 0x1F; // right GUI
-        case 0x2F: return 0x5C; // apps
-        case 0x4A: return 0x60; // keypad /
-        case 0x5A: return 0x62; // keypad enter
-        case 0x69: return 0x27; // end
-        case 0x6B: return 0x53; // cursor left
-        case 0x6C: return 0x2F; // home
-        case 0x70: return 0x39; // insert
-        case 0x71: return 0x37; // delete
-        case 0x72: return 0x3F; // cursor down
-        case 0x74: return 0x47; // cursor right
-        case 0x75: return 0x4F; // cursor up
-        case 0x7A: return 0x56; // page down
-        case 0x7D: return 0x5E; // page up
-        case 0x7C: return 0x7F; // Print Screen
-        case 0x7E: return 0x00; // Control'd Pause
-
-        case 0x21: return 0x65; // volume down
-        case 0x32: return 0x6E; // volume up
-        case 0x23: return 0x6F; // mute
-        case 0x10: return 0x08; // (WWW search)     -> F13
-        case 0x18: return 0x10; // (WWW favourites) -> F14
-        case 0x20: return 0x18; // (WWW refresh)    -> F15
-        case 0x28: return 0x20; // (WWW stop)       -> F16
-        case 0x30: return 0x28; // (WWW forward)    -> F17
-        case 0x38: return 0x30; // (WWW back)       -> F18
-        case 0x3A: return 0x38; // (WWW home)       -> F19
-        case 0x40: return 0x40; // (my computer)    -> F20
-        case 0x48: return 0x48; // (email)          -> F21
-        case 0x2B: return 0x50; // (calculator)     -> F22
-        case 0x34: return 0x08; // (play/pause)     -> F13
-        case 0x3B: return 0x10; // (stop)           -> F14
-        case 0x15: return 0x18; // (previous track) -> F15
-        case 0x4D: return 0x20; // (next track)     -> F16
-        case 0x50: return 0x28; // (media select)   -> F17
-        case 0x5E: return 0x50; // (ACPI wake)      -> F22
-        case 0x3F: return 0x57; // (ACPI sleep)     -> F23
-        case 0x37: return 0x5F; // (ACPI power)     -> F24
-
-        // https://github.com/tmk/tmk_keyboard/pull/636
-        case 0x03: return 0x18; // Help        DEC LK411 -> F15
-        case 0x04: return 0x08; // F13         DEC LK411
-        case 0x0B: return 0x20; // Do          DEC LK411 -> F16
-        case 0x0C: return 0x10; // F14         DEC LK411
-        case 0x0D: return 0x19; // LCompose    DEC LK411 -> LGUI
-        case 0x79: return 0x6D; // KP-         DEC LK411 -> PCMM
-        case 0x83: return 0x28; // F17         DEC LK411
-        default: return (code & 0x7F);
-    }
+    uint8_t c = pgm_read_byte(&cs2_e0code_table[code & 0x7F]);
+    if (c) return c & 0x7F;
+    return (code & 0x7F);
 }
 
-static int8_t process_cs2(uint8_t code)
+enum {
+    CS2_INIT,
+    CS2_F0,
+    CS2_E0,
+    CS2_E0_F0,
+    // Pause
+    CS2_E1,
+    CS2_E1_14,
+    CS2_E1_F0,
+    CS2_E1_F0_14,
+    CS2_E1_F0_14_F0,
+    CS2_STATES
+};
+
+/* Codes 80-FF other than prefixes are error: replug or unstable connection probably */
+static const cs_rule_t PROGMEM cs2_rules[] = {
+    // state            code        next                action
+    { CS2_INIT,         LOW,        CS2_INIT,           CS_MAKE },
+    { CS2_INIT,         IS(0xF0),   CS2_F0,             CS_NONE },
+    { CS2_INIT,         IS(0xE0),   CS2_E0,             CS_NONE },
+    { CS2_INIT,         IS(0xE1),   CS2_E1,             CS_NONE },
+    { CS2_INIT,         IS(0x83),   CS2_INIT,           CS_MAKE | CS_FIXED, 0x02 },     // F7
+    { CS2_INIT,         IS(0x84),   CS2_INIT,           CS_MAKE | CS_FIXED, 0x7F },     // Alt'd PrintScreen
+    { CS2_INIT,         ANY,        CS2_INIT,           CS_CLEAR | CS_ERROR },          // AA, FC: Self-test
+
+    // E0-Prefixed
+    { CS2_E0,           IS(0x12),   CS2_INIT,           CS_NONE },      // to be ignored
+    { CS2_E0,           IS(0x59),   CS2_INIT,           CS_NONE },      // to be ignored
+    { CS2_E0,           LOW,        CS2_INIT,           CS_MAKE | CS_XLAT },
+    { CS2_E0,           IS(0xF0),   CS2_E0_F0,          CS_NONE },
+    { CS2_E0,           ANY,        CS2_INIT,           CS_CLEAR | CS_ERROR },
+
+    // Break code
+    { CS2_F0,           LOW,        CS2_INIT,           CS_BREAK },
+    { CS2_F0,           IS(0x83),   CS2_INIT,           CS_BREAK | CS_FIXED, 0x02 },    // F7
+    { CS2_F0,           IS(0x84),   CS2_INIT,           CS_BREAK | CS_FIXED, 0x7F },    // Alt'd PrintScreen
+    { CS2_F0,           ANY,        CS2_INIT,           CS_CLEAR | CS_ERROR },
+
+    // Break code of E0-prefixed
+    { CS2_E0_F0,        IS(0x12),   CS2_INIT,           CS_NONE },      // to be ignored
+    { CS2_E0_F0,        IS(0x59),   CS2_INIT,           CS_NONE },      // to be ignored
+    { CS2_E0_F0,        LOW,        CS2_INIT,           CS_BREAK | CS_XLAT },
+    { CS2_E0_F0,        ANY,        CS2_INIT,           CS_CLEAR | CS_ERROR },
+
+    // Pause make: E1 14 77
+    { CS2_E1,           IS(0x14),   CS2_E1_14,          CS_NONE },
+    { CS2_E1,           IS(0xF0),   CS2_E1_F0,          CS_NONE },
+    { CS2_E1,           ANY,        CS2_INIT,           CS_NONE },
+    { CS2_E1_14,        IS(0x77),   CS2_INIT,           CS_MAKE | CS_FIXED, 0x00 },
+    { CS2_E1_14,        ANY,        CS2_INIT,           CS_NONE },
+    // Pause break: E1 F0 14 F0 77
+    { CS2_E1_F0,        IS(0x14),   CS2_E1_F0_14,       CS_NONE },
+    { CS2_E1_F0,        ANY,        CS2_INIT,           CS_NONE },
+    { CS2_E1_F0_14,     IS(0xF0),   CS2_E1_F0_14_F0,    CS_NONE },
+    { CS2_E1_F0_14,     ANY,        CS2_INIT,           CS_NONE },
+    { CS2_E1_F0_14_F0,  IS(0x77),   CS2_INIT,           CS_BREAK | CS_FIXED, 0x00 },
+    { CS2_E1_F0_14_F0,  ANY,        CS2_INIT,           CS_NONE },
+    { CS_END },
+};
+
+static uint8_t cs2_index[CS2_STATES];
+
+static int8_t process_cs2(port_t *port, uint8_t code)
 {
-    // scan code reading states
-    static enum {
-        INIT,
-        F0,
-        E0,
-        E0_F0,
-        // Pause
-        E1,
-        E1_14,
-        E1_F0,
-        E1_F0_14,
-        E1_F0_14_F0,
-    } state = INIT;
-
-    switch (state) {
-        case INIT:
-            switch (code) {
-                case 0xE0:
-                    state = E0;
-                    break;
-                case 0xF0:
-                    state = F0;
-                    break;
-                case 0xE1:
-                    state = E1;
-                    break;
-                case 0x83:  // F7
-                    matrix_make(0x02);
-                    state = INIT;
-                    break;
-                case 0x84:  // Alt'd PrintScreen
-                    matrix_make(0x7F);
-                    state = INIT;
-                    break;
-                case 0xAA:  // Self-test passed
-                case 0xFC:  // Self-test failed
-                    // replug or unstable connection probably
-                default:    // normal key make
-                    state = INIT;
-                    if (code < 0x80) {
-                        matrix_make(code);
-                    } else {
-                        matrix_clear();
-                        xprintf("!CS2_INIT!\n");
-                        return -1;
-                    }
-            }
-            break;
-        case E0:    // E0-Prefixed
-            switch (code) {
-                case 0x12:  // to be ignored
-                case 0x59:  // to be ignored
-                    state = INIT;
-                    break;
-                case 0xF0:
-                    state = E0_F0;
-                    break;
-                default:
-                    state = INIT;
-                    if (code < 0x80) {
-                        matrix_make(cs2_e0code(code));
-                    } else {
-                        matrix_clear();
-                        xprintf("!CS2_E0!\n");
-                        return -1;
-                    }
-            }
-            break;
-        case F0:    // Break code
-            switch (code) {
-                case 0x83:  // F7
-                    matrix_break(0x02);
-                    state = INIT;
-                    break;
-                case 0x84:  // Alt'd PrintScreen
-                    matrix_break(0x7F);
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-                    if (code < 0x80) {
-                        matrix_break(code);
-                    } else {
-                        matrix_clear();
-                        xprintf("!CS2_F0!\n");
-                        return -1;
-                    }
-            }
-            break;
-        case E0_F0: // Break code of E0-prefixed
-            switch (code) {
-                case 0x12:  // to be ignored
-                case 0x59:  // to be ignored
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-                    if (code < 0x80) {
-                        matrix_break(cs2_e0code(code));
-                    } else {
-                        matrix_clear();
-                        xprintf("!CS2_E0_F0!\n");
-                        return -1;
-                    }
-            }
-            break;
-        // Pause make: E1 14 77
-        case E1:
-            switch (code) {
-                case 0x14:
-                    state = E1_14;
-                    break;
-                case 0xF0:
-                    state = E1_F0;
-                    break;
-                default:
-                    state = INIT;
-            }
-            break;
-        case E1_14:
-            switch (code) {
-                case 0x77:
-                    matrix_make(0x00);
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-            }
-            break;
-        // Pause break: E1 F0 14 F0 77
-        case E1_F0:
-            switch (code) {
-                case 0x14:
-                    state = E1_F0_14;
-                    break;
-                default:
-                    state = INIT;
-            }
-            break;
-        case E1_F0_14:
-            switch (code) {
-                case 0xF0:
-                    state = E1_F0_14_F0;
-                    break;
-                default:
-                    state = INIT;
-            }
-            break;
-        case E1_F0_14_F0:
-            switch (code) {
-                case 0x77:
-                    matrix_break(0x00);
-                    state = INIT;
-                    break;
-                default:
-                    state = INIT;
-            }
-            break;
-        default:
-            state = INIT;
-    }
-    return 0;
+    return cs_process(port, code, cs2_rules, cs2_index, CS2_STATES, cs2_e0code, 2);
 }
 
 /*
@@ -908,160 +1047,83 @@ static int8_t process_cs2(uint8_t code)
  * See [3], [7] and
  * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#scan-code-set-3
  */
-static int8_t process_cs3(uint8_t code)
-{
-    static enum {
-        READY,
-        F0,
+/* Codes 80-8F translation, G80-2551 prefix 80 is handled in cs3_rules */
+static const uint8_t PROGMEM cs3_80code_table[0x10] = {
+    [0x03] = XLAT(0x02), // PrintScreen
+    [0x04] = XLAT(0x7F), // Keypad *
+    [0x05] = XLAT(0x0B), // Muhenkan
+    [0x06] = XLAT(0x06), // Henkan
+    [0x07] = XLAT(0x00), // Hiragana
+    [0x0B] = XLAT(0x01), // Left GUI
+    [0x0C] = XLAT(0x09), // Right GUI
+    [0x0D] = XLAT(0x0A), // Application
+};
+
+/* returns FF when the code has no translation */
+static uint8_t cs3_80code(uint8_t code) {
+    if ((code & 0xF0) != 0x80) return 0xFF;
+    uint8_t c = pgm_read_byte(&cs3_80code_table[code & 0x0F]);
+    if (c) return c & 0x7F;
+    return 0xFF;
+}
+
+enum {
+    CS3_READY,
+    CS3_F0,
 #ifdef G80_2551_SUPPORT
-        // G80-2551 four extra keys around cursor keys
-        G80,
-        G80_F0,
+    // G80-2551 four extra keys around cursor keys
+    CS3_G80,
+    CS3_G80_F0,
 #endif
-    } state = READY;
+    CS3_STATES
+};
 
-    switch (state) {
-        case READY:
-            switch (code) {
-                case 0xF0:
-                    state = F0;
-                    break;
-                case 0x83:  // PrintScreen
-                    matrix_make(0x02);
-                    break;
-                case 0x84:  // Keypad *
-                    matrix_make(0x7F);
-                    break;
-                case 0x85:  // Muhenkan
-                    matrix_make(0x0B);
-                    break;
-                case 0x86:  // Henkan
-                    matrix_make(0x06);
-                    break;
-                case 0x87:  // Hiragana
-                    matrix_make(0x00);
-                    break;
-                case 0x8B:  // Left GUI
-                    matrix_make(0x01);
-                    break;
-                case 0x8C:  // Right GUI
-                    matrix_make(0x09);
-                    break;
-                case 0x8D:  // Application
-                    matrix_make(0x0A);
-                    break;
+static const cs_rule_t PROGMEM cs3_rules[] = {
+    // state        code        next        action
+    { CS3_READY,    LOW,        CS3_READY,  CS_MAKE },
+    { CS3_READY,    IS(0xF0),   CS3_F0,     CS_NONE },
 #ifdef G80_2551_SUPPORT
-                case 0x80:  // G80-2551 four extra keys around cursor keys
-                    state = G80;
-                    break;
+    { CS3_READY,    IS(0x80),   CS3_G80,    CS_NONE },
 #endif
-                default:    // normal key make
-                    if (code < 0x80) {
-                        matrix_make(code);
-                    } else {
-                        xprintf("!CS3_READY!\n");
-                        return -1;
-                    }
-            }
-            break;
-        case F0:    // Break code
-            switch (code) {
-                case 0x83:  // PrintScreen
-                    matrix_break(0x02);
-                    state = READY;
-                    break;
-                case 0x84:  // Keypad *
-                    matrix_break(0x7F);
-                    state = READY;
-                    break;
-                case 0x85:  // Muhenkan
-                    matrix_break(0x0B);
-                    state = READY;
-                    break;
-                case 0x86:  // Henkan
-                    matrix_break(0x06);
-                    state = READY;
-                    break;
-                case 0x87:  // Hiragana
-                    matrix_break(0x00);
-                    state = READY;
-                    break;
-                case 0x8B:  // Left GUI
-                    matrix_break(0x01);
-                    state = READY;
-                    break;
-                case 0x8C:  // Right GUI
-                    matrix_break(0x09);
-                    state = READY;
-                    break;
-                case 0x8D:  // Application
-                    matrix_break(0x0A);
-                    state = READY;
-                    break;
-                default:
-                    state = READY;
-                    if (code < 0x80) {
-                        matrix_break(code);
-                    } else {
-                        xprintf("!CS3_F0!\n");
-                        return -1;
-                    }
-            }
-            break;
+    { CS3_READY,    ANY,        CS3_READY,  CS_MAKE | CS_XLAT },
+
+    // Break code
+    { CS3_F0,       LOW,        CS3_READY,  CS_BREAK },
+    { CS3_F0,       ANY,        CS3_READY,  CS_BREAK | CS_XLAT },
+
 #ifdef G80_2551_SUPPORT
-        /*
-         * G80-2551 terminal keyboard support
-         * https://deskthority.net/wiki/Cherry_G80-2551
-         * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#g80-2551-in-code-set-3
-         */
-        case G80:   // G80-2551 four extra keys around cursor keys
-            switch (code) {
-                case (0x26):    // TD= -> JYEN
-                    matrix_make(0x5D);
-                    break;
-                case (0x25):    // page with edge -> NUHS
-                    matrix_make(0x53);
-                    break;
-                case (0x16):    // two pages -> RO
-                    matrix_make(0x51);
-                    break;
-                case (0x1E):    // calc -> KANA
-                    matrix_make(0x00);
-                    break;
-                case (0xF0):
-                    state = G80_F0;
-                    return 0;
-                default:
-                    // Not supported
-                    matrix_clear();
-                    break;
-            }
-            state = READY;
-            break;
-        case G80_F0:
-            switch (code) {
-                case (0x26):    // TD= -> JYEN
-                    matrix_break(0x5D);
-                    break;
-                case (0x25):    // page with edge -> NUHS
-                    matrix_break(0x53);
-                    break;
-                case (0x16):    // two pages -> RO
-                    matrix_break(0x51);
-                    break;
-                case (0x1E):    // calc -> KANA
-                    matrix_break(0x00);
-                    break;
-                default:
-                    // Not supported
-                    matrix_clear();
-                    break;
-            }
-            state = READY;
-            break;
+    /*
+     * G80-2551 terminal keyboard support
+     * https://deskthority.net/wiki/Cherry_G80-2551
+     * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#g80-2551-in-code-set-3
+     */
+    { CS3_G80,      IS(0x26),   CS3_READY,  CS_MAKE | CS_FIXED, 0x5D },     // TD= -> JYEN
+    { CS3_G80,      IS(0x25),   CS3_READY,  CS_MAKE | CS_FIXED, 0x53 },     // page with edge -> NUHS
+    { CS3_G80,      IS(0x16),   CS3_READY,  CS_MAKE | CS_FIXED, 0x51 },     // two pages -> RO
+    { CS3_G80,      IS(0x1E),   CS3_READY,  CS_MAKE | CS_FIXED, 0x00 },     // calc -> KANA
+    { CS3_G80,      IS(0xF0),   CS3_G80_F0, CS_NONE },
+    { CS3_G80,      ANY,        CS3_READY,  CS_CLEAR },                     // Not supported
+    { CS3_G80_F0,   IS(0x26),   CS3_READY,  CS_BREAK | CS_FIXED, 0x5D },    // TD= -> JYEN
+    { CS3_G80_F0,   IS(0x25),   CS3_READY,  CS_BREAK | CS_FIXED, 0x53 },    // page with edge -> NUHS
+    { CS3_G80_F0,   IS(0x16),   CS3_READY,  CS_BREAK | CS_FIXED, 0x51 },    // two pages -> RO
+    { CS3_G80_F0,   IS(0x1E),   CS3_READY,  CS_BREAK | CS_FIXED, 0x00 },    // calc -> KANA
+    { CS3_G80_F0,   ANY,        CS3_READY,  CS_CLEAR },                     // Not supported
 #endif
-    }
-    return 0;
+    { CS_END },
+};
+
+static uint8_t cs3_index[CS3_STATES];
+
+static int8_t process_cs3(port_t *port, uint8_t code)
+{
+    return cs_process(port, code, cs3_rules, cs3_index, CS3_STATES, cs3_80code, 3);
+}
+
+static void cs_init(void)
+{
+    cs_index(cs1_rules, cs1_index, CS1_STATES);
+    cs_index(cs2_rules, cs2_index, CS2_STATES);
+    cs_index(cs3_rules, cs3_index, CS3_STATES);
 }
 
 /*
@@ -10,7 +10,11 @@ typedef enum { NONE, PC_XT, PC_AT, PC_TERMINAL, PC_AT_Z150 } keyboard_kind_t;
      "NONE")
 
 
-extern uint16_t keyboard_id;
-extern keyboard_kind_t keyboard_kind;
+/* matrix rows for each port: keycode bit 6-3 */
+#define PORT_MATRIX_ROWS    16
+
+/* per port */
+extern uint16_t keyboard_id[];
+extern keyboard_kind_t keyboard_kind[];
 
 #endif
@@ -0,0 +1,509 @@
+/*
+ * Switch-based scan code decoders of ibmpc_usb.c before the rule tables,
+ * kept as reference for replay.c. State is static as in the original; matrix
+ * functions take the port in place of the global matrix.
+ */
+static uint8_t ref_cs1_e0code(uint8_t code) {
+    switch(code) {
+        // Original IBM XT keyboard doesn't use E0-codes probably
+        // Some XT compatilble keyobards need these keys?
+        case 0x37: return 0x54; // Print Screen
+        case 0x46: return 0x55; // Ctrl + Pause
+        case 0x5B: return 0x5A; // Left  GUI
+        case 0x5C: return 0x5B; // Right GUI
+        case 0x5D: return 0x5C; // Application
+        case 0x20: return 0x5D; // Mute
+        case 0x2E: return 0x5E; // Volume Down
+        case 0x30: return 0x5F; // Volume Up
+        case 0x48: return 0x60; // Up
+        case 0x4B: return 0x61; // Left
+        case 0x50: return 0x62; // Down
+        case 0x4D: return 0x63; // Right
+        case 0x1C: return 0x6F; // Keypad Enter
+        case 0x52: return 0x71; // Insert
+        case 0x53: return 0x72; // Delete
+        case 0x47: return 0x74; // Home
+        case 0x4F: return 0x75; // End
+        case 0x49: return 0x77; // Page Up
+        case 0x51: return 0x78; // Page Down
+        case 0x1D: return 0x7A; // Right Ctrl
+        case 0x38: return 0x7C; // Right Alt
+        case 0x35: return 0x7F; // Keypad /
+
+        // Shared matrix cell with other keys
+        case 0x5E: return 0x70; // Power (KANA)
+        case 0x5F: return 0x79; // Sleep (HENKAN)
+        case 0x63: return 0x7B; // Wake  (MUHENKAN)
+
+        default:
+           xprintf("!CS1_E0_%02X!\n", code);
+           return code;
+    }
+    return 0x00;
+}
+
+static int8_t ref_cs1(port_t *port, uint8_t code)
+{
+    static enum {
+        INIT,
+        E0,
+        // Pause: E1 1D 45, E1 9D C5 [a]
+        E1,
+        E1_1D,
+        E1_9D,
+    } state = INIT;
+
+    switch (state) {
+        case INIT:
+            switch (code) {
+                case 0xE0:
+                    state = E0;
+                    break;
+                case 0xE1:
+                    state = E1;
+                    break;
+                default:
+                    if (code < 0x80)
+                        matrix_make(port, code);
+                    else
+                        matrix_break(port, code & 0x7F);
+                    break;
+            }
+            break;
+        case E0:
+            switch (code) {
+                case 0x2A:
+                case 0xAA:
+                case 0x36:
+                case 0xB6:
+                    //ignore fake shift
+                    state = INIT;
+                    break;
+                default:
+                    if (code < 0x80)
+                        matrix_make(port, ref_cs1_e0code(code));
+                    else
+                        matrix_break(port, ref_cs1_e0code(code & 0x7F));
+                    state = INIT;
+                    break;
+            }
+            break;
+        case E1:
+            switch (code) {
+                case 0x1D:
+                    state = E1_1D;
+                    break;
+                case 0x9D:
+                    state = E1_9D;
+                    break;
+                default:
+                    state = INIT;
+                    break;
+            }
+            break;
+        case E1_1D:
+            switch (code) {
+                case 0x45:
+                    matrix_make(port, 0x55); // Pause
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+                    break;
+            }
+            break;
+        case E1_9D:
+            switch (code) {
+                case 0xC5:
+                    matrix_break(port, 0x55); // Pause
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+                    break;
+            }
+            break;
+        default:
+            state = INIT;
+    }
+    return 0;
+}
+
+static uint8_t ref_cs2_e0code(uint8_t code) {
+    switch(code) {
+        // E0 prefixed codes translation See [a].
+        case 0x11: return 0x0F; // right alt
+        case 0x14: return 0x17; // right control
+        case 0x1F: return 0x19; // left GUI
+        case 0x27: return 0x1F; // right GUI
+        case 0x2F: return 0x5C; // apps
+        case 0x4A: return 0x60; // keypad /
+        case 0x5A: return 0x62; // keypad enter
+        case 0x69: return 0x27; // end
+        case 0x6B: return 0x53; // cursor left
+        case 0x6C: return 0x2F; // home
+        case 0x70: return 0x39; // insert
+        case 0x71: return 0x37; // delete
+        case 0x72: return 0x3F; // cursor down
+        case 0x74: return 0x47; // cursor right
+        case 0x75: return 0x4F; // cursor up
+        case 0x7A: return 0x56; // page down
+        case 0x7D: return 0x5E; // page up
+        case 0x7C: return 0x7F; // Print Screen
+        case 0x7E: return 0x00; // Control'd Pause
+
+        case 0x21: return 0x65; // volume down
+        case 0x32: return 0x6E; // volume up
+        case 0x23: return 0x6F; // mute
+        case 0x10: return 0x08; // (WWW search)     -> F13
+        case 0x18: return 0x10; // (WWW favourites) -> F14
+        case 0x20: return 0x18; // (WWW refresh)    -> F15
+        case 0x28: return 0x20; // (WWW stop)       -> F16
+        case 0x30: return 0x28; // (WWW forward)    -> F17
+        case 0x38: return 0x30; // (WWW back)       -> F18
+        case 0x3A: return 0x38; // (WWW home)       -> F19
+        case 0x40: return 0x40; // (my computer)    -> F20
+        case 0x48: return 0x48; // (email)          -> F21
+        case 0x2B: return 0x50; // (calculator)     -> F22
+        case 0x34: return 0x08; // (play/pause)     -> F13
+        case 0x3B: return 0x10; // (stop)           -> F14
+        case 0x15: return 0x18; // (previous track) -> F15
+        case 0x4D: return 0x20; // (next track)     -> F16
+        case 0x50: return 0x28; // (media select)   -> F17
+        case 0x5E: return 0x50; // (ACPI wake)      -> F22
+        case 0x3F: return 0x57; // (ACPI sleep)     -> F23
+        case 0x37: return 0x5F; // (ACPI power)     -> F24
+
+        // https://github.com/tmk/tmk_keyboard/pull/636
+        case 0x03: return 0x18; // Help        DEC LK411 -> F15
+        case 0x04: return 0x08; // F13         DEC LK411
+        case 0x0B: return 0x20; // Do          DEC LK411 -> F16
+        case 0x0C: return 0x10; // F14         DEC LK411
+        case 0x0D: return 0x19; // LCompose    DEC LK411 -> LGUI
+        case 0x79: return 0x6D; // KP-         DEC LK411 -> PCMM
+        case 0x83: return 0x28; // F17         DEC LK411
+        default: return (code & 0x7F);
+    }
+}
+
+static int8_t ref_cs2(port_t *port, uint8_t code)
+{
+    // scan code reading states
+    static enum {
+        INIT,
+        F0,
+        E0,
+        E0_F0,
+        // Pause
+        E1,
+        E1_14,
+        E1_F0,
+        E1_F0_14,
+        E1_F0_14_F0,
+    } state = INIT;
+
+    switch (state) {
+        case INIT:
+            switch (code) {
+                case 0xE0:
+                    state = E0;
+                    break;
+                case 0xF0:
+                    state = F0;
+                    break;
+                case 0xE1:
+                    state = E1;
+                    break;
+                case 0x83:  // F7
+                    matrix_make(port, 0x02);
+                    state = INIT;
+                    break;
+                case 0x84:  // Alt'd PrintScreen
+                    matrix_make(port, 0x7F);
+                    state = INIT;
+                    break;
+                case 0xAA:  // Self-test passed
+                case 0xFC:  // Self-test failed
+                    // replug or unstable connection probably
+                default:    // normal key make
+                    state = INIT;
+                    if (code < 0x80) {
+                        matrix_make(port, code);
+                    } else {
+                        matrix_clear_port(port);
+                        xprintf("!CS2_INIT!\n");
+                        return -1;
+                    }
+            }
+            break;
+        case E0:    // E0-Prefixed
+            switch (code) {
+                case 0x12:  // to be ignored
+                case 0x59:  // to be ignored
+                    state = INIT;
+                    break;
+                case 0xF0:
+                    state = E0_F0;
+                    break;
+                default:
+                    state = INIT;
+                    if (code < 0x80) {
+                        matrix_make(port, ref_cs2_e0code(code));
+                    } else {
+                        matrix_clear_port(port);
+                        xprintf("!CS2_E0!\n");
+                        return -1;
+                    }
+            }
+            break;
+        case F0:    // Break code
+            switch (code) {
+                case 0x83:  // F7
+                    matrix_break(port, 0x02);
+                    state = INIT;
+                    break;
+                case 0x84:  // Alt'd PrintScreen
+                    matrix_break(port, 0x7F);
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+                    if (code < 0x80) {
+                        matrix_break(port, code);
+                    } else {
+                        matrix_clear_port(port);
+                        xprintf("!CS2_F0!\n");
+                        return -1;
+                    }
+            }
+            break;
+        case E0_F0: // Break code of E0-prefixed
+            switch (code) {
+                case 0x12:  // to be ignored
+                case 0x59:  // to be ignored
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+                    if (code < 0x80) {
+                        matrix_break(port, ref_cs2_e0code(code));
+                    } else {
+                        matrix_clear_port(port);
+                        xprintf("!CS2_E0_F0!\n");
+                        return -1;
+                    }
+            }
+            break;
+        // Pause make: E1 14 77
+        case E1:
+            switch (code) {
+                case 0x14:
+                    state = E1_14;
+                    break;
+                case 0xF0:
+                    state = E1_F0;
+                    break;
+                default:
+                    state = INIT;
+            }
+            break;
+        case E1_14:
+            switch (code) {
+                case 0x77:
+                    matrix_make(port, 0x00);
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+            }
+            break;
+        // Pause break: E1 F0 14 F0 77
+        case E1_F0:
+            switch (code) {
+                case 0x14:
+                    state = E1_F0_14;
+                    break;
+                default:
+                    state = INIT;
+            }
+            break;
+        case E1_F0_14:
+            switch (code) {
+                case 0xF0:
+                    state = E1_F0_14_F0;
+                    break;
+                default:
+                    state = INIT;
+            }
+            break;
+        case E1_F0_14_F0:
+            switch (code) {
+                case 0x77:
+                    matrix_break(port, 0x00);
+                    state = INIT;
+                    break;
+                default:
+                    state = INIT;
+            }
+            break;
+        default:
+            state = INIT;
+    }
+    return 0;
+}
+
+static int8_t ref_cs3(port_t *port, uint8_t code)
+{
+    static enum {
+        READY,
+        F0,
+#ifdef G80_2551_SUPPORT
+        // G80-2551 four extra keys around cursor keys
+        G80,
+        G80_F0,
+#endif
+    } state = READY;
+
+    switch (state) {
+        case READY:
+            switch (code) {
+                case 0xF0:
+                    state = F0;
+                    break;
+                case 0x83:  // PrintScreen
+                    matrix_make(port, 0x02);
+                    break;
+                case 0x84:  // Keypad *
+                    matrix_make(port, 0x7F);
+                    break;
+                case 0x85:  // Muhenkan
+                    matrix_make(port, 0x0B);
+                    break;
+                case 0x86:  // Henkan
+                    matrix_make(port, 0x06);
+                    break;
+                case 0x87:  // Hiragana
+                    matrix_make(port, 0x00);
+                    break;
+                case 0x8B:  // Left GUI
+                    matrix_make(port, 0x01);
+                    break;
+                case 0x8C:  // Right GUI
+                    matrix_make(port, 0x09);
+                    break;
+                case 0x8D:  // Application
+                    matrix_make(port, 0x0A);
+                    break;
+#ifdef G80_2551_SUPPORT
+                case 0x80:  // G80-2551 four extra keys around cursor keys
+                    state = G80;
+                    break;
+#endif
+                default:    // normal key make
+                    if (code < 0x80) {
+                        matrix_make(port, code);
+                    } else {
+                        xprintf("!CS3_READY!\n");
+                        return -1;
+                    }
+            }
+            break;
+        case F0:    // Break code
+            switch (code) {
+                case 0x83:  // PrintScreen
+                    matrix_break(port, 0x02);
+                    state = READY;
+                    break;
+                case 0x84:  // Keypad *
+                    matrix_break(port, 0x7F);
+                    state = READY;
+                    break;
+                case 0x85:  // Muhenkan
+                    matrix_break(port, 0x0B);
+                    state = READY;
+                    break;
+                case 0x86:  // Henkan
+                    matrix_break(port, 0x06);
+                    state = READY;
+                    break;
+                case 0x87:  // Hiragana
+                    matrix_break(port, 0x00);
+                    state = READY;
+                    break;
+                case 0x8B:  // Left GUI
+                    matrix_break(port, 0x01);
+                    state = READY;
+                    break;
+                case 0x8C:  // Right GUI
+                    matrix_break(port, 0x09);
+                    state = READY;
+                    break;
+                case 0x8D:  // Application
+                    matrix_break(port, 0x0A);
+                    state = READY;
+                    break;
+                default:
+                    state = READY;
+                    if (code < 0x80) {
+                        matrix_break(port, code);
+                    } else {
+                        xprintf("!CS3_F0!\n");
+                        return -1;
+                    }
+            }
+            break;
+#ifdef G80_2551_SUPPORT
+        /*
+         * G80-2551 terminal keyboard support
+         * https://deskthority.net/wiki/Cherry_G80-2551
+         * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#g80-2551-in-code-set-3
+         */
+        case G80:   // G80-2551 four extra keys around cursor keys
+            switch (code) {
+                case (0x26):    // TD= -> JYEN
+                    matrix_make(port, 0x5D);
+                    break;
+                case (0x25):    // page with edge -> NUHS
+                    matrix_make(port, 0x53);
+                    break;
+                case (0x16):    // two pages -> RO
+                    matrix_make(port, 0x51);
+                    break;
+                case (0x1E):    // calc -> KANA
+                    matrix_make(port, 0x00);
+                    break;
+                case (0xF0):
+                    state = G80_F0;
+                    return 0;
+                default:
+                    // Not supported
+                    matrix_clear_port(port);
+                    break;
+            }
+            state = READY;
+            break;
+        case G80_F0:
+            switch (code) {
+                case (0x26):    // TD= -> JYEN
+                    matrix_break(port, 0x5D);
+                    break;
+                case (0x25):    // page with edge -> NUHS
+                    matrix_break(port, 0x53);
+                    break;
+                case (0x16):    // two pages -> RO
+                    matrix_break(port, 0x51);
+                    break;
+                case (0x1E):    // calc -> KANA
+                    matrix_break(port, 0x00);
+                    break;
+                default:
+                    // Not supported
+                    matrix_clear_port(port);
+                    break;
+            }
+            state = READY;
+            break;
+#endif
+    }
+    return 0;
+}
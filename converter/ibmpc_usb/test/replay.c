@@ -0,0 +1,233 @@
+/*
+ * Scan code decoder replay test
+ *
+ * Feeds the same scan code streams to the rule table decoder of ibmpc_usb.c
+ * (port 0) and to the switch-based decoder it replaced (ref_decoder.c, port 1),
+ * and checks that both return the same result and leave the same matrix rows
+ * after every byte. Decoding time per byte of each decoder is also shown for the
+ * mixed stream and for a stream of plain make and break codes.
+ *
+ * Build and run on host:
+ *     $ make
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* host replacements of AVR and ibmpc.h */
+#define PROGMEM_H
+#define PROGMEM
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+
+#define PRINT_H__
+#define xprintf(...)        do { } while (0)
+#define print(s)            do { } while (0)
+
+#define MATRIX_ROWS         32
+#define MATRIX_COLS         8
+
+#define IBMPC_H
+#define IBMPC_PORTS         2
+#define IBMPC_PROTOCOL_AT       0x10
+#define IBMPC_PROTOCOL_AT_Z150  0x11
+#define IBMPC_PROTOCOL_XT       0x20
+#define IBMPC_ERR_NONE      0
+#define IBMPC_ERR_SEND      0x10
+#define IBMPC_ERR_FULL      0x40
+#define IBMPC_SET_LED       0xED
+#define IBMPC_LED_SCROLL_LOCK   0
+#define IBMPC_LED_NUM_LOCK      1
+#define IBMPC_LED_CAPS_LOCK     2
+#define IBMPC_RST_HIZ()
+#define IBMPC_RST_LO()
+typedef struct {
+    uint16_t isr_debug;
+    uint8_t protocol;
+    uint8_t error;
+    uint8_t recv_latency_max;
+    uint16_t recv_count;
+    uint16_t error_count;
+} ibmpc_t;
+ibmpc_t ibmpc_host[IBMPC_PORTS];
+void ibmpc_host_init(ibmpc_t *host) { (void)host; }
+void ibmpc_host_enable(ibmpc_t *host) { (void)host; }
+void ibmpc_host_disable(ibmpc_t *host) { (void)host; }
+void ibmpc_host_isr_clear(ibmpc_t *host) { (void)host; }
+void ibmpc_host_set_led(ibmpc_t *host, uint8_t led) { (void)host; (void)led; }
+void ibmpc_host_send_start(ibmpc_t *host, uint8_t data) { (void)host; (void)data; }
+bool ibmpc_host_sending(ibmpc_t *host) { (void)host; return false; }
+int16_t ibmpc_host_recv(ibmpc_t *host) { (void)host; return -1; }
+
+/* tmk_core functions referred to */
+#include "timer.h"
+#include "host.h"
+#include "util.h"
+#include "debug.h"
+debug_config_t debug_config;
+uint16_t timer_read(void) { return 0; }
+uint16_t timer_elapsed(uint16_t last) { (void)last; return 0; }
+uint8_t host_keyboard_leds(void) { return 0; }
+uint8_t bitpop(uint8_t bits) { return __builtin_popcount(bits); }
+
+#include "../ibmpc_usb.c"
+#include "ref_decoder.c"
+
+
+#define NEW     (&ports[0])
+#define REF     (&ports[1])
+
+typedef int8_t (*decoder_t)(port_t *port, uint8_t code);
+
+static uint32_t rand_state = 1;
+static uint8_t rand8(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 16;
+}
+
+/* Stream of keys with prefixes and Pause sequences mixed in, also broken ones and garbage */
+static const uint8_t cs1_seqs[][6] = {
+    { 1, 0xE0 }, { 1, 0xE1 }, { 2, 0xE0, 0x2A }, { 2, 0xE0, 0xB6 },
+    { 3, 0xE1, 0x1D, 0x45 }, { 3, 0xE1, 0x9D, 0xC5 }, { 2, 0xE1, 0x1D },
+};
+static const uint8_t cs2_seqs[][6] = {
+    { 1, 0xE0 }, { 1, 0xF0 }, { 2, 0xE0, 0xF0 }, { 2, 0xE0, 0x12 }, { 3, 0xE0, 0xF0, 0x59 },
+    { 3, 0xE1, 0x14, 0x77 }, { 5, 0xE1, 0xF0, 0x14, 0xF0, 0x77 }, { 3, 0xE1, 0xF0, 0x14 },
+    { 1, 0x83 }, { 2, 0xF0, 0x84 }, { 2, 0xE0, 0x7E }, { 1, 0xAA },
+};
+static const uint8_t cs3_seqs[][6] = {
+    { 1, 0xF0 }, { 1, 0x80 }, { 2, 0x80, 0x26 }, { 3, 0x80, 0xF0, 0x1E },
+    { 1, 0x8B }, { 2, 0xF0, 0x8D }, { 1, 0x8F },
+};
+
+static size_t make_stream(uint8_t *buf, size_t len, const uint8_t (*seqs)[6], uint8_t nseqs)
+{
+    size_t n = 0;
+    while (n < len) {
+        uint8_t r = rand8();
+        if (r < 64) {
+            const uint8_t *seq = seqs[rand8() % nseqs];
+            for (uint8_t i = 1; i <= seq[0] && n < len; i++) buf[n++] = seq[i];
+        } else if (r < 80) {
+            buf[n++] = rand8();                 // any byte
+        } else {
+            buf[n++] = rand8() & 0x7F;          // key make(CS1 break with 80)
+            if (r & 1 && n < len) buf[n++] = rand8() | 0x80;
+        }
+        // 00 and FF are handled by port_scan() and never reach decoders
+        if (n && (buf[n - 1] == 0x00 || buf[n - 1] == 0xFF)) n--;
+    }
+    return n;
+}
+
+/* Make and break of random keys only, as in typing */
+static size_t make_typing(uint8_t *buf, size_t len, uint8_t cs)
+{
+    size_t n = 0;
+    while (n + 3 <= len) {
+        uint8_t key = (rand8() & 0x7F) | 0x01;
+        buf[n++] = key;
+        if (cs == 1) {
+            buf[n++] = key | 0x80;
+        } else {
+            buf[n++] = 0xF0;
+            buf[n++] = key;
+        }
+    }
+    return n;
+}
+
+static void port_reset(port_t *port)
+{
+    // as INIT state of port_scan()
+    port->cs_state = 0;
+    matrix_clear_port(port);
+}
+
+static int replay(const char *name, decoder_t dec, decoder_t ref, const uint8_t *buf, size_t len)
+{
+    port_reset(NEW);
+    port_reset(REF);
+    int errors = 0;
+    for (size_t i = 0; i < len; i++) {
+        int8_t rn = dec(NEW, buf[i]);
+        int8_t rr = ref(REF, buf[i]);
+        if (rn != rr || memcmp(&matrix[0], &matrix[PORT_MATRIX_ROWS], PORT_MATRIX_ROWS)) {
+            if (errors++ < 10) {
+                printf("%s: mismatch at %zu code:%02X result:%d/%d\n", name, i, buf[i], rn, rr);
+            }
+            port_reset(NEW);
+            port_reset(REF);
+        }
+        if (rn == -1) port_reset(NEW);
+        if (rr == -1) port_reset(REF);
+    }
+    return errors;
+}
+
+static double now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+}
+
+static double per_byte(decoder_t dec, port_t *port, const uint8_t *buf, size_t len)
+{
+    port_reset(port);
+    double start = now();
+    for (size_t i = 0; i < len; i++) {
+        if (dec(port, buf[i]) == -1) port->cs_state = 0;
+    }
+    return (now() - start) / len;
+}
+
+#define STREAM_LEN  1000000
+static uint8_t stream[STREAM_LEN];
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        decoder_t dec;
+        decoder_t ref;
+        const uint8_t (*seqs)[6];
+        uint8_t nseqs;
+    } sets[] = {
+        { "CS1", process_cs1, ref_cs1, cs1_seqs, sizeof(cs1_seqs) / sizeof(cs1_seqs[0]) },
+        { "CS2", process_cs2, ref_cs2, cs2_seqs, sizeof(cs2_seqs) / sizeof(cs2_seqs[0]) },
+        { "CS3", process_cs3, ref_cs3, cs3_seqs, sizeof(cs3_seqs) / sizeof(cs3_seqs[0]) },
+    };
+    int errors = 0;
+
+    matrix_init();
+#if defined(__x86_64__) || defined(__i386__)
+    printf("decode time per byte in TSC cycles(host)\n");
+#else
+    printf("decode time per byte in ns(host)\n");
+#endif
+    for (uint8_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        size_t len = make_stream(stream, STREAM_LEN, sets[s].seqs, sets[s].nseqs);
+        int e = replay(sets[s].name, sets[s].dec, sets[s].ref, stream, len);
+        printf("%s: %zu bytes %d mismatches  table:%.1f switch:%.1f", sets[s].name, len, e,
+               per_byte(sets[s].dec, NEW, stream, len), per_byte(sets[s].ref, REF, stream, len));
+        errors += e;
+
+        len = make_typing(stream, STREAM_LEN, s + 1);
+        e = replay(sets[s].name, sets[s].dec, sets[s].ref, stream, len);
+        printf("  typing table:%.1f switch:%.1f\n",
+               per_byte(sets[s].dec, NEW, stream, len), per_byte(sets[s].ref, REF, stream, len));
+        errors += e;
+    }
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? 1 : 0;
+}
@@ -90,7 +90,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * ^a: ISO backslash and US backslash use identical code 2B. [3], [a]
  * Unsupported codes or error -> 00. UNIMAP_NUBS is unused.
  */
-const uint8_t PROGMEM unimap_cs1[MATRIX_ROWS][MATRIX_COLS] = {
+const uint8_t PROGMEM unimap_cs1[PORT_MATRIX_ROWS][MATRIX_COLS] = {
     { UNIMAP_NO,    UNIMAP_ESC,   UNIMAP_1,     UNIMAP_2,     UNIMAP_3,     UNIMAP_4,     UNIMAP_5,     UNIMAP_6     }, /* 00-07 */
     { UNIMAP_7,     UNIMAP_8,     UNIMAP_9,     UNIMAP_0,     UNIMAP_MINUS, UNIMAP_EQUAL, UNIMAP_BSPACE,UNIMAP_TAB   }, /* 08-0F */
     { UNIMAP_Q,     UNIMAP_W,     UNIMAP_E,     UNIMAP_R,     UNIMAP_T,     UNIMAP_Y,     UNIMAP_U,     UNIMAP_I     }, /* 10-17 */
@@ -150,7 +150,7 @@ const uint8_t PROGMEM unimap_cs1[MATRIX_ROWS][MATRIX_COLS] = {
  * ^a: ISO hash key and US backslash use identical code 5D.
  * 51, 63, 68, 6A, 6D: Hidden keys in IBM model M [6]
  */
-const uint8_t PROGMEM unimap_cs2[MATRIX_ROWS][MATRIX_COLS] = {
+const uint8_t PROGMEM unimap_cs2[PORT_MATRIX_ROWS][MATRIX_COLS] = {
     { UNIMAP_PAUS,  UNIMAP_F9,    UNIMAP_F7,    UNIMAP_F5,    UNIMAP_F3,    UNIMAP_F1,    UNIMAP_F2,    UNIMAP_F12   }, /* 00-07 */
     { UNIMAP_F13,   UNIMAP_F10,   UNIMAP_F8,    UNIMAP_F6,    UNIMAP_F4,    UNIMAP_TAB,   UNIMAP_GRV,   UNIMAP_RALT  }, /* 08-0F */
     { UNIMAP_F14,   UNIMAP_LALT,  UNIMAP_LSHIFT,UNIMAP_KANA,  UNIMAP_LCTL,  UNIMAP_Q,     UNIMAP_1,     UNIMAP_RCTL  }, /* 10-17 */
@@ -209,7 +209,7 @@ const uint8_t PROGMEM unimap_cs2[MATRIX_ROWS][MATRIX_COLS] = {
  * -: G80-2551 specific 80-prefixed codes remapped: 26->5D, 25->53, 16->51, 1E->00
  * 51, 5C, 5D, 68, 78: Hidden keys in IBM 122-key terminal keyboard [7]
  */
-const uint8_t PROGMEM unimap_cs3[MATRIX_ROWS][MATRIX_COLS] = {
+const uint8_t PROGMEM unimap_cs3[PORT_MATRIX_ROWS][MATRIX_COLS] = {
     { UNIMAP_KANA,  UNIMAP_LGUI,  UNIMAP_PSCR,  UNIMAP_VOLD,  UNIMAP_VOLU,  UNIMAP_MUTE,  UNIMAP_HENK,  UNIMAP_F1    }, /* 00-07 */
     { UNIMAP_F13,   UNIMAP_RGUI,  UNIMAP_APP,   UNIMAP_MHEN,  UNIMAP_PAUS,  UNIMAP_TAB,   UNIMAP_GRV,   UNIMAP_F2    }, /* 08-0F */
     { UNIMAP_F14,   UNIMAP_LCTL,  UNIMAP_LSHIFT,UNIMAP_NUBS,  UNIMAP_CAPS,  UNIMAP_Q,     UNIMAP_1,     UNIMAP_F3    }, /* 10-17 */
@@ -233,15 +233,17 @@ extern const action_t actionmaps[][UNIMAP_ROWS][UNIMAP_COLS];
 action_t action_for_key(uint8_t layer, keypos_t key)
 {
     uint8_t unimap_pos;
-    switch (keyboard_kind) {
+    // matrix rows of each port
+    uint8_t row = key.row % PORT_MATRIX_ROWS;
+    switch (keyboard_kind[key.row / PORT_MATRIX_ROWS]) {
         case PC_XT:
-            unimap_pos = pgm_read_byte(&unimap_cs1[key.row][key.col]);
+            unimap_pos = pgm_read_byte(&unimap_cs1[row][key.col]);
             break;
         case PC_AT:
-            unimap_pos = pgm_read_byte(&unimap_cs2[key.row][key.col]);
+            unimap_pos = pgm_read_byte(&unimap_cs2[row][key.col]);
             break;
         case PC_TERMINAL:
-            unimap_pos = pgm_read_byte(&unimap_cs3[key.row][key.col]);
+            unimap_pos = pgm_read_byte(&unimap_cs3[row][key.col]);
             break;
         default:
             return (action_t)ACTION_NO;
@@ -29,6 +29,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "led.h"
 #include "m0110.h"
 #include "matrix.h"
+#include "keycode.h"
+#include "command.h"
 
 
 #define CAPS        0x39
@@ -83,6 +85,24 @@ uint8_t matrix_scan(void)
     return 1;
 }
 
+/*
+ * Latency: time keyboard was left without command in flight bounds key latency,
+ * and time main loop was held by keyboard reading delays other work.
+ */
+bool command_extra(uint8_t code)
+{
+    switch (code) {
+        case KC_L:
+            xprintf("\ngap max:%ums block max:%ums err:%u\n",
+                    m0110_gap_max, m0110_block_max, m0110_error_count);
+            m0110_gap_max = 0;
+            m0110_block_max = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
 inline
 uint8_t matrix_get_row(uint8_t row)
 {
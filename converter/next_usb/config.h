@@ -62,6 +62,9 @@ POSSIBILITY OF SUCH DAMAGE.
 //#define PRO_MICRO_CONFIG 1
 #define TMK_CONFIG 1
 
+// interval to poll keyboard in ms, 2ms at least
+//#define NEXT_KBD_POLL_INTERVAL 5
+
 // comment out if you don't want the keyboard's LEDs to flash upon initialization or pressing shift
 //#define NEXT_KBD_INIT_FLASH_LEDS
 //#define NEXT_KBD_SHIFT_FLASH_LEDS
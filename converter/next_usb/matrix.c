@@ -56,6 +56,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "debug.h"
 #include "matrix.h"
 #include "next_kbd.h"
+#include "timer.h"
+#include "keycode.h"
+#include "command.h"
 
 static void matrix_make(uint8_t code);
 static void matrix_break(uint8_t code);
@@ -78,6 +81,21 @@ static bool is_modified = false;
 
 static bool power_state = false;
 
+/* KMBus query and response take about 32 bit cells(1.6ms) */
+#define NEXT_KBD_POLL_MIN   2
+#ifndef NEXT_KBD_POLL_INTERVAL
+#define NEXT_KBD_POLL_INTERVAL  5
+#endif
+#if NEXT_KBD_POLL_INTERVAL < NEXT_KBD_POLL_MIN
+#   error "NEXT_KBD_POLL_INTERVAL is shorter than KMBus transaction"
+#endif
+
+static uint16_t poll_ms;
+/* time between polls: bound of latency added to key event */
+static uint16_t poll_gap_max;
+static uint32_t poll_gap_sum;
+static uint16_t poll_count;
+
 /* intialize matrix for scanning. should be called once. */
 void matrix_init(void)
 {
@@ -146,11 +164,6 @@ void matrix_init(void)
 /* scan all key states on matrix */
 uint8_t matrix_scan(void)
 {
-    _delay_ms(5);
-    
-    //next_kbd_set_leds(false, false);
-    NEXT_KBD_LED1_OFF;
-    
     is_modified = false;
     
     if (!NEXT_KBD_PWR_READ) {
@@ -171,6 +184,21 @@ uint8_t matrix_scan(void)
         }
     }
     
+    // poll keyboard by timer so that main loop runs between polls
+    uint16_t gap = timer_elapsed(poll_ms);
+    if (gap < NEXT_KBD_POLL_INTERVAL) {
+        return 0;
+    }
+    poll_ms = timer_read();
+    if (poll_count) {
+        if (gap > poll_gap_max) poll_gap_max = gap;
+        poll_gap_sum += gap;
+    }
+    if (poll_count < UINT16_MAX) poll_count++;
+
+    //next_kbd_set_leds(false, false);
+    NEXT_KBD_LED1_OFF;
+
     uint32_t resp = (next_kbd_recv());
     
     if (!resp || resp == NEXT_KBD_KMBUS_IDLE)
@@ -213,6 +241,22 @@ uint8_t matrix_scan(void)
     return 1;
 }
 
+/* KMBus poll statistics */
+bool command_extra(uint8_t code)
+{
+    switch (code) {
+        case KC_L:
+            xprintf("\npoll interval:%ums gap avg:%ums max:%ums count:%u\n",
+                    NEXT_KBD_POLL_INTERVAL,
+                    (poll_count > 1 ? (uint16_t)(poll_gap_sum / (poll_count - 1)) : 0),
+                    poll_gap_max, poll_count);
+            poll_gap_max = 0; poll_gap_sum = 0; poll_count = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
 /* matrix state on row */
 inline
 uint8_t matrix_get_row(uint8_t row)
@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdint.h>
 #include <stdbool.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include "print.h"
 #include "util.h"
@@ -25,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "led.h"
 #include "debug.h"
 #include "protocol/serial.h"
+#include "timer.h"
 
 
 /*
@@ -47,6 +49,48 @@ static uint8_t matrix[MATRIX_ROWS];
 #define ROW(code)      ((code>>3)&0xF)
 #define COL(code)      (code&0x07)
 
+// keys changed in this scan
+static uint8_t matrix_changed[MATRIX_ROWS];
+// code held until next scan as its key already changed in this scan
+static int16_t pending = -1;
+
+static void matrix_set(uint8_t code);
+
+
+/*
+ * RDY pulse
+ *
+ * Keyboards require RDY pulse >=37us to send next data
+ * https://archive.org/stream/PC9800TechnicalDataBookHARDWARE1993/PC-9800TechnicalDataBook_HARDWARE1993#page/n157
+ *
+ * The pulse is ended by Timer0 compare B interrupt instead of busy wait.
+ * Timer0 is system timer and runs in CTC mode with OCR0A, OCR0B is free.
+ */
+#define RDY_PULSE_TICKS     ((uint16_t)(40UL * TIMER_RAW_FREQ / 1000000) + 1)
+
+static volatile bool rdy_pulse = false;
+
+static void pc98_rdy_pulse(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    PC98_RDY_PORT |=  (1<<PC98_RDY_BIT);
+    uint16_t t = TIMER_RAW + RDY_PULSE_TICKS;
+    if (t > TIMER_RAW_TOP) t -= TIMER_RAW_TOP + 1;
+    OCR0B = t;
+    TIFR0 = (1<<OCF0B);
+    TIMSK0 |= (1<<OCIE0B);
+    rdy_pulse = true;
+    SREG = sreg;
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+    PC98_RDY_PORT &= ~(1<<PC98_RDY_BIT);
+    TIMSK0 &= ~(1<<OCIE0B);
+    rdy_pulse = false;
+}
+
 
 static void pc98_send(uint8_t data)
 {
@@ -105,20 +149,101 @@ static bool pc98_is_newtype(void)
     return true;
 }
 
+/*
+ * LED command
+ *
+ * 9D <led> is sent from matrix_scan() step by step without blocking, only
+ * after received codes are drained and RDY pulse ends. Keyboard is inhibited
+ * with RDY high while a command byte is sent and answers with FA(ACK).
+ * Without ACK in PC98_CMD_TIMEOUT or with other response the command is sent
+ * again from 9D up to PC98_CMD_RETRY times.
+ * Latest LED state set during the command is sent after it.
+ */
+#ifndef PC98_CMD_TIMEOUT
+#define PC98_CMD_TIMEOUT    255     // ms to wait for ACK
+#endif
+#ifndef PC98_CMD_RETRY
+#define PC98_CMD_RETRY      3
+#endif
+
 static uint8_t pc98_led = 0;
-static void pc98_led_set(void)
+static enum {
+    CMD_IDLE,
+    CMD_INHIBIT,    // RDY high before sending
+    CMD_SENT,       // RDY high after sending
+    CMD_WAIT_ACK,
+} cmd_state = CMD_IDLE;
+static uint8_t  cmd_index;          // 0: 9D, 1: LED
+static uint8_t  cmd_led;
+static uint8_t  cmd_retry;
+static uint16_t cmd_ms;
+
+// inhibit keyboard to send a command byte
+static void pc98_cmd_inhibit(void)
 {
-    uint16_t code;
-RETRY:
-    pc98_send(0x9D);
-    code = pc98_wait_response();
-    if (code != -1) dprintf("send 9D: %02X\n", code);
-    if (code != 0xFA) return;
+    PC98_RDY_PORT |= (1<<PC98_RDY_BIT);
+    cmd_state = CMD_INHIBIT;
+    cmd_ms = timer_read();
+}
 
-    pc98_send(pc98_led);
-    code = pc98_wait_response();
-    if (code != -1) dprintf("send %02X: %02X\n", pc98_led, code);
-    if (code != 0xFA) goto RETRY;
+// send command again from 9D, or give up
+static void pc98_cmd_retry(void)
+{
+    if (cmd_retry++ < PC98_CMD_RETRY) {
+        cmd_index = 0;
+        pc98_cmd_inhibit();
+    } else {
+        dprintf("LED %02X: given up\n", cmd_led);
+        cmd_state = CMD_IDLE;
+    }
+}
+
+static void pc98_cmd_task(void)
+{
+    uint8_t data = (cmd_index ? cmd_led : 0x9D);
+    switch (cmd_state) {
+        case CMD_IDLE:
+            // keyboard must not be sending code: receive buffer is empty
+            if (!pc98_led || rdy_pulse || pending != -1) break;
+            cmd_led = pc98_led;
+            pc98_led = 0;
+            cmd_index = 0;
+            cmd_retry = 0;
+            pc98_cmd_inhibit();
+            break;
+        case CMD_INHIBIT:
+            // RDY high for 1ms at least before and after sending
+            if (timer_elapsed(cmd_ms) < 2) break;
+            xprintf("s%02X ", data);
+            serial_send(data);
+            cmd_state = CMD_SENT;
+            cmd_ms = timer_read();
+            break;
+        case CMD_SENT:
+            if (timer_elapsed(cmd_ms) < 2) break;
+            PC98_RDY_PORT &= ~(1<<PC98_RDY_BIT);
+            cmd_state = CMD_WAIT_ACK;
+            cmd_ms = timer_read();
+            break;
+        case CMD_WAIT_ACK:
+            if (timer_elapsed(cmd_ms) < PC98_CMD_TIMEOUT) break;
+            dprintf("send %02X: timeout\n", data);
+            pc98_cmd_retry();
+            break;
+    }
+}
+
+static void pc98_cmd_response(uint8_t code)
+{
+    dprintf("send %02X: %02X\n", (cmd_index ? cmd_led : 0x9D), code);
+    cmd_state = CMD_IDLE;
+    if (code == 0xFA) {
+        // 9D is acknowledged, LED byte next
+        if (cmd_index++ == 0) pc98_cmd_inhibit();
+    } else {
+        // retry from 9D when not acknowledged
+        pc98_cmd_retry();
+    }
 }
 
 void matrix_init(void)
@@ -153,43 +278,62 @@ void matrix_init(void)
     return;
 }
 
+/*
+ * Drains all codes received so far in a scan. A key changed twice in a scan
+ * would lose its first event and the code is held until next scan.
+ */
 uint8_t matrix_scan(void)
 {
-    uint16_t code;
-    code = serial_recv2();
-    if (code == -1) {
-#ifdef PC98_LED_CONTROL
-        // Before sending command  we have to make sure that there is no unprocessed key in queue
-        // otherwise keys will be missed during sending command
-        if (pc98_led) {
-            pc98_led_set();
-            pc98_led = 0;
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++) matrix_changed[i] = 0x00;
+
+    if (pending != -1) {
+        uint8_t code = pending;
+        pending = -1;
+        matrix_set(code);
+    }
+
+    while (pending == -1) {
+        int16_t code = serial_recv2();
+        if (code == -1) break;
+
+        if (cmd_state == CMD_WAIT_ACK) {
+            pc98_cmd_response(code);
+        } else {
+            xprintf("r%02X ", code);
+            matrix_set(code);
         }
-#endif
-        return 0;
+        // RDY is held high while command byte is sent
+        if (cmd_state != CMD_INHIBIT && cmd_state != CMD_SENT) pc98_rdy_pulse();
     }
 
-    xprintf("r%02X ", code);
+#ifdef PC98_LED_CONTROL
+    // Before sending command  we have to make sure that there is no unprocessed key in queue
+    // otherwise keys will be missed during sending command
+    pc98_cmd_task();
+#endif
+    return 1;
+}
+
+static void matrix_set(uint8_t code)
+{
+    if (matrix_changed[ROW(code)] & (1<<COL(code))) {
+        pending = code;
+        return;
+    }
 
     if (code&0x80) {
         // break code
         if (matrix_is_on(ROW(code), COL(code))) {
             matrix[ROW(code)] &= ~(1<<COL(code));
+            matrix_changed[ROW(code)] |= (1<<COL(code));
         }
     } else {
         // make code
         if (!matrix_is_on(ROW(code), COL(code))) {
             matrix[ROW(code)] |=  (1<<COL(code));
+            matrix_changed[ROW(code)] |= (1<<COL(code));
         }
     }
-
-    // Keyboards require RDY pulse >=37us to send next data
-    // https://archive.org/stream/PC9800TechnicalDataBookHARDWARE1993/PC-9800TechnicalDataBook_HARDWARE1993#page/n157
-    PC98_RDY_PORT |=  (1<<PC98_RDY_BIT);
-    _delay_us(40);
-    PC98_RDY_PORT &= ~(1<<PC98_RDY_BIT);
-
-    return code;
 }
 
 inline
@@ -36,6 +36,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
     keyboard_report->mods == (MOD_BIT(KC_LSHIFT) | MOD_BIT(KC_RSHIFT)) \
 )
 
+/* time(ms) to wait for parameter byte of keyboard response */
+#ifndef SUN_RESPONSE_TIMEOUT
+#define SUN_RESPONSE_TIMEOUT    100
+#endif
+/* interval(ms) to send reset again until keyboard responds */
+#ifndef SUN_RESET_RETRY
+#define SUN_RESET_RETRY         1000
+#endif
+
 /* legacy keymap support */
 #define USE_LEGACY_KEYMAP
 
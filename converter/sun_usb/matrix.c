@@ -18,7 +18,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdint.h>
 #include <stdbool.h>
 #include <avr/io.h>
-#include <util/delay.h>
 #include "print.h"
 #include "util.h"
 #include "matrix.h"
@@ -26,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "protocol/serial.h"
 #include "led.h"
 #include "host.h"
+#include "timer.h"
 
 
 /*
@@ -49,6 +49,53 @@ static uint8_t matrix[MATRIX_ROWS];
 #define COL(code)      (code&0x07)
 
 
+/*
+ * Keyboard responses with parameter byte are received with state machine
+ * over serial buffer instead of waiting for the second byte. A response
+ * which doesn't complete in SUN_RESPONSE_TIMEOUT is discarded.
+ */
+enum {
+    SUN_SCAN,           // scan codes
+    SUN_RESET,          // FF received: keyboard ID follows
+    SUN_LAYOUT,         // FE received: layout follows
+    SUN_RESET_FAIL,     // 7E received: error code follows
+};
+static uint8_t  state = SUN_SCAN;
+static uint16_t state_ms;
+// keyboard has not responded to reset command yet
+static bool     reset_pending = false;
+static uint16_t reset_ms;
+// code left to next scan
+static int16_t  held = -1;
+
+static void state_enter(uint8_t s)
+{
+    state = s;
+    state_ms = timer_read();
+}
+
+static void reset_send(void)
+{
+    print(".");
+    serial_send(0x01);
+    reset_pending = true;
+    reset_ms = timer_read();
+}
+
+static int16_t recv(void)
+{
+    int16_t data = held;
+    if (data != -1) {
+        held = -1;
+        return data;
+    }
+    data = serial_recv2();
+    if (data != -1) {
+        debug_hex(data); debug(" ");
+    }
+    return data;
+}
+
 void matrix_init(void)
 {
     DDRD |= (1<<6);
@@ -60,73 +107,103 @@ void matrix_init(void)
     // initialize matrix state: all keys off
     for (uint8_t i=0; i < MATRIX_ROWS; i++) matrix[i] = 0x00;
 
-    // wait for keyboard coming up
-    // otherwise LED status update fails
+    // LED status is updated when keyboard comes up with reset response,
+    // reset is sent again in matrix_scan until then.
     print("Reseting ");
-    while (1) {
-        print(".");
-        while (serial_recv());
-        serial_send(0x01);
-        _delay_ms(500);
-        if (serial_recv() == 0xFF) {
-            _delay_ms(500);
-            if (serial_recv() == 0x04)
-                break;
-        }
-    }
-    print(" Done\n");
-
-    PORTD &= ~(1<<6);
+    while (serial_recv2() != -1) ;
+    reset_send();
     return;
 }
 
 uint8_t matrix_scan(void)
 {
+    int16_t data;
     uint8_t code;
-    code = serial_recv();
-    if (!code) return 0;
-
-    debug_hex(code); debug(" ");
-
-    switch (code) {
-        case 0xFF:  // reset success: FF 04
-            print("reset: ");
-            _delay_ms(500);
-            code = serial_recv();
-            xprintf("%02X\n", code);
-            if (code == 0x04) {
-                // LED status
-                led_set(host_keyboard_leds());
-            }
-            return 0;
-        case 0xFE:  // layout: FE <layout>
-            print("layout: ");
-            _delay_ms(500);
-            xprintf("%02X\n", serial_recv());
-            return 0;
-        case 0x7E:  // reset fail: 7E 01
-            print("reset fail: ");
-            _delay_ms(500);
-            xprintf("%02X\n", serial_recv());
-            return 0;
-        case 0x7F:
-            // all keys up
-            for (uint8_t i=0; i < MATRIX_ROWS; i++) matrix[i] = 0x00;
-            return 0;
+    uint8_t last = 0;
+    uint8_t changed[MATRIX_ROWS] = {};
+
+    if (reset_pending && timer_elapsed(reset_ms) > SUN_RESET_RETRY) {
+        reset_send();
     }
 
-    if (code&0x80) {
-        // break code
-        if (matrix_is_on(ROW(code), COL(code))) {
-            matrix[ROW(code)] &= ~(1<<COL(code));
+    if (state != SUN_SCAN && timer_elapsed(state_ms) > SUN_RESPONSE_TIMEOUT) {
+        print("timeout\n");
+        state = SUN_SCAN;
+    }
+
+    // all codes received are processed, but a key changes only once per scan
+    // so that press and release of it in a scan are not lost
+    while ((data = recv()) != -1) {
+        code = data;
+
+        switch (state) {
+            case SUN_RESET:
+                // time from reset command, or from reset response on hotplug
+                xprintf("%02X %ums\n", code, timer_elapsed(reset_ms));
+                if (code == 0x04) {
+                    // LED status
+                    led_set(host_keyboard_leds());
+                }
+                if (reset_pending) {
+                    reset_pending = false;
+                    PORTD &= ~(1<<6);
+                    print(" Done\n");
+                }
+                state = SUN_SCAN;
+                continue;
+            case SUN_LAYOUT:
+            case SUN_RESET_FAIL:
+                xprintf("%02X\n", code);
+                state = SUN_SCAN;
+                continue;
         }
-    } else {
-        // make code
-        if (!matrix_is_on(ROW(code), COL(code))) {
-            matrix[ROW(code)] |=  (1<<COL(code));
+
+        switch (code) {
+            case 0x00:
+                continue;
+            case 0xFF:  // reset success: FF 04
+                print("reset: ");
+                if (!reset_pending) reset_ms = timer_read();
+                state_enter(SUN_RESET);
+                continue;
+            case 0xFE:  // layout: FE <layout>
+                print("layout: ");
+                state_enter(SUN_LAYOUT);
+                continue;
+            case 0x7E:  // reset fail: 7E 01
+                print("reset fail: ");
+                state_enter(SUN_RESET_FAIL);
+                continue;
+            case 0x7F:
+                // all keys up
+                if (last) {
+                    held = code;
+                    return last;
+                }
+                for (uint8_t i=0; i < MATRIX_ROWS; i++) matrix[i] = 0x00;
+                continue;
+        }
+
+        if (changed[ROW(code)] & (1<<COL(code))) {
+            held = code;
+            return last;
+        }
+        changed[ROW(code)] |= (1<<COL(code));
+
+        if (code&0x80) {
+            // break code
+            if (matrix_is_on(ROW(code), COL(code))) {
+                matrix[ROW(code)] &= ~(1<<COL(code));
+            }
+        } else {
+            // make code
+            if (!matrix_is_on(ROW(code), COL(code))) {
+                matrix[ROW(code)] |=  (1<<COL(code));
+            }
         }
+        last = code;
     }
-    return code;
+    return last;
 }
 
 inline
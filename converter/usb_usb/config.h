@@ -33,6 +33,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MATRIX_ROWS 16
 #define MATRIX_COLS 16
 
+/* Use report protocol instead of boot protocol to support NKRO keyboards.
+ * Keyboard input report is read according to its report descriptor. */
+//#define USB_USB_REPORT_PROTOCOL
+
+/* USB host scheduler: time budget of a loop in ms.
+ * Slice duration histograms are shown with command U. */
+//#define USB_USB_LOOP_BUDGET     2
+
 /* key combination for command */
 #define IS_COMMAND() (keyboard_report->mods == (MOD_BIT(KC_LSHIFT) | MOD_BIT(KC_RSHIFT))) 
 
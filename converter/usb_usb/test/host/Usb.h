@@ -0,0 +1,100 @@
+/*
+ * Host stub of USB Host Shield 2.0 classes used by usb_usb.cpp and parser.cpp
+ *
+ * No USB transfer is done; reports are given to parsers by the test directly.
+ */
+#ifndef HOST_USB_H
+#define HOST_USB_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define USB_HID_PROTOCOL_KEYBOARD   1
+#define USB_STATE_RUNNING           0x90
+#define FSHOST                      2
+#define hrNAK                       4
+#define bmREQ_HID_REPORT            0xA1
+#define USB_REQUEST_GET_DESCRIPTOR  6
+#define HID_DESCRIPTOR_REPORT       0x22
+
+uint16_t millis(void);
+
+class USBReadParser {
+public:
+    virtual void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset) = 0;
+};
+
+struct EpInfo {
+    uint8_t epAddr;
+    uint8_t maxPktSize;
+};
+
+class USB {
+public:
+    void Init() {}
+    void Task() {}
+    uint8_t getUsbTaskState() { return USB_STATE_RUNNING; }
+    uint8_t getVbusState() { return FSHOST; }
+    uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t *data) {
+        (void)addr; (void)ep; (void)nbytesptr; (void)data;
+        return hrNAK;
+    }
+    uint8_t ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo,
+                    uint8_t wValHi, uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t *dataptr,
+                    USBReadParser *p) {
+        (void)addr; (void)ep; (void)bmReqType; (void)bRequest; (void)wValLo; (void)wValHi;
+        (void)wInd; (void)total; (void)nbytes; (void)dataptr; (void)p;
+        return 0;
+    }
+};
+
+class USBHub {
+public:
+    USBHub(USB *p) { (void)p; }
+};
+
+class USBHID {
+public:
+    static const uint8_t epInterruptInIndex = 1;
+    uint8_t GetAddress() { return 1; }
+};
+
+class HIDReportParser {
+public:
+    virtual void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf) = 0;
+};
+
+class HIDUniversal : public USBHID {
+public:
+    HIDUniversal(USB *p) : pUsb(p), bAddress(0), bNumIface(0), qNextPollTime(0), pollInterval(0), reportParser(0) {}
+    bool SetReportParser(uint8_t id, HIDReportParser *prs) { (void)id; reportParser = prs; return true; }
+    bool isReady() { return true; }
+    uint8_t SetReport(uint8_t ep, uint8_t iface, uint8_t type, uint8_t id, uint16_t n, uint8_t *data) {
+        (void)ep; (void)iface; (void)type; (void)id; (void)n; (void)data;
+        return 0;
+    }
+    virtual uint8_t Poll() { return 0; }
+    virtual uint8_t Release() { return 0; }
+protected:
+    static const uint8_t maxHidInterfaces = 3;
+    struct {
+        uint8_t bmInterface;
+        uint8_t epIndex[3];
+    } hidInterfaces[maxHidInterfaces];
+    EpInfo epInfo[4];
+    USB *pUsb;
+    uint8_t bAddress;
+    uint8_t bNumIface;
+    uint32_t qNextPollTime;
+    uint8_t pollInterval;
+    HIDReportParser *reportParser;
+    virtual uint8_t OnInitSuccessful() { return 0; }
+};
+
+template <uint8_t BOOT_PROTOCOL>
+class HIDBoot : public HIDUniversal {
+public:
+    HIDBoot(USB *p) : HIDUniversal(p) {}
+};
+
+#endif
@@ -0,0 +1,10 @@
+/* Host stub of LUFA device state referred to by usb_usb.cpp */
+#ifndef HOST_LUFA_H
+#define HOST_LUFA_H
+
+#include <stdbool.h>
+
+static bool USB_Device_RemoteWakeupEnabled = false;
+static inline void USB_Device_SendRemoteWakeup(void) {}
+
+#endif
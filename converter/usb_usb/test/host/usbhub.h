@@ -0,0 +1,2 @@
+/* Host stub: see Usb.h */
+#include "Usb.h"
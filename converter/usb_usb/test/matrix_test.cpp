@@ -0,0 +1,144 @@
+/*
+ * Bitmap matrix test
+ *
+ * Boot protocol reports of four keyboards are given to their KBDReportParser as the
+ * library does, and matrix rows after matrix_scan() are checked against key state
+ * rebuilt from the last report of every keyboard each time, as or_report() did.
+ * A short recorded sequence covers a key held on two keyboards and rollover error
+ * reports; random reports follow.
+ *
+ * Build and run on host:
+ *     $ make
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* host replacements of print */
+#define PRINT_H__
+#define xprintf(...)        do { } while (0)
+#define print(s)            do { } while (0)
+#define println(s)          do { } while (0)
+
+#include "../usb_usb.cpp"
+#include "parser.cpp"
+
+/* tmk_core functions referred to */
+debug_config_t debug_config;
+uint16_t millis(void) { static uint16_t t; return ++t; }
+uint16_t timer_read(void) { return 0; }
+uint16_t timer_elapsed(uint16_t last) { (void)last; return 0; }
+uint8_t host_keyboard_leds(void) { return 0; }
+void keyboard_set_leds(uint8_t leds) { (void)leds; }
+uint8_t bitpop16(uint16_t bits) { return __builtin_popcount(bits); }
+void suspend_power_down(void) {}
+bool suspend_wakeup_condition(void) { return false; }
+
+
+/* last report accepted from each keyboard */
+static report_keyboard_t last[KBD_COUNT];
+
+static bool ref_is_on(uint8_t code)
+{
+    for (uint8_t k = 0; k < KBD_COUNT; k++) {
+        if (IS_MOD(code) && (last[k].mods & (1 << (code - KC_LCTRL)))) return true;
+        for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+            if (IS_ANY(code) && last[k].keys[i] == code) return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t reports, errors;
+
+static void feed(uint8_t k, const uint8_t *buf)
+{
+    uint8_t data[8];
+    memcpy(data, buf, sizeof(data));
+    kbd_parsers[k]->Parse(kbds[k], false, sizeof(data), data);
+    if (buf[2] != 0x01) memcpy(&last[k], buf, sizeof(last[k]));     // rollover error is ignored
+    matrix_scan();
+    reports++;
+
+    uint8_t count = 0;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t ref = 0;
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            if (ref_is_on(CODE(row, col))) {
+                ref |= (1 << col);
+                count++;
+            }
+        }
+        if (matrix_get_row(row) != ref) {
+            if (errors++ < 10) {
+                printf("report %u kbd%u: row %X %04X expected %04X\n",
+                       reports, k + 1, row, matrix_get_row(row), ref);
+            }
+        }
+    }
+    if (matrix_key_count() != count) {
+        if (errors++ < 10) printf("report %u: key count %u expected %u\n", reports, matrix_key_count(), count);
+    }
+}
+
+/* keyboard, mods, reserved, keys */
+static const uint8_t recorded[][9] = {
+    { 0, 0x00, 0, KC_A },                                   // kbd1 A
+    { 1, 0x00, 0, KC_A },                                   // kbd2 A: A is held on two
+    { 0, 0x00, 0 },                                         // kbd1 releases A: still on
+    { 1, 0x02, 0, KC_A, KC_B },                             // kbd2 LShift+A+B
+    { 1, 0x02, 0, KC_B, KC_A },                             // same keys in other order
+    { 0, 0x02, 0, KC_C },                                   // LShift on two
+    { 1, 0x00, 0, KC_B },                                   // kbd2 releases LShift and A
+    { 2, 0x00, 0, KC_1, KC_2, KC_3, KC_4, KC_5, KC_6 },     // kbd3 six keys
+    { 2, 0x00, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 },     // rollover error: ignored
+    { 2, 0x00, 0, KC_2, KC_3, KC_4, KC_5, KC_6, KC_7 },
+    { 3, 0xE0, 0, KC_RIGHT },                               // kbd4 right mods
+    { 0, 0x00, 0 },
+    { 1, 0x00, 0 },
+    { 2, 0x00, 0 },
+    { 3, 0x00, 0 },                                         // all released
+};
+
+static uint32_t rand_state = 1;
+static uint8_t rand8(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 16;
+}
+
+int main(void)
+{
+    matrix_init();
+
+    for (uint8_t i = 0; i < sizeof(recorded) / sizeof(recorded[0]); i++) {
+        feed(recorded[i][0], &recorded[i][1]);
+    }
+    if (matrix_key_count() != 0) {
+        printf("keys left after recorded sequence: %u\n", matrix_key_count());
+        errors++;
+    }
+    printf("recorded: %u reports\n", reports);
+
+    // keys from a small set so that keyboards often hold same keys
+    for (uint32_t n = 0; n < 1000000; n++) {
+        uint8_t buf[8] = {};
+        uint8_t k = rand8() % KBD_COUNT;
+        if (rand8() < 4) {
+            memset(&buf[2], 0x01, 6);
+        } else {
+            buf[0] = rand8() & rand8();
+            uint8_t keys = rand8() % (KEYBOARD_REPORT_KEYS + 1);
+            for (uint8_t i = 0; i < keys; i++) {
+                uint8_t code = KC_A + rand8() % 24;
+                if (memchr(&buf[2], code, i)) continue;     // no duplicate in a report
+                buf[2 + i] = code;
+            }
+        }
+        feed(k, buf);
+    }
+    printf("total: %u reports %u errors\n", reports, errors);
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? 1 : 0;
+}
@@ -39,6 +39,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "suspend.h"
 #include "lufa.h"
 
+extern "C" {
+#include "command.h"
+}
+
 
 /* KEY CODE to Matrix
  *
@@ -65,8 +69,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define ROW_BITS(code)  (1 << COL(code))
 
 
+#define KBD_COUNT 4
+
+// Key state of each keyboard
+static matrix_row_t kbd_matrix[KBD_COUNT][MATRIX_ROWS];
+#ifndef USB_USB_REPORT_PROTOCOL
+// Last report of each keyboard to diff with
+static report_keyboard_t kbd_report_prev[KBD_COUNT];
+#endif
+
 // Integrated key state of all keyboards
-static report_keyboard_t keyboard_report;
+static matrix_row_t matrix[MATRIX_ROWS];
 
 static bool matrix_is_mod =false;
 
@@ -74,18 +87,37 @@ static bool matrix_is_mod =false;
  * USB Host Shield HID keyboards
  * This supports two cascaded hubs and four keyboards
  */
+#ifdef USB_USB_REPORT_PROTOCOL
+typedef HIDKeyboard kbd_t;
+#else
+typedef HIDBoot<USB_HID_PROTOCOL_KEYBOARD> kbd_t;
+#endif
 USB usb_host;
-HIDBoot<USB_HID_PROTOCOL_KEYBOARD>    kbd1(&usb_host);
-HIDBoot<USB_HID_PROTOCOL_KEYBOARD>    kbd2(&usb_host);
-HIDBoot<USB_HID_PROTOCOL_KEYBOARD>    kbd3(&usb_host);
-HIDBoot<USB_HID_PROTOCOL_KEYBOARD>    kbd4(&usb_host);
+kbd_t kbd1(&usb_host);
+kbd_t kbd2(&usb_host);
+kbd_t kbd3(&usb_host);
+kbd_t kbd4(&usb_host);
+#ifndef USB_USB_REPORT_PROTOCOL
 KBDReportParser kbd_parser1;
 KBDReportParser kbd_parser2;
 KBDReportParser kbd_parser3;
 KBDReportParser kbd_parser4;
+#endif
 USBHub hub1(&usb_host);
 USBHub hub2(&usb_host);
 
+static kbd_t * const kbds[KBD_COUNT] = { &kbd1, &kbd2, &kbd3, &kbd4 };
+
+#ifdef USB_USB_REPORT_PROTOCOL
+static KBDNKROParser * const kbd_parsers[KBD_COUNT] = {
+    &kbd1.parser, &kbd2.parser, &kbd3.parser, &kbd4.parser
+};
+#else
+static KBDReportParser * const kbd_parsers[KBD_COUNT] = {
+    &kbd_parser1, &kbd_parser2, &kbd_parser3, &kbd_parser4
+};
+#endif
+
 
 uint8_t matrix_rows(void) { return MATRIX_ROWS; }
 uint8_t matrix_cols(void) { return MATRIX_COLS; }
@@ -94,63 +126,181 @@ void matrix_init(void) {
     debug_enable = true;
     // USB Host Shield setup
     usb_host.Init();
+#ifndef USB_USB_REPORT_PROTOCOL
     kbd1.SetReportParser(0, (HIDReportParser*)&kbd_parser1);
     kbd2.SetReportParser(0, (HIDReportParser*)&kbd_parser2);
     kbd3.SetReportParser(0, (HIDReportParser*)&kbd_parser3);
     kbd4.SetReportParser(0, (HIDReportParser*)&kbd_parser4);
+#endif
 }
 
-static void or_report(report_keyboard_t report) {
-    // integrate reports into keyboard_report
-    keyboard_report.mods |= report.mods;
+static void matrix_merge(uint8_t row) {
+    // key is on while any of keyboards holds it
+    matrix_row_t row_bits = 0;
+    for (uint8_t k = 0; k < KBD_COUNT; k++) {
+        row_bits |= kbd_matrix[k][row];
+    }
+    matrix[row] = row_bits;
+}
+
+#ifdef USB_USB_REPORT_PROTOCOL
+// update rows changed in key state of keyboard
+static void matrix_update(uint8_t kbd, KBDNKROParser *parser) {
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t row_bits = parser->get_row(row);
+        if (row_bits != kbd_matrix[kbd][row]) {
+            kbd_matrix[kbd][row] = row_bits;
+            matrix_merge(row);
+        }
+    }
+}
+#else
+static void matrix_set(uint8_t kbd, uint8_t code, bool on) {
+    uint8_t row = ROW(code);
+    if (on) {
+        kbd_matrix[kbd][row] |= ROW_BITS(code);
+    } else {
+        kbd_matrix[kbd][row] &= ~ROW_BITS(code);
+    }
+    matrix_merge(row);
+}
+
+static bool report_has_key(const report_keyboard_t *report, uint8_t code) {
     for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        if (IS_ANY(report.keys[i])) {
-            for (uint8_t j = 0; j < KEYBOARD_REPORT_KEYS; j++) {
-                if (! keyboard_report.keys[j]) {
-                    keyboard_report.keys[j] = report.keys[i];
-                    break;
-                }
+        if (report->keys[i] == code) return true;
+    }
+    return false;
+}
+
+// apply make and break between previous and new report of keyboard
+static void matrix_update(uint8_t kbd, const report_keyboard_t *report) {
+    report_keyboard_t *prev = &kbd_report_prev[kbd];
+
+    uint8_t mods_changed = prev->mods ^ report->mods;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (mods_changed & (1<<i)) {
+            matrix_set(kbd, KC_LCTRL + i, report->mods & (1<<i));
+        }
+    }
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (IS_ANY(prev->keys[i]) && !report_has_key(report, prev->keys[i])) {
+            matrix_set(kbd, prev->keys[i], false);
+        }
+    }
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (IS_ANY(report->keys[i]) && !report_has_key(prev, report->keys[i])) {
+            matrix_set(kbd, report->keys[i], true);
+        }
+    }
+    *prev = *report;
+}
+#endif
+
+/*
+ * USB host scheduler
+ *
+ * Host work is split into slices and run in order of priority every loop:
+ *   1. Interrupt-IN polling of configured keyboards
+ *   2. usb_host.Task(): bus state, polling of hubs and enumeration
+ *   3. Report descriptor of one interface of a new keyboard(report protocol)
+ *   4. LED SetReport of one keyboard
+ * Budget is checked before each slice and the rest is deferred to next loop
+ * once the loop spent USB_USB_LOOP_BUDGET ms.
+ * Task() polls keyboards again but Poll() does nothing until next bInterval.
+ * Enumeration of a device in Task()(USB::Configuring()) is done by the library
+ * at once and can't be split further, it can delay only hubs and next loop.
+ */
+#ifndef USB_USB_LOOP_BUDGET
+#define USB_USB_LOOP_BUDGET     2
+#endif
+
+enum { SLICE_POLL, SLICE_TASK, SLICE_DESC, SLICE_LED, SLICE_COUNT };
+static const char * const slice_name[SLICE_COUNT] = { "poll", "task", "desc", "led" };
+
+// histogram of slice duration: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64- ms
+#define SLICE_HIST_BUCKETS  8
+static uint16_t slice_hist[SLICE_COUNT][SLICE_HIST_BUCKETS];
+
+static uint8_t led_state = 0;
+static uint8_t led_pending = 0;
+
+static void slice_record(uint8_t slice, uint16_t start) {
+    uint16_t t = timer_elapsed(start);
+    uint8_t b = 0;
+    while (t && b < SLICE_HIST_BUCKETS - 1) {
+        t >>= 1;
+        b++;
+    }
+    if (slice_hist[slice][b] != 0xFFFF) slice_hist[slice][b]++;
+}
+
+static void usb_host_schedule(uint16_t loop_start) {
+    uint16_t start;
+
+    // keyboards first so that enumeration in Task() doesn't delay them
+    if (timer_elapsed(loop_start) < USB_USB_LOOP_BUDGET) {
+        start = timer_read();
+        for (uint8_t k = 0; k < KBD_COUNT; k++) {
+            kbds[k]->Poll();
+        }
+        slice_record(SLICE_POLL, start);
+    }
+
+    if (timer_elapsed(loop_start) < USB_USB_LOOP_BUDGET) {
+        start = timer_read();
+        usb_host.Task();
+        slice_record(SLICE_TASK, start);
+        uint16_t t = timer_elapsed(start);
+        if (t > 100) {
+            xprintf("host.Task: %d\n", t);
+        }
+    }
+
+#ifdef USB_USB_REPORT_PROTOCOL
+    if (timer_elapsed(loop_start) < USB_USB_LOOP_BUDGET) {
+        for (uint8_t k = 0; k < KBD_COUNT; k++) {
+            start = timer_read();
+            if (kbds[k]->ReadReportDescr()) {
+                slice_record(SLICE_DESC, start);
+                break;
+            }
+        }
+    }
+#endif
+
+    if (led_pending && timer_elapsed(loop_start) < USB_USB_LOOP_BUDGET) {
+        for (uint8_t k = 0; k < KBD_COUNT; k++) {
+            if (!(led_pending & (1<<k))) continue;
+            led_pending &= ~(1<<k);
+            if (kbds[k]->isReady()) {
+                start = timer_read();
+                kbds[k]->SetReport(0, 0, 2, 0, 1, &led_state);
+                slice_record(SLICE_LED, start);
+                break;
             }
         }
     }
 }
 
 uint8_t matrix_scan(void) {
-    static uint16_t last_time_stamp1 = 0;
-    static uint16_t last_time_stamp2 = 0;
-    static uint16_t last_time_stamp3 = 0;
-    static uint16_t last_time_stamp4 = 0;
+    static uint16_t last_time_stamp[KBD_COUNT] = {};
+    uint16_t loop_start = timer_read();
 
     // check report came from keyboards
-    if (kbd_parser1.time_stamp != last_time_stamp1 ||
-        kbd_parser2.time_stamp != last_time_stamp2 ||
-        kbd_parser3.time_stamp != last_time_stamp3 ||
-        kbd_parser4.time_stamp != last_time_stamp4) {
-
-        last_time_stamp1 = kbd_parser1.time_stamp;
-        last_time_stamp2 = kbd_parser2.time_stamp;
-        last_time_stamp3 = kbd_parser3.time_stamp;
-        last_time_stamp4 = kbd_parser4.time_stamp;
-
-        // clear and integrate all reports
-        keyboard_report = {};
-        or_report(kbd_parser1.report);
-        or_report(kbd_parser2.report);
-        or_report(kbd_parser3.report);
-        or_report(kbd_parser4.report);
-
-        matrix_is_mod = true;
-    } else {
-        matrix_is_mod = false;
+    matrix_is_mod = false;
+    for (uint8_t k = 0; k < KBD_COUNT; k++) {
+        if (kbd_parsers[k]->time_stamp != last_time_stamp[k]) {
+            last_time_stamp[k] = kbd_parsers[k]->time_stamp;
+#ifdef USB_USB_REPORT_PROTOCOL
+            matrix_update(k, kbd_parsers[k]);
+#else
+            matrix_update(k, &kbd_parsers[k]->report);
+#endif
+            matrix_is_mod = true;
+        }
     }
 
-    uint16_t timer;
-    timer = timer_read();
-    usb_host.Task();
-    timer = timer_elapsed(timer);
-    if (timer > 100) {
-        xprintf("host.Task: %d\n", timer);
-    }
+    usb_host_schedule(loop_start);
 
     static uint8_t usb_state = 0;
     if (usb_state != usb_host.getUsbTaskState()) {
@@ -171,46 +321,17 @@ bool matrix_is_modified(void) {
 }
 
 bool matrix_is_on(uint8_t row, uint8_t col) {
-    uint8_t code = CODE(row, col);
-
-    if (IS_MOD(code)) {
-        if (keyboard_report.mods & ROW_BITS(code)) {
-            return true;
-        }
-    }
-    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        if (keyboard_report.keys[i] == code) {
-            return true;
-        }
-    }
-    return false;
+    return (matrix[row] & (1<<col));
 }
 
 matrix_row_t matrix_get_row(uint8_t row) {
-    uint16_t row_bits = 0;
-
-    if (IS_MOD(CODE(row, 0)) && keyboard_report.mods) {
-        row_bits |= keyboard_report.mods;
-    }
-
-    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        if (IS_ANY(keyboard_report.keys[i])) {
-            if (row == ROW(keyboard_report.keys[i])) {
-                row_bits |= ROW_BITS(keyboard_report.keys[i]);
-            }
-        }
-    }
-    return row_bits;
+    return matrix[row];
 }
 
 uint8_t matrix_key_count(void) {
     uint8_t count = 0;
-
-    count += bitpop(keyboard_report.mods);
-    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        if (IS_ANY(keyboard_report.keys[i])) {
-            count++;
-        }
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
+        count += bitpop16(matrix[i]);
     }
     return count;
 }
@@ -220,10 +341,27 @@ void matrix_print(void) {
 
 void led_set(uint8_t usb_led)
 {
-    if (kbd1.isReady()) kbd1.SetReport(0, 0, 2, 0, 1, &usb_led);
-    if (kbd2.isReady()) kbd2.SetReport(0, 0, 2, 0, 1, &usb_led);
-    if (kbd3.isReady()) kbd3.SetReport(0, 0, 2, 0, 1, &usb_led);
-    if (kbd4.isReady()) kbd4.SetReport(0, 0, 2, 0, 1, &usb_led);
+    // written to keyboards by scheduler
+    led_state = usb_led;
+    led_pending = (1<<KBD_COUNT) - 1;
+}
+
+bool command_extra(uint8_t code)
+{
+    switch (code) {
+        case KC_U:
+            print("\nslice(ms):  0     1     2-    4-    8-    16-   32-   64-");
+            for (uint8_t s = 0; s < SLICE_COUNT; s++) {
+                xprintf("\n%-10s", slice_name[s]);
+                for (uint8_t b = 0; b < SLICE_HIST_BUCKETS; b++) {
+                    xprintf(" %5u", slice_hist[s][b]);
+                }
+            }
+            print("\n");
+            return true;
+        default:
+            return false;
+    }
 }
 
 // We need to keep doing UHS2 USB::Task() to initialize keyboard
@@ -18,9 +18,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "stdint.h"
 #include "serial.h"
 #include "led.h"
+#include "x68k_led.h"
 #include "debug.h"
 
 
+int16_t x68k_led = -1;
+
 void led_set(uint8_t usb_led)
 {
     /* X68000 LED bits 0: on, 1: off
@@ -39,5 +42,5 @@ void led_set(uint8_t usb_led)
     if (usb_led&(1<<USB_LED_SCROLL_LOCK))   led &= ~(1<<1);
     if (usb_led&(1<<USB_LED_COMPOSE))       led &= ~(1<<4);
     if (usb_led&(1<<USB_LED_KANA))          led &= ~(1<<0);
-    serial_send(led);
+    x68k_led = led;
 }
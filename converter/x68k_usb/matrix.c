@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "serial.h"
 #include "matrix.h"
 #include "debug.h"
+#include "x68k_led.h"
 
 
 /*
@@ -49,6 +50,13 @@ static uint8_t matrix[MATRIX_ROWS];
 
 static bool is_modified = false;
 
+// keys changed in this scan
+static uint8_t matrix_changed[MATRIX_ROWS];
+// code held until next scan as its key already changed in this scan
+static int16_t pending = -1;
+
+static void matrix_set(uint8_t code);
+
 
 void matrix_init(void)
 {
@@ -60,31 +68,59 @@ void matrix_init(void)
     return;
 }
 
+/*
+ * Drains all codes received so far in a scan. A key changed twice in a scan
+ * would lose its first event and the code is held until next scan.
+ */
 uint8_t matrix_scan(void)
 {
     is_modified = false;
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++) matrix_changed[i] = 0x00;
+
+    if (pending != -1) {
+        uint8_t code = pending;
+        pending = -1;
+        matrix_set(code);
+    }
+
+    while (pending == -1) {
+        int16_t code = serial_recv2();
+        if (code == -1) break;
 
-    uint16_t code;
-    code = serial_recv2();
-    if (code == -1) {
-        return 0;
+        dprintf("%02X\n", code);
+        matrix_set(code);
+    }
+
+    // send LED between receive bursts
+    if (pending == -1 && x68k_led != -1) {
+        serial_send(x68k_led);
+        x68k_led = -1;
+    }
+    return is_modified;
+}
+
+static void matrix_set(uint8_t code)
+{
+    if (matrix_changed[ROW(code)] & (1<<COL(code))) {
+        pending = code;
+        return;
     }
 
-    dprintf("%02X\n", code);
     if (code&0x80) {
         // break code
         if (matrix_is_on(ROW(code), COL(code))) {
             matrix[ROW(code)] &= ~(1<<COL(code));
+            matrix_changed[ROW(code)] |= (1<<COL(code));
             is_modified = true;
         }
     } else {
         // make code
         if (!matrix_is_on(ROW(code), COL(code))) {
             matrix[ROW(code)] |=  (1<<COL(code));
+            matrix_changed[ROW(code)] |= (1<<COL(code));
             is_modified = true;
         }
     }
-    return code;
 }
 
 inline
@@ -33,6 +33,13 @@ static uint8_t matrix[MATRIX_ROWS];
 #define ROW(code)      (code>>3)
 #define COL(code)      (code&0x07)
 
+// keys changed in this scan
+static uint8_t matrix_changed[MATRIX_ROWS];
+// event held until next scan as its key already changed in this scan
+static bool pending = false;
+static bool pending_make;
+static uint8_t pending_code;
+
 
 void matrix_init(void)
 {
@@ -78,7 +85,41 @@ static uint8_t move_e0code(uint8_t code) {
     return 0x00;
 }
 
+static void process_code(uint8_t code);
+
+/*
+ * Drains all bytes received so far in a scan. Keys changed in a scan are
+ * reported together, but a key changed twice would lose its first event
+ * and it is held until next scan.
+ */
 uint8_t matrix_scan(void)
+{
+    uint8_t lost = xt_host_overflow();
+    if (lost) {
+        // break codes may have been lost
+        xprintf("\n[OVF:%u]\n", lost);
+        matrix_clear();
+    }
+
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++) matrix_changed[i] = 0x00;
+
+    if (pending) {
+        pending = false;
+        if (pending_make)
+            matrix_make(pending_code);
+        else
+            matrix_break(pending_code);
+    }
+
+    while (!pending) {
+        uint8_t code = xt_host_recv();
+        if (!code) break;
+        process_code(code);
+    }
+    return 1;
+}
+
+static void process_code(uint8_t code)
 {
     static enum {
         INIT,
@@ -89,8 +130,6 @@ uint8_t matrix_scan(void)
         E1_9D,
     } state = INIT;
 
-    uint8_t code = xt_host_recv();
-    if (!code) return 0;
     dprintf("%02X ", code);
     switch (state) {
         case INIT:
@@ -165,7 +204,6 @@ uint8_t matrix_scan(void)
         default:
             state = INIT;
     }
-    return 1;
 }
 
 inline
@@ -174,10 +212,23 @@ uint8_t matrix_get_row(uint8_t row)
     return matrix[row];
 }
 
+static bool matrix_hold(uint8_t code, bool make)
+{
+    if (matrix_changed[ROW(code)] & (1<<COL(code))) {
+        pending = true;
+        pending_make = make;
+        pending_code = code;
+        return true;
+    }
+    matrix_changed[ROW(code)] |= 1<<COL(code);
+    return false;
+}
+
 inline
 static void matrix_make(uint8_t code)
 {
     if (!matrix_is_on(ROW(code), COL(code))) {
+        if (matrix_hold(code, true)) return;
         matrix[ROW(code)] |= 1<<COL(code);
     }
 }
@@ -186,6 +237,7 @@ inline
 static void matrix_break(uint8_t code)
 {
     if (matrix_is_on(ROW(code), COL(code))) {
+        if (matrix_hold(code, false)) return;
         matrix[ROW(code)] &= ~(1<<COL(code));
     }
 }
@@ -170,3 +170,35 @@ static void select_row(uint8_t row)
             break;
     }
 }
+
+#ifdef SUSPEND_WAKEUP_PCINT
+/* Wakeup from suspend: all rows are selected and any change of columns
+ * on PORTB(PCINT0-7) interrupts */
+bool matrix_wakeup_arm(void)
+{
+    // Output low(DDR:1, PORT:0) to select all rows
+    DDRD  |=  0b01111111;
+    PORTD &= ~0b01111111;
+    DDRC  |=  0b00000100;
+    PORTC &= ~0b00000100;
+    _delay_us(30);  // delay for settling
+
+    // key on: no change would come, poll by scan
+    if (read_cols()) {
+        unselect_rows();
+        return false;
+    }
+
+    PCMSK0 = 0b11111111;
+    PCIFR  = (1<<PCIF0);
+    PCICR |= (1<<PCIE0);
+    return true;
+}
+
+void matrix_wakeup_disarm(void)
+{
+    PCICR &= ~(1<<PCIE0);
+    PCMSK0 = 0;
+    unselect_rows();
+}
+#endif
@@ -46,16 +46,13 @@ Project located at <https://github.com/benblazak/ergodox-firmware>
 
 /* Set 0 if debouncing isn't needed */
 /*
- * This constant define not debouncing time in msecs, but amount of matrix
- * scan loops which should be made to get stable debounced results.
- *
- * On Ergodox matrix scan rate is relatively low, because of slow I2C.
- * Now it's only 317 scans/second, or about 3.15 msec/scan.
+ * This constant defines debouncing time in msecs.
  * According to Cherry specs, debouncing time is 5 msec.
  *
- * And so, there is no sense to have DEBOUNCE higher than 2.
+ * Left half is read by I2C in background and matrix scan rate no longer
+ * depends on slow I2C, so debouncing can't be counted in matrix scan loops.
  */
-#define DEBOUNCE        2
+#define DEBOUNCE        5
 #define TAPPING_TERM    230
 
 /* Mechanical locking support. Use KC_LCAP, KC_LNUM or KC_LSCR instead in keymap */
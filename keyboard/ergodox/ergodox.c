@@ -36,6 +36,7 @@ Most used files are located at
 #include "debug.h"
 #include "ergodox.h"
 #include "i2cmaster.h"
+#include "i2cqueue.h"
 
 bool i2c_initialized = 0;
 uint8_t mcp23018_status = 0x20;
@@ -77,6 +78,9 @@ void ergodox_blink_all_leds(void)
 uint8_t init_mcp23018(void) {
     mcp23018_status = 0x20;
 
+    // blocking I2C below can't be used while queue is busy
+    i2c_queue_wait(ERGODOX_I2C_TIMEOUT);
+
     // I2C subsystem
     if (i2c_initialized == 0) {
         i2c_init();  // on pins D(1,0)
@@ -115,6 +119,9 @@ uint8_t ergodox_left_leds_update(void) {
     if (mcp23018_status) { // if there was an error
         return mcp23018_status;
     }
+    if (!i2c_queue_wait(ERGODOX_I2C_TIMEOUT)) {
+        return mcp23018_status = 1;
+    }
 
     // set logical value (doesn't matter on inputs)
     // - unused  : hi-Z : 1
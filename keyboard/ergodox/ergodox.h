@@ -50,6 +50,11 @@ Most used files are located at
 
 extern uint8_t mcp23018_status;
 
+// time(ms) to wait for transactions queued on I2C
+#ifndef ERGODOX_I2C_TIMEOUT
+#   define ERGODOX_I2C_TIMEOUT      20
+#endif
+
 void init_ergodox(void);
 void ergodox_blink_all_leds(void);
 uint8_t init_mcp23018(void);
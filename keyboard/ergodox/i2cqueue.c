@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <compat/twi.h>
+#include "ringbuf.h"
+#include "timer.h"
+#include "i2cmaster.h"
+#include "i2cqueue.h"
+
+
+// transaction slots; one is never used
+#define I2C_QUEUE_SIZE  16
+
+RINGBUF_DEFINE(txq, i2c_txn_t, I2C_QUEUE_SIZE);
+
+static volatile bool busy = false;
+static volatile uint8_t errors = 0;
+static volatile uint8_t status = 0;
+
+// transaction on the bus: touched only in ISR while busy
+static i2c_txn_t cur;
+static uint8_t idx;
+static bool reading;
+
+#define TWCR_NEXT   ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+#define TWCR_STOP   ((1<<TWINT) | (1<<TWEN) | (1<<TWSTO))
+
+/* Starts next transaction or stops bus; called with interrupt disabled */
+static void next(void)
+{
+    if (txq_get(&cur)) {
+        idx = 0;
+        reading = false;
+        TWCR = TWCR_NEXT | (1<<TWSTA);
+    } else {
+        TWCR = TWCR_STOP;
+        busy = false;
+    }
+}
+
+bool i2c_queue_put(const i2c_txn_t *txn)
+{
+    // error in ISR resets the queue: it must not run in the middle of put
+    uint8_t sreg = SREG;
+    cli();
+    if (!txq_put(*txn)) {
+        SREG = sreg;
+        return false;
+    }
+    if (!busy) {
+        // STOP of last transaction may be still on the bus
+        while (TWCR & (1<<TWSTO)) ;
+        busy = true;
+        next();
+    }
+    SREG = sreg;
+    return true;
+}
+
+bool i2c_queue_busy(void)
+{
+    return busy;
+}
+
+bool i2c_queue_wait(uint8_t timeout)
+{
+    uint16_t t = timer_read();
+    while (busy) {
+        if (timer_elapsed(t) > timeout) {
+            i2c_queue_abort();
+            return false;
+        }
+    }
+    return true;
+}
+
+void i2c_queue_abort(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (busy) {
+        if (errors != 0xFF) errors++;
+        status = TW_STATUS;
+    }
+    // TWI module is reset when disabled
+    TWCR = 0;
+    txq_reset();
+    busy = false;
+    SREG = sreg;
+    i2c_init();
+}
+
+uint8_t i2c_queue_errors(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t e = errors;
+    errors = 0;
+    SREG = sreg;
+    return e;
+}
+
+uint8_t i2c_queue_status(void)
+{
+    return status;
+}
+
+ISR(TWI_vect)
+{
+    switch (TW_STATUS) {
+        case TW_START:
+        case TW_REP_START:
+            TWDR = (cur.addr<<1) | (reading ? I2C_READ : I2C_WRITE);
+            TWCR = TWCR_NEXT;
+            break;
+        case TW_MT_SLA_ACK:
+        case TW_MT_DATA_ACK:
+            if (idx < cur.len) {
+                TWDR = cur.data[idx++];
+                TWCR = TWCR_NEXT;
+            } else if (cur.read) {
+                reading = true;
+                TWCR = TWCR_NEXT | (1<<TWSTA);
+            } else {
+                next();
+            }
+            break;
+        case TW_MR_SLA_ACK:
+            // receive the only byte with NACK
+            TWCR = TWCR_NEXT;
+            break;
+        case TW_MR_DATA_NACK:
+            *cur.read = TWDR;
+            next();
+            break;
+        default:
+            // NACK, arbitration lost or bus error: release bus and discard the rest
+            if (errors != 0xFF) errors++;
+            status = TW_STATUS;
+            txq_reset();
+            TWCR = TWCR_STOP;
+            busy = false;
+            break;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef I2CQUEUE_H
+#define I2CQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Interrupt-driven I2C transaction queue on hardware TWI
+ *
+ * Queued transactions are run in order by TWI interrupt while main loop does
+ * other work. A transaction writes 'len' bytes of 'data' to device 'addr',
+ * then reads one byte into 'read' after repeated start unless it is NULL.
+ * Transactions are chained with repeated start and STOP is sent when the
+ * queue gets empty.
+ *
+ * On error(NACK, arbitration lost or bus error) STOP is sent and the rest of
+ * queue is discarded; the error is counted until i2c_queue_errors() is called.
+ *
+ * Blocking functions of i2cmaster.h must not be used while the queue is busy,
+ * call i2c_queue_wait() before them.
+ */
+#define I2C_QUEUE_DATA_MAX  2
+
+typedef struct {
+    uint8_t addr;                       // 7-bit device address
+    uint8_t len;                        // bytes to write
+    uint8_t data[I2C_QUEUE_DATA_MAX];
+    uint8_t *read;                      // NULL: write only
+} i2c_txn_t;
+
+/* false when queue is full */
+bool i2c_queue_put(const i2c_txn_t *txn);
+bool i2c_queue_busy(void);
+/* false if not done in timeout(ms), the queue is aborted then */
+bool i2c_queue_wait(uint8_t timeout);
+/* stops transaction on the way and discards the queue */
+void i2c_queue_abort(void);
+/* errors since last call and TWI status of the last one */
+uint8_t i2c_queue_errors(void);
+uint8_t i2c_queue_status(void);
+
+#endif
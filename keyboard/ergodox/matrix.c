@@ -29,14 +29,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "matrix.h"
 #include "ergodox.h"
 #include "i2cmaster.h"
-#ifdef DEBUG_MATRIX_SCAN_RATE
-#include  "timer.h"
-#endif
+#include "i2cqueue.h"
+#include "timer.h"
 
 #ifndef DEBOUNCE
 #   define DEBOUNCE	5
 #endif
-static uint8_t debouncing = DEBOUNCE;
+static bool debouncing = false;
+static uint16_t debouncing_time;
 
 /* matrix state(1:on, 0:off) */
 static matrix_row_t matrix[MATRIX_ROWS];
@@ -46,12 +46,39 @@ static matrix_row_t read_cols(uint8_t row);
 static void init_cols(void);
 static void unselect_rows(void);
 static void select_row(uint8_t row);
+static void left_task(void);
 
-static uint8_t mcp23018_reset_loop;
+/*
+ * Left half(MCP23018) is swept by I2C queue in background while rows on
+ * teensy are scanned; matrix_scan uses result of the last sweep.
+ *
+ * On error the MCP23018 is reset after back-off time which doubles from
+ * ERGODOX_I2C_BACKOFF_MIN up to ERGODOX_I2C_BACKOFF_MAX while it fails.
+ */
+#ifndef ERGODOX_I2C_BACKOFF_MIN
+#   define ERGODOX_I2C_BACKOFF_MIN  16      // ms
+#endif
+#ifndef ERGODOX_I2C_BACKOFF_MAX
+#   define ERGODOX_I2C_BACKOFF_MAX  1024    // ms
+#endif
+
+static uint8_t left_raw[7];
+static matrix_row_t left_cols[7];
+static bool left_sweeping = false;
+static uint16_t left_sweep_time;
+static uint16_t left_retry_time;
+static uint16_t left_backoff = ERGODOX_I2C_BACKOFF_MIN;
+#ifdef KEYMAP_CUB
+// layer shown on left LEDs, 0xFF: not sent
+static uint8_t last_layer = 0xFF;
+#endif
 
 #ifdef DEBUG_MATRIX_SCAN_RATE
 uint32_t matrix_timer;
 uint32_t matrix_scan_count;
+static uint16_t left_sweep_count;
+static uint32_t left_sweep_ms;
+static uint16_t left_error_count;
 #endif
 
 inline
@@ -80,6 +107,10 @@ void matrix_init(void)
         matrix[i] = 0;
         matrix_debouncing[i] = 0;
     }
+    for (uint8_t i=0; i < 7; i++) {
+        left_cols[i] = 0;
+    }
+    left_retry_time = timer_read();
 
 #ifdef DEBUG_MATRIX_SCAN_RATE
     matrix_timer = timer_read32();
@@ -89,32 +120,23 @@ void matrix_init(void)
 
 uint8_t matrix_scan(void)
 {
-    if (mcp23018_status) { // if there was an error
-        if (++mcp23018_reset_loop == 0) {
-            // since mcp23018_reset_loop is 8 bit - we'll try to reset once in 255 matrix scans
-            // this will be approx bit more frequent than once per second
-            print("trying to reset mcp23018\n");
-            mcp23018_status = init_mcp23018();
-            if (mcp23018_status) {
-                print("left side not responding\n");
-            } else {
-                print("left side attached\n");
-                ergodox_blink_all_leds();
-            }
-        }
-    }
-
 #ifdef DEBUG_MATRIX_SCAN_RATE
     matrix_scan_count++;
 
     uint32_t timer_now = timer_read32();
     if (TIMER_DIFF_32(timer_now, matrix_timer)>1000) {
-        print("matrix scan frequency: ");
-        pdec(matrix_scan_count);
-        print("\n");
+        xprintf("matrix scan: %lu/s %luus left: %u/s %uus errors: %u\n",
+                matrix_scan_count,
+                (matrix_scan_count ? 1000000UL / matrix_scan_count : 0),
+                left_sweep_count,
+                (left_sweep_count ? (uint16_t)(left_sweep_ms * 1000 / left_sweep_count) : 0),
+                left_error_count);
 
         matrix_timer = timer_now;
         matrix_scan_count = 0;
+        left_sweep_count = 0;
+        left_sweep_ms = 0;
+        left_error_count = 0;
     }
 #endif
 
@@ -163,30 +185,34 @@ uint8_t matrix_scan(void)
             break;
     }
 
-    mcp23018_status = ergodox_left_leds_update();
+    if (layer != last_layer) {
+        last_layer = layer;
+        mcp23018_status = ergodox_left_leds_update();
+    }
 #endif
 
+    // collect last sweep of left half and start next one
+    left_task();
+
     for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
         select_row(i);
         matrix_row_t cols = read_cols(i);
         if (matrix_debouncing[i] != cols) {
             matrix_debouncing[i] = cols;
             if (debouncing) {
-                debug("bounce!: "); debug_hex(debouncing); debug("\n");
+                debug("bounce!: "); debug_dec(timer_elapsed(debouncing_time)); debug("ms\n");
             }
-            debouncing = DEBOUNCE;
+            debouncing = true;
+            debouncing_time = timer_read();
         }
         unselect_rows();
     }
 
-    if (debouncing) {
-        if (--debouncing) {
-            _delay_ms(1);
-        } else {
-            for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
-                matrix[i] = matrix_debouncing[i];
-            }
+    if (debouncing && timer_elapsed(debouncing_time) >= DEBOUNCE) {
+        for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
+            matrix[i] = matrix_debouncing[i];
         }
+        debouncing = false;
     }
 
     return 1;
@@ -229,6 +255,80 @@ uint8_t matrix_key_count(void)
     return count;
 }
 
+/* Sweep of left half
+ *
+ * Each row is selected by writing GPIOA and read in the same transaction:
+ * address pointer of MCP23018 moves to GPIOB after the write(IOCON.SEQOP=0)
+ * and read after repeated start returns the columns.
+ */
+static void left_task(void)
+{
+    if (mcp23018_status) { // if there was an error
+        if (timer_elapsed(left_retry_time) < left_backoff) return;
+
+        print("trying to reset mcp23018\n");
+        mcp23018_status = init_mcp23018();
+        left_retry_time = timer_read();
+        if (mcp23018_status) {
+            print("left side not responding\n");
+            if (left_backoff < ERGODOX_I2C_BACKOFF_MAX) left_backoff <<= 1;
+            return;
+        }
+        print("left side attached\n");
+#ifdef KEYMAP_CUB
+        // LEDs of the reset MCP23018 are off: send them again
+        last_layer = 0xFF;
+#endif
+        ergodox_blink_all_leds();
+        left_backoff = ERGODOX_I2C_BACKOFF_MIN;
+        left_sweeping = false;
+    }
+
+    if (left_sweeping) {
+        if (i2c_queue_busy()) {
+            if (timer_elapsed(left_sweep_time) <= ERGODOX_I2C_TIMEOUT) return;
+            i2c_queue_abort();
+        }
+        left_sweeping = false;
+
+        if (i2c_queue_errors()) {
+            dprintf("left side error: %02X\n", i2c_queue_status());
+#ifdef DEBUG_MATRIX_SCAN_RATE
+            left_error_count++;
+#endif
+            mcp23018_status = 1;
+            left_retry_time = timer_read();
+            for (uint8_t i = 0; i < 7; i++) {
+                left_cols[i] = 0;
+            }
+            return;
+        }
+
+        // B6 and B7 are LED outputs
+        for (uint8_t i = 0; i < 7; i++) {
+            left_cols[i] = ~left_raw[i] & 0x3F;
+        }
+#ifdef DEBUG_MATRIX_SCAN_RATE
+        left_sweep_count++;
+        left_sweep_ms += timer_elapsed(left_sweep_time);
+#endif
+    }
+
+    // select each row and read, then unselect all
+    uint8_t hiz = 0xFF & ~(ergodox_left_led_3<<LEFT_LED_3_SHIFT);
+    for (uint8_t i = 0; i < 7; i++) {
+        i2c_queue_put(&(i2c_txn_t){
+                .addr = I2C_ADDR, .len = 2,
+                .data = { GPIOA, hiz & ~(1<<i) },
+                .read = &left_raw[i] });
+    }
+    i2c_queue_put(&(i2c_txn_t){
+            .addr = I2C_ADDR, .len = 2,
+            .data = { GPIOA, hiz } });
+    left_sweep_time = timer_read();
+    left_sweeping = true;
+}
+
 /* Column pin configuration
  *
  * Teensy
@@ -253,19 +353,8 @@ static void  init_cols(void)
 static matrix_row_t read_cols(uint8_t row)
 {
     if (row < 7) {
-        if (mcp23018_status) { // if there was an error
-            return 0;
-        } else {
-            uint8_t data = 0;
-            mcp23018_status = i2c_start(I2C_ADDR_WRITE);    if (mcp23018_status) goto out;
-            mcp23018_status = i2c_write(GPIOB);             if (mcp23018_status) goto out;
-            mcp23018_status = i2c_start(I2C_ADDR_READ);     if (mcp23018_status) goto out;
-            data = i2c_readNak();
-            data = ~data;
-        out:
-            i2c_stop();
-            return data;
-        }
+        // read by last sweep
+        return left_cols[row];
     } else {
         _delay_us(30);  // without this wait read unstable value.
         // read from teensy
@@ -291,19 +380,7 @@ static matrix_row_t read_cols(uint8_t row)
  */
 static void unselect_rows(void)
 {
-    // unselect on mcp23018
-    if (mcp23018_status) { // if there was an error
-        // do nothing
-    } else {
-        // set all rows hi-Z : 1
-        mcp23018_status = i2c_start(I2C_ADDR_WRITE);    if (mcp23018_status) goto out;
-        mcp23018_status = i2c_write(GPIOA);             if (mcp23018_status) goto out;
-        mcp23018_status = i2c_write( 0xFF
-                              & ~(ergodox_left_led_3<<LEFT_LED_3_SHIFT)
-                          );                            if (mcp23018_status) goto out;
-    out:
-        i2c_stop();
-    }
+    // mcp23018 is unselected at end of sweep
 
     // unselect on teensy
     // Hi-Z(DDR:0, PORT:0) to unselect
@@ -318,20 +395,7 @@ static void unselect_rows(void)
 static void select_row(uint8_t row)
 {
     if (row < 7) {
-        // select on mcp23018
-        if (mcp23018_status) { // if there was an error
-            // do nothing
-        } else {
-            // set active row low  : 0
-            // set other rows hi-Z : 1
-            mcp23018_status = i2c_start(I2C_ADDR_WRITE);        if (mcp23018_status) goto out;
-            mcp23018_status = i2c_write(GPIOA);                 if (mcp23018_status) goto out;
-            mcp23018_status = i2c_write( 0xFF & ~(1<<row)
-                                  & ~(ergodox_left_led_3<<LEFT_LED_3_SHIFT)
-                              );                                if (mcp23018_status) goto out;
-        out:
-            i2c_stop();
-        }
+        // selected in sweep of mcp23018
     } else {
         // select on teensy
         // Output low(DDR:1, PORT:0) to select
@@ -39,6 +39,22 @@ static matrix_row_t _matrix0[MATRIX_ROWS];
 static matrix_row_t _matrix1[MATRIX_ROWS];
 
 
+/*
+ * Scan timing: see avr/topre.h.
+ * Recovery is 75us at least as before.
+ */
+#ifndef TOPRE_SELECT
+#define TOPRE_SELECT        2
+#endif
+#ifndef TOPRE_SETTLE
+#define TOPRE_SETTLE        2
+#endif
+#ifndef TOPRE_RECOVERY_MAX
+#define TOPRE_RECOVERY_MAX  75
+#endif
+#include "avr/topre.h"
+
+
 void matrix_init(void)
 {
 #if 0
@@ -58,6 +74,8 @@ void matrix_init(void)
     for (uint8_t i=0; i < MATRIX_ROWS; i++) _matrix1[i] = 0x00;
     matrix = _matrix0;
     matrix_prev = _matrix1;
+
+    topre_init();
 }
 
 uint8_t matrix_scan(void)
@@ -68,54 +86,8 @@ uint8_t matrix_scan(void)
     matrix_prev = matrix;
     matrix = tmp;
 
-    uint8_t row, col;
-    for (col = 0; col < MATRIX_COLS; col++) {
-        SET_COL(col);
-        for (row = 0; row < MATRIX_ROWS; row++) {
-            //KEY_SELECT(row, col);
-            SET_ROW(row);
-            _delay_us(2);
-
-            // Not sure this is needed. This just emulates HHKB controller's behaviour.
-            if (matrix_prev[row] & (1<<col)) {
-                KEY_HYS_ON();
-            }
-            _delay_us(10);
-
-            // NOTE: KEY_STATE is valid only in 20us after KEY_ENABLE.
-            // If V-USB interrupts in this section we could lose 40us or so
-            // and would read invalid value from KEY_STATE.
-            uint8_t last = TIMER_RAW;
-
-            KEY_ENABLE();
-
-            // Wait for KEY_STATE outputs its value.
-            _delay_us(2);
-
-            if (KEY_STATE()) {
-                matrix[row] &= ~(1<<col);
-            } else {
-                matrix[row] |= (1<<col);
-            }
-
-            // Ignore if this code region execution time elapses more than 20us.
-            // MEMO: 20[us] * (TIMER_RAW_FREQ / 1000000)[count per us]
-            // MEMO: then change above using this rule: a/(b/c) = a*1/(b/c) = a*(c/b)
-            if (TIMER_DIFF_RAW(TIMER_RAW, last) > 20/(1000000/TIMER_RAW_FREQ)) {
-                matrix[row] = matrix_prev[row];
-            }
-
-            _delay_us(5);
-            KEY_HYS_OFF();
-            KEY_UNABLE();
-
-            // NOTE: KEY_STATE keep its state in 20us after KEY_ENABLE.
-            // This takes 25us or more to make sure KEY_STATE returns to idle state.
-            _delay_us(75);
-        }
-        if (matrix[row] ^ matrix_prev[row]) {
-            matrix_last_modified = timer_read32();
-        }
+    if (topre_scan(matrix, matrix_prev)) {
+        matrix_last_modified = timer_read32();
     }
     return 1;
 }
@@ -126,6 +98,15 @@ matrix_row_t matrix_get_row(uint8_t row)
     return matrix[row];
 }
 
+void matrix_print(void)
+{
+    print("\n  0123456789ABCDEF\n");
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        xprintf("%X:%016b\n", row, bitrev16(matrix_get_row(row)));
+    }
+    topre_print();
+}
+
 void led_set(uint8_t usb_led)
 {
     if (usb_led & (1<<USB_LED_CAPS_LOCK)) {
@@ -57,6 +57,11 @@ static inline void SET_COL(uint8_t COL)
     // Col:8-F |low        |high
     PORTB = (PORTB & 0xE0) | ((COL & 0x08) ? 1<<4 : 1<<3) | (COL & 0x07);
 }
+static inline void KEY_SELECT(uint8_t ROW, uint8_t COL)
+{
+    SET_COL(COL);
+    SET_ROW(ROW);
+}
 
 
 #ifdef UNIMAP_ENABLE
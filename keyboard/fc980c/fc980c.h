@@ -54,6 +54,11 @@ static inline void SET_COL(uint8_t COL)
     // PB0-3
     PORTB = (PORTB & 0xF0) | (COL & 0x0F);
 }
+static inline void KEY_SELECT(uint8_t ROW, uint8_t COL)
+{
+    SET_COL(COL);
+    SET_ROW(ROW);
+}
 
 
 #ifdef UNIMAP_ENABLE
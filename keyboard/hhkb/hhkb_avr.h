@@ -39,8 +39,8 @@
 static inline void KEY_ENABLE(void) { (PORTB &= ~(1<<6)); }
 static inline void KEY_UNABLE(void) { (PORTB |=  (1<<6)); }
 static inline bool KEY_STATE(void) { return (PIND & (1<<7)); }
-static inline void KEY_PREV_ON(void) { (PORTB |=  (1<<7)); }
-static inline void KEY_PREV_OFF(void) { (PORTB &= ~(1<<7)); }
+static inline void KEY_HYS_ON(void) { (PORTB |=  (1<<7)); }
+static inline void KEY_HYS_OFF(void) { (PORTB &= ~(1<<7)); }
 #ifdef HHKB_POWER_SAVING
 static inline void KEY_POWER_ON(void) {
     DDRB = 0xFF; PORTB = 0x40;          // change pins output
@@ -77,7 +77,7 @@ static inline void KEY_INIT(void)
     PORTC |=  (1<<6|1<<7);
 #endif
     KEY_UNABLE();
-    KEY_PREV_OFF();
+    KEY_HYS_OFF();
 
     KEY_POWER_OFF();
 }
@@ -115,8 +115,8 @@ static inline void KEY_SELECT(uint8_t ROW, uint8_t COL)
 #define KEY_ENABLE()            (PORTB &= ~(1<<6))
 #define KEY_UNABLE()            (PORTB |=  (1<<6))
 #define KEY_STATE()             (PINE & (1<<6))
-#define KEY_PREV_ON()           (PORTE |=  (1<<7))
-#define KEY_PREV_OFF()          (PORTE &= ~(1<<7))
+#define KEY_HYS_ON()            (PORTE |=  (1<<7))
+#define KEY_HYS_OFF()           (PORTE &= ~(1<<7))
 #define KEY_POWER_ON()
 #define KEY_POWER_OFF()
 #define KEY_POWER_STATE()       true
@@ -143,7 +143,7 @@ static inline void KEY_SELECT(uint8_t ROW, uint8_t COL)
     PORTB |= 1<<0;                      \
     DDRC  |= 0x0F;                      \
     KEY_UNABLE();                       \
-    KEY_PREV_OFF();                     \
+    KEY_HYS_OFF();                      \
 } while (0)
 #define KEY_SELECT(ROW, COL)    do {    \
     PORTB = (PORTB & 0xE3) | ((ROW) & 0x07)<<2; \
@@ -152,8 +152,8 @@ static inline void KEY_SELECT(uint8_t ROW, uint8_t COL)
 #define KEY_ENABLE()            (PORTC &= ~(1<<3))
 #define KEY_UNABLE()            (PORTC |=  (1<<3))
 #define KEY_STATE()             (PINB & (1<<0))
-#define KEY_PREV_ON()           (PORTB |=  (1<<1))
-#define KEY_PREV_OFF()          (PORTB &= ~(1<<1))
+#define KEY_HYS_ON()            (PORTB |=  (1<<1))
+#define KEY_HYS_OFF()           (PORTB &= ~(1<<1))
 // Power supply switching
 #define KEY_POWER_ON()          do {    \
     KEY_INIT();                         \
@@ -43,6 +43,49 @@ static matrix_row_t _matrix0[MATRIX_ROWS];
 static matrix_row_t _matrix1[MATRIX_ROWS];
 
 
+/*
+ * Scan timing
+ *
+ * Recovery after KEY_UNABLE is 75us(30us on JP) at most. KEY_STATE of a key
+ * read on stays busy for a while after KEY_UNABLE; the longest of that seen
+ * plus HHKB_RECOVERY_MARGIN is used as recovery of all keys, but not shorter
+ * than TOPRE_RECOVERY_MIN. Keys not pressed show nothing to measure, so the
+ * maximum is kept until a key is seen on. See avr/topre.h.
+ */
+#ifndef TOPRE_RECOVERY_MAX
+#   ifdef HHKB_JP
+#       define TOPRE_RECOVERY_MAX   30
+#   else
+#       define TOPRE_RECOVERY_MAX   75
+#   endif
+#endif
+// NOTE: KEY_STATE keep its state in 20us after KEY_ENABLE.
+#ifndef TOPRE_RECOVERY_MIN
+#define TOPRE_RECOVERY_MIN      25
+#endif
+#ifndef HHKB_RECOVERY_MARGIN
+#define HHKB_RECOVERY_MARGIN    5
+#endif
+
+static uint8_t recovery = TOPRE_RECOVERY_MAX;
+static uint8_t recovery_busy;       // longest busy time of KEY_STATE seen
+
+static inline void recovered(uint8_t busy)
+{
+    if (busy <= recovery_busy) return;
+    recovery_busy = busy;
+
+    uint8_t us = busy + HHKB_RECOVERY_MARGIN;
+    if (us < TOPRE_RECOVERY_MIN) us = TOPRE_RECOVERY_MIN;
+    if (us > TOPRE_RECOVERY_MAX) us = TOPRE_RECOVERY_MAX;
+    recovery = us;
+}
+
+#define TOPRE_RECOVERY          recovery
+#define TOPRE_RECOVERED(us)     recovered(us)
+#include "avr/topre.h"
+
+
 void matrix_init(void)
 {
 #ifdef DEBUG
@@ -57,6 +100,9 @@ void matrix_init(void)
     for (uint8_t i=0; i < MATRIX_ROWS; i++) _matrix1[i] = 0x00;
     matrix = _matrix0;
     matrix_prev = _matrix1;
+
+    if (!KEY_POWER_STATE()) KEY_POWER_ON();
+    topre_init();
 }
 
 uint8_t matrix_scan(void)
@@ -69,67 +115,11 @@ uint8_t matrix_scan(void)
 
     // power on
     if (!KEY_POWER_STATE()) KEY_POWER_ON();
-    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
-        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
-            KEY_SELECT(row, col);
-            _delay_us(5);
-
-            // Not sure this is needed. This just emulates HHKB controller's behaviour.
-            if (matrix_prev[row] & (1<<col)) {
-                KEY_PREV_ON();
-            }
-            _delay_us(10);
-
-            // NOTE: KEY_STATE is valid only in 20us after KEY_ENABLE.
-            // If V-USB interrupts in this section we could lose 40us or so
-            // and would read invalid value from KEY_STATE.
-            uint8_t last = TIMER_RAW;
-
-            KEY_ENABLE();
-
-            // Wait for KEY_STATE outputs its value.
-            // 1us was ok on one HHKB, but not worked on another.
-            // no   wait doesn't work on Teensy++ with pro(1us works)
-            // no   wait does    work on tmk PCB(8MHz) with pro2
-            // 1us  wait does    work on both of above
-            // 1us  wait doesn't work on tmk(16MHz)
-            // 5us  wait does    work on tmk(16MHz)
-            // 5us  wait does    work on tmk(16MHz/2)
-            // 5us  wait does    work on tmk(8MHz)
-            // 10us wait does    work on Teensy++ with pro
-            // 10us wait does    work on 328p+iwrap with pro
-            // 10us wait doesn't work on tmk PCB(8MHz) with pro2(very lagged scan)
-            _delay_us(5);
-
-            if (KEY_STATE()) {
-                matrix[row] &= ~(1<<col);
-            } else {
-                matrix[row] |= (1<<col);
-            }
-
-            // Ignore if this code region execution time elapses more than 20us.
-            // MEMO: 20[us] * (TIMER_RAW_FREQ / 1000000)[count per us]
-            // MEMO: then change above using this rule: a/(b/c) = a*1/(b/c) = a*(c/b)
-            if (TIMER_DIFF_RAW(TIMER_RAW, last) > 20/(1000000/TIMER_RAW_FREQ)) {
-                matrix[row] = matrix_prev[row];
-            }
-
-            _delay_us(5);
-            KEY_PREV_OFF();
-            KEY_UNABLE();
-
-            // NOTE: KEY_STATE keep its state in 20us after KEY_ENABLE.
-            // This takes 25us or more to make sure KEY_STATE returns to idle state.
-#ifdef HHKB_JP
-            // Looks like JP needs faster scan due to its twice larger matrix
-            // or it can drop keys in fast key typing
-            _delay_us(30);
-#else
-            _delay_us(75);
-#endif
-        }
-        if (matrix[row] ^ matrix_prev[row]) matrix_last_modified = timer_read32();
+
+    if (topre_scan(matrix, matrix_prev)) {
+        matrix_last_modified = timer_read32();
     }
+
     // power off
     if (KEY_POWER_STATE() &&
             (USB_DeviceState == DEVICE_STATE_Suspended ||
@@ -153,3 +143,13 @@ void matrix_power_up(void) {
 void matrix_power_down(void) {
     KEY_POWER_OFF();
 }
+
+void matrix_print(void)
+{
+    print("\n  01234567\n");
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        xprintf("%X:%08b\n", row, bitrev(matrix_get_row(row)));
+    }
+
+    topre_print();
+}
@@ -1,4 +1,5 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "host.h"
 #include "host_driver.h"
 #include "serial.h"
@@ -6,6 +7,7 @@
 #include "print.h"
 #include "timer.h"
 #include "wait.h"
+#include "ringbuf.h"
 
 
 /* Host driver */
@@ -70,15 +72,18 @@ const char *rn42_gets(uint16_t timeout)
     return s;
 }
 
+static void tx_pause(void);
+
 void rn42_putc(uint8_t c)
 {
+    tx_pause();
     serial_send(c);
 }
 
 void rn42_puts(char *s)
 {
     while (*s)
-	serial_send(*s++);
+	rn42_putc(*s++);
 }
 
 bool rn42_autoconnecting(void)
@@ -162,6 +167,180 @@ void rn42_print_response(void)
 }
 
 
+/*
+ * Report pipeline
+ *
+ * Reports are sent by USART Data Register Empty interrupt only while RN-42
+ * allows with RTS, so that sending doesn't block keyboard task and bursts
+ * don't overflow buffer of the module. A report is built into 'frame' when
+ * the previous one is done; lanes are taken in order of keyboard, consumer
+ * and mouse.
+ *   keyboard:  single slot, the latest state overwrites unsent one
+ *   consumer:  queue, press and release must be kept in order
+ *   mouse:     queue
+ * When RTS is asserted the interrupt is stopped and rn42_task() resumes it.
+ *
+ * rn42_putc() pauses reports between frames until next rn42_task(). A frame
+ * not finished in time is sent again from its start, so that no report, a key
+ * release in particular, is lost.
+ */
+static report_keyboard_t kbd_slot;
+static volatile bool kbd_ready = false;
+RINGBUF_DEFINE(consumer_q, uint16_t, 8);
+RINGBUF_DEFINE(mouse_q, report_mouse_t, 8);
+
+// frame on the wire: written only in ISR while UDRIE1 is set, polled by tx_pause()
+static uint8_t frame[11];
+static volatile uint8_t frame_len = 0;
+static volatile uint8_t frame_idx = 0;
+static volatile bool tx_paused = false;
+
+/* statistics */
+static uint16_t kbd_overwrite = 0;
+static uint16_t frame_abort = 0;
+static uint16_t lane_full = 0;
+static uint8_t consumer_max = 0;
+static uint8_t mouse_max = 0;
+static bool rts_stalled = false;
+static uint16_t rts_since;
+static uint32_t rts_time = 0;   // ms RTS was asserted with reports pending
+
+static bool next_frame(void)
+{
+    uint8_t *f = frame;
+    if (kbd_ready) {
+        *f++ = 0xFD;    // Raw report mode
+        *f++ = 9;       // length
+        *f++ = 1;       // descriptor type
+        *f++ = kbd_slot.mods;
+        *f++ = 0x00;
+        for (uint8_t i = 0; i < 6; i++) *f++ = kbd_slot.keys[i];
+        kbd_ready = false;
+    } else {
+        uint16_t bits;
+        report_mouse_t m;
+        if (consumer_q_get(&bits)) {
+            *f++ = 0xFD;    // Raw report mode
+            *f++ = 3;       // length
+            *f++ = 3;       // descriptor type
+            *f++ = bits&0xFF;
+            *f++ = (bits>>8)&0xFF;
+        } else if (mouse_q_get(&m)) {
+            *f++ = 0xFD;    // Raw report mode
+            *f++ = 5;       // length
+            *f++ = 2;       // descriptor type
+            *f++ = m.buttons;
+            *f++ = m.x;
+            *f++ = m.y;
+            *f++ = m.v;
+        } else {
+            return false;
+        }
+    }
+    frame_len = f - frame;
+    frame_idx = 0;
+    return true;
+}
+
+ISR(USART1_UDRE_vect)
+{
+    if (rn42_rts() || (frame_idx >= frame_len && (tx_paused || !next_frame()))) {
+        // not allowed to send or nothing to send
+        UCSR1B &= ~(1<<UDRIE1);
+        return;
+    }
+    SERIAL_UART_DATA = frame[frame_idx++];
+}
+
+static bool tx_active(void)
+{
+    return (frame_idx < frame_len) || kbd_ready ||
+           !consumer_q_is_empty() || !mouse_q_is_empty();
+}
+
+// frame partly sent
+static bool tx_in_frame(void)
+{
+    // index and length of one frame: ISR may start next frame in between
+    uint8_t sreg = SREG;
+    cli();
+    bool in_frame = (frame_idx > 0 && frame_idx < frame_len);
+    SREG = sreg;
+    return in_frame;
+}
+
+static void tx_kick(void)
+{
+    if (!tx_active()) return;
+    // only a frame on the wire is finished while paused
+    if (tx_paused && !tx_in_frame()) return;
+
+    if (rn42_rts()) {
+        if (!rts_stalled) {
+            rts_stalled = true;
+            rts_since = timer_read();
+        }
+        return;
+    }
+    if (rts_stalled) {
+        rts_stalled = false;
+        rts_time += timer_elapsed(rts_since);
+    }
+    UCSR1B |= (1<<UDRIE1);
+}
+
+static void tx_reset(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    UCSR1B &= ~(1<<UDRIE1);
+    // rest of frame on the wire is given up
+    frame_len = frame_idx = 0;
+    kbd_ready = false;
+    consumer_q_reset();
+    mouse_q_reset();
+    rts_stalled = false;
+    SREG = sreg;
+}
+
+static void tx_pause(void)
+{
+    if (tx_paused) return;
+    tx_paused = true;
+
+    uint16_t t = timer_read();
+    while (tx_in_frame() && timer_elapsed(t) < 100) tx_kick();
+
+    uint8_t sreg = SREG;
+    cli();
+    if (tx_in_frame()) {
+        // RN-42 doesn't take it in time: send whole frame again later
+        UCSR1B &= ~(1<<UDRIE1);
+        frame_idx = 0;
+        frame_abort++;
+    }
+    SREG = sreg;
+}
+
+void rn42_tx_task(void)
+{
+    tx_paused = false;
+    tx_kick();
+}
+
+void rn42_tx_clear(void)
+{
+    tx_reset();
+}
+
+void rn42_tx_print(void)
+{
+    xprintf("tx: kbd:%u consumer:%u/%u mouse:%u/%u\n",
+            kbd_ready, consumer_q_count(), consumer_max, mouse_q_count(), mouse_max);
+    xprintf("tx: overwrite:%u full:%u abort:%u rts:%lums\n",
+            kbd_overwrite, lane_full, frame_abort, rts_time);
+}
+
 static void send_keyboard(report_keyboard_t *report)
 {
     // wake from deep sleep
@@ -171,17 +350,13 @@ static void send_keyboard(report_keyboard_t *report)
     PORTD &= ~(1<<5);   // low
 */
 
-    serial_send(0xFD);  // Raw report mode
-    serial_send(9);     // length
-    serial_send(1);     // descriptor type
-    serial_send(report->mods);
-    serial_send(0x00);
-    serial_send(report->keys[0]);
-    serial_send(report->keys[1]);
-    serial_send(report->keys[2]);
-    serial_send(report->keys[3]);
-    serial_send(report->keys[4]);
-    serial_send(report->keys[5]);
+    uint8_t sreg = SREG;
+    cli();
+    if (kbd_ready) kbd_overwrite++;
+    kbd_slot = *report;
+    kbd_ready = true;
+    SREG = sreg;
+    tx_kick();
 }
 
 static void send_mouse(report_mouse_t *report)
@@ -193,13 +368,9 @@ static void send_mouse(report_mouse_t *report)
     PORTD &= ~(1<<5);   // low
 */
 
-    serial_send(0xFD);  // Raw report mode
-    serial_send(5);     // length
-    serial_send(2);     // descriptor type
-    serial_send(report->buttons);
-    serial_send(report->x);
-    serial_send(report->y);
-    serial_send(report->v);
+    if (!mouse_q_put(*report)) lane_full++;
+    if (mouse_q_count() > mouse_max) mouse_max = mouse_q_count();
+    tx_kick();
 }
 
 static void send_system(uint16_t data)
@@ -234,12 +405,9 @@ static uint16_t usage2bits(uint16_t usage)
 
 static void send_consumer(uint16_t data)
 {
-    uint16_t bits = usage2bits(data);
-    serial_send(0xFD);  // Raw report mode
-    serial_send(3);     // length
-    serial_send(3);     // descriptor type
-    serial_send(bits&0xFF);
-    serial_send((bits>>8)&0xFF);
+    if (!consumer_q_put(usage2bits(data))) lane_full++;
+    if (consumer_q_count() > consumer_max) consumer_max = consumer_q_count();
+    tx_kick();
 }
 
 
@@ -21,6 +21,11 @@ void rn42_cts_lo(void);
 bool rn42_linked(void);
 void rn42_set_leds(uint8_t l);
 
+/* report pipeline: resumes sending, discards pending reports, prints stats */
+void rn42_tx_task(void);
+void rn42_tx_clear(void);
+void rn42_tx_print(void);
+
 const char *rn42_send_command(const char *cmd);
 void rn42_send_str(const char *str);
 void rn42_print_response(void);
@@ -41,6 +41,10 @@ void rn42_task_init(void)
 void rn42_task(void)
 {
     int16_t c;
+
+    // resume sending reports stopped by RTS
+    rn42_tx_task();
+
     // Raw mode: interpret output report of LED state
     while ((c = rn42_getc()) != -1) {
         // LED Out report: 0xFE, 0x02, 0x01, <leds>
@@ -85,6 +89,7 @@ void rn42_task(void)
             }
         } else {
             if (host_get_driver() != &lufa_driver) {
+                rn42_tx_clear();
                 clear_keyboard();
 #ifdef NKRO_ENABLE
                 keyboard_nkro = rn42_nkro_last;
@@ -304,6 +309,7 @@ bool command_extra(uint8_t code)
             xprintf("force_usb: %X\n", force_usb);
             xprintf("rn42: %s\n", rn42_rts() ? "OFF" : (rn42_linked() ? "CONN" : "ON"));
             xprintf("rn42_autoconnecting(): %X\n", rn42_autoconnecting());
+            rn42_tx_print();
             xprintf("config_mode: %X\n", config_mode);
             xprintf("USB State: %s\n",
                     (USB_DeviceState == DEVICE_STATE_Unattached) ? "Unattached" :
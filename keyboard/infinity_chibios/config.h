@@ -40,6 +40,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 /* Set 0 if debouncing isn't needed */
 #define DEBOUNCE    5
 
+/* Background matrix scan by timer with MATRIX_SCAN_GPT = yes in Makefile */
+#define MATRIX_GPT_DRIVER   GPTD1       // PIT0
+#define MATRIX_SCAN_RATE    2000        // scans per second
+
 /* Mechanical locking support. Use KC_LCAP, KC_LNUM or KC_LSCR instead in keymap */
 //#define LOCKING_SUPPORT_ENABLE
 /* Locking resynchronize hack */
@@ -6,6 +6,9 @@
 #include "wait.h"
 #include "print.h"
 #include "matrix.h"
+#ifdef MATRIX_SCAN_GPT
+#include "chibios/matrix_gpt.h"
+#endif
 
 
 /*
@@ -22,6 +25,10 @@ static matrix_row_t matrix_debouncing[MATRIX_ROWS];
 static bool debouncing = false;
 static uint16_t debouncing_time = 0;
 
+static void select_row(uint8_t row);
+static void unselect_row(uint8_t row);
+static matrix_row_t read_cols(void);
+
 
 void matrix_init(void)
 {
@@ -47,43 +54,35 @@ void matrix_init(void)
 
     memset(matrix, 0, MATRIX_ROWS);
     memset(matrix_debouncing, 0, MATRIX_ROWS);
+
+#ifdef MATRIX_SCAN_GPT
+    matrix_gpt_start();
+#endif
 }
 
 uint8_t matrix_scan(void)
 {
+#ifdef MATRIX_SCAN_GPT
+    // complete scan by timer in background
+    matrix_row_t rows[MATRIX_ROWS];
+    uint32_t time;
+    if (matrix_gpt_get(rows, &time)) {
+        for (int row = 0; row < MATRIX_ROWS; row++) {
+            if (matrix_debouncing[row] != rows[row]) {
+                matrix_debouncing[row] = rows[row];
+                debouncing = true;
+                debouncing_time = (uint16_t)time;
+            }
+        }
+    }
+#else
     for (int row = 0; row < MATRIX_ROWS; row++) {
         matrix_row_t data = 0;
 
-        // strobe row
-        switch (row) {
-            case 0: palSetPad(GPIOB, 0);    break;
-            case 1: palSetPad(GPIOB, 1);    break;
-            case 2: palSetPad(GPIOB, 2);    break;
-            case 3: palSetPad(GPIOB, 3);    break;
-            case 4: palSetPad(GPIOB, 16);   break;
-            case 5: palSetPad(GPIOB, 17);   break;
-            case 6: palSetPad(GPIOC, 4);    break;
-            case 7: palSetPad(GPIOC, 5);    break;
-            case 8: palSetPad(GPIOD, 0);    break;
-        }
-
+        select_row(row);
         wait_us(1); // need wait to settle pin state
-
-        // read col data
-        data = (palReadPort(GPIOD)>>1);
-
-        // un-strobe row
-        switch (row) {
-            case 0: palClearPad(GPIOB, 0);    break;
-            case 1: palClearPad(GPIOB, 1);    break;
-            case 2: palClearPad(GPIOB, 2);    break;
-            case 3: palClearPad(GPIOB, 3);    break;
-            case 4: palClearPad(GPIOB, 16);   break;
-            case 5: palClearPad(GPIOB, 17);   break;
-            case 6: palClearPad(GPIOC, 4);    break;
-            case 7: palClearPad(GPIOC, 5);    break;
-            case 8: palClearPad(GPIOD, 0);    break;
-        }
+        data = read_cols();
+        unselect_row(row);
 
         if (matrix_debouncing[row] != data) {
             matrix_debouncing[row] = data;
@@ -91,6 +90,7 @@ uint8_t matrix_scan(void)
             debouncing_time = timer_read();
         }
     }
+#endif
 
     if (debouncing && timer_elapsed(debouncing_time) > DEBOUNCE) {
         for (int row = 0; row < MATRIX_ROWS; row++) {
@@ -126,3 +126,47 @@ void matrix_print(void)
         xprintf("\n");
     }
 }
+
+/* strobe row */
+static void select_row(uint8_t row)
+{
+    switch (row) {
+        case 0: palSetPad(GPIOB, 0);    break;
+        case 1: palSetPad(GPIOB, 1);    break;
+        case 2: palSetPad(GPIOB, 2);    break;
+        case 3: palSetPad(GPIOB, 3);    break;
+        case 4: palSetPad(GPIOB, 16);   break;
+        case 5: palSetPad(GPIOB, 17);   break;
+        case 6: palSetPad(GPIOC, 4);    break;
+        case 7: palSetPad(GPIOC, 5);    break;
+        case 8: palSetPad(GPIOD, 0);    break;
+    }
+}
+
+/* un-strobe row */
+static void unselect_row(uint8_t row)
+{
+    switch (row) {
+        case 0: palClearPad(GPIOB, 0);    break;
+        case 1: palClearPad(GPIOB, 1);    break;
+        case 2: palClearPad(GPIOB, 2);    break;
+        case 3: palClearPad(GPIOB, 3);    break;
+        case 4: palClearPad(GPIOB, 16);   break;
+        case 5: palClearPad(GPIOB, 17);   break;
+        case 6: palClearPad(GPIOC, 4);    break;
+        case 7: palClearPad(GPIOC, 5);    break;
+        case 8: palClearPad(GPIOD, 0);    break;
+    }
+}
+
+/* read col data */
+static matrix_row_t read_cols(void)
+{
+    return (palReadPort(GPIOD)>>1);
+}
+
+#ifdef MATRIX_SCAN_GPT
+void matrix_gpt_select_row(uint8_t row)     { select_row(row); }
+void matrix_gpt_unselect_row(uint8_t row)   { unselect_row(row); }
+matrix_row_t matrix_gpt_read_cols(void)     { return read_cols(); }
+#endif
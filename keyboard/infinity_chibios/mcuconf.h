@@ -43,6 +43,13 @@
  */
 #define KINETIS_SERIAL_USE_UART0            TRUE
 
+/*
+ * GPT driver system settings: PIT0 for background matrix scan
+ */
+#ifdef MATRIX_SCAN_GPT
+#define KINETIS_GPT_USE_PIT0                TRUE
+#endif
+
 /*
  * USB driver settings
  */
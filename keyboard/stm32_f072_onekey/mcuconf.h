@@ -84,7 +84,11 @@
  */
 #define STM32_GPT_USE_TIM1                  FALSE
 #define STM32_GPT_USE_TIM2                  FALSE
+#ifdef MATRIX_SCAN_GPT
+#define STM32_GPT_USE_TIM3                  TRUE
+#else
 #define STM32_GPT_USE_TIM3                  FALSE
+#endif
 #define STM32_GPT_USE_TIM14                 FALSE
 #define STM32_GPT_TIM1_IRQ_PRIORITY         2
 #define STM32_GPT_TIM2_IRQ_PRIORITY         2
@@ -26,6 +26,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "util.h"
 #include "matrix.h"
 #include "wait.h"
+#ifdef MATRIX_SCAN_GPT
+#include "timer.h"
+#include "chibios/matrix_gpt.h"
+#endif
 
 #ifndef DEBOUNCE
 #   define DEBOUNCE 5
@@ -85,8 +89,47 @@ void matrix_init(void)
     LED_ON();
     wait_ms(500);
     LED_OFF();
+
+#ifdef MATRIX_SCAN_GPT
+    matrix_gpt_start();
+#endif
+}
+
+#ifdef MATRIX_SCAN_GPT
+static uint16_t debouncing_time;
+
+/* complete scan by timer in background; debounce with time of the scan */
+uint8_t matrix_scan(void)
+{
+    matrix_row_t rows[MATRIX_ROWS];
+    uint32_t time;
+    if (matrix_gpt_get(rows, &time)) {
+        for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
+            if (matrix_debouncing[i] != rows[i]) {
+                matrix_debouncing[i] = rows[i];
+                if (debouncing) {
+                    debug("bounce!: "); debug_hex(timer_elapsed(debouncing_time)); debug("\n");
+                }
+                debouncing = 1;
+                debouncing_time = (uint16_t)time;
+            }
+        }
+    }
+
+    if (debouncing && timer_elapsed(debouncing_time) > DEBOUNCE) {
+        for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
+            matrix[i] = matrix_debouncing[i];
+        }
+        debouncing = 0;
+    }
+
+    return 1;
 }
 
+void matrix_gpt_select_row(uint8_t row)     { select_row(row); }
+void matrix_gpt_unselect_row(uint8_t row)   { (void)row; unselect_rows(); }
+matrix_row_t matrix_gpt_read_cols(void)     { return read_cols(); }
+#else
 uint8_t matrix_scan(void)
 {
     for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
@@ -115,6 +158,7 @@ uint8_t matrix_scan(void)
 
     return 1;
 }
+#endif
 
 inline
 bool matrix_is_on(uint8_t row, uint8_t col)
@@ -89,7 +89,11 @@
  */
 #define STM32_GPT_USE_TIM1                  FALSE
 #define STM32_GPT_USE_TIM2                  FALSE
+#ifdef MATRIX_SCAN_GPT
+#define STM32_GPT_USE_TIM3                  TRUE
+#else
 #define STM32_GPT_USE_TIM3                  FALSE
+#endif
 #define STM32_GPT_USE_TIM4                  FALSE
 #define STM32_GPT_USE_TIM5                  FALSE
 #define STM32_GPT_USE_TIM8                  FALSE
@@ -5,6 +5,87 @@
 #include "led.h"
 #include "sleep_led.h"
 
+/* Hardware PWM
+ * Define one of these in config.h when the LED is on OC1x pin:
+ *   SLEEP_LED_PWM_OC1A, SLEEP_LED_PWM_OC1B or SLEEP_LED_PWM_OC1C
+ * and SLEEP_LED_PWM_INVERT when the LED is lit with low.
+ * The pin must be configured as output by the board.
+ *
+ * Timer1 runs 8-bit fast PWM on the pin and overflow interrupt steps the duty
+ * from breathing_table; interrupts are F_CPU/(prescale*256) per second instead
+ * of 256*64 with software PWM, and the timer keeps running in idle sleep
+ * so that suspend_power_down() can idle the MCU.
+ *
+ * 244Hz at 16MHz, 488Hz at 8MHz   PWM frequency(= interrupts/second)
+ * 16                              table steps/second
+ */
+#ifdef ADB_USE_ICP
+#   error "SLEEP_LED_ENABLE: Timer1 is also used by ADB_USE_ICP"
+#endif
+
+#if defined(SLEEP_LED_PWM_OC1A)
+#   define SLEEP_LED_OCR    OCR1A
+#   define SLEEP_LED_COM1   COM1A1
+#   define SLEEP_LED_COM0   COM1A0
+#elif defined(SLEEP_LED_PWM_OC1B)
+#   define SLEEP_LED_OCR    OCR1B
+#   define SLEEP_LED_COM1   COM1B1
+#   define SLEEP_LED_COM0   COM1B0
+#elif defined(SLEEP_LED_PWM_OC1C)
+#   define SLEEP_LED_OCR    OCR1C
+#   define SLEEP_LED_COM1   COM1C1
+#   define SLEEP_LED_COM0   COM1C0
+#endif
+
+#ifdef SLEEP_LED_OCR
+
+#ifdef SLEEP_LED_PWM_INVERT
+#   define SLEEP_LED_COM    (_BV(SLEEP_LED_COM1) | _BV(SLEEP_LED_COM0))
+#else
+#   define SLEEP_LED_COM    _BV(SLEEP_LED_COM1)
+#endif
+
+#if F_CPU >= 16000000
+#   define SLEEP_LED_PRESCALE   256
+#   define SLEEP_LED_CS         _BV(CS12)
+#else
+#   define SLEEP_LED_PRESCALE   64
+#   define SLEEP_LED_CS         (_BV(CS11) | _BV(CS10))
+#endif
+/* PWM periods per table step */
+#define SLEEP_LED_STEP  (F_CPU / SLEEP_LED_PRESCALE / 256 / 16)
+
+static uint8_t step;
+static uint8_t breath;
+
+void sleep_led_init(void)
+{
+    /* Timer1 setup */
+    /* Fast PWM 8-bit mode, output is connected at sleep_led_enable */
+    TCCR1A = _BV(WGM10);
+    TCCR1B = _BV(WGM12) | SLEEP_LED_CS;
+    SLEEP_LED_OCR = 0;
+}
+
+void sleep_led_enable(void)
+{
+    step = 0;
+    breath = 0;
+    SLEEP_LED_OCR = 0;
+    /* Connect pin to PWM output and enable Overflow Interrupt */
+    TCCR1A |= SLEEP_LED_COM;
+    TIMSK1 |= _BV(TOIE1);
+}
+
+void sleep_led_disable(void)
+{
+    /* Disable Overflow Interrupt and give pin back to port register */
+    TIMSK1 &= ~_BV(TOIE1);
+    TCCR1A &= ~SLEEP_LED_COM;
+}
+
+#else /* SLEEP_LED_OCR */
+
 /* Software PWM
  *  ______           ______           __
  * |  ON  |___OFF___|  ON  |___OFF___|   ....
@@ -45,6 +126,7 @@ void sleep_led_disable(void)
     TIMSK1 &= ~_BV(OCIE1A);
 }
 
+#endif /* SLEEP_LED_OCR */
 
 __attribute__ ((weak))
 void sleep_led_on(void)
@@ -72,6 +154,17 @@ static const uint8_t breathing_table[64] PROGMEM = {
 15, 10, 6, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+#ifdef SLEEP_LED_OCR
+ISR(TIMER1_OVF_vect)
+{
+    if (++step < SLEEP_LED_STEP) return;
+    step = 0;
+    breath = (breath + 1) % 64;
+    /* OCR1x is double buffered and updated at BOTTOM */
+    SLEEP_LED_OCR = pgm_read_byte(&breathing_table[breath]);
+}
+
+#else /* SLEEP_LED_OCR */
 ISR(TIMER1_COMPA_vect)
 {
     /* Software PWM
@@ -100,3 +193,4 @@ ISR(TIMER1_COMPA_vect)
         sleep_led_off();
     }
 }
+#endif /* SLEEP_LED_OCR */
@@ -2,17 +2,43 @@
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <avr/interrupt.h>
+#include <avr/power.h>
 #include "matrix.h"
 #include "action.h"
 #include "backlight.h"
 #include "suspend_avr.h"
 #include "suspend.h"
 #include "timer.h"
+#include "sleep_led.h"
+#include "debug.h"
 #ifdef PROTOCOL_LUFA
 #include "lufa.h"
 #endif
 
 
+/* Wakeup by pin change
+ * With SUSPEND_WAKEUP_PCINT defined, matrix_wakeup_arm() of the board selects
+ * all rows and enables pin change interrupt(PCINT0_vect) of columns so that
+ * MCU sleeps until a key moves, instead of waking every 15ms to scan matrix.
+ * Watchdog wakes it every SUSPEND_WAKEUP_WDTO only to keep time. When the board
+ * can't arm(not implemented or key is on) it falls back to watchdog polling.
+ */
+#ifdef SUSPEND_WAKEUP_PCINT
+#ifndef SUSPEND_WAKEUP_WDTO
+#   define SUSPEND_WAKEUP_WDTO  WDTO_1S
+#endif
+static volatile bool pin_changed = false;
+static bool armed = false;
+static uint16_t pin_changed_time;
+
+/* statistics printed on wakeup */
+static uint16_t wakeup_pin = 0;     // wakeups by pin change
+static uint16_t wakeup_wdt = 0;     // wakeups by watchdog while armed
+static uint16_t wakeup_scan = 0;    // matrix scans
+static uint16_t wakeup_latency = 0; // ms from pin change to wakeup condition
+#endif
+
+
 #define wdt_intr_enable(value)   \
 __asm__ __volatile__ (  \
     "in __tmp_reg__,__SREG__" "\n\t"    \
@@ -30,6 +56,130 @@ __asm__ __volatile__ (  \
 )
 
 
+/* Power reduction while power down
+ * Peripherals not needed to wake up are gated with PRR, ADC and analog
+ * comparator are turned off, and BOD is disabled in sleep on MCUs having
+ * BODS(picoPower); all of them are restored on wakeup. Clock prescale has no
+ * effect since clock stops in power down, and I/O pins are left to
+ * matrix_power_down() of the board.
+ *
+ * Define SUSPEND_PRR0/SUSPEND_PRR1 in config.h to change gated peripherals, and
+ * SUSPEND_POWER_REPORT to list them in build messages.
+ */
+#ifdef PRADC
+#   define PRR_ADC      _BV(PRADC)
+#else
+#   define PRR_ADC      0
+#endif
+#ifdef PRSPI
+#   define PRR_SPI      _BV(PRSPI)
+#else
+#   define PRR_SPI      0
+#endif
+#ifdef PRTWI
+#   define PRR_TWI      _BV(PRTWI)
+#else
+#   define PRR_TWI      0
+#endif
+// Timer1 captures ADB data with ADB_USE_ICP and Talk would never end without its clock
+#if defined(PRTIM1) && !defined(ADB_USE_ICP)
+#   define PRR_TIM1     _BV(PRTIM1)
+#else
+#   define PRR_TIM1     0
+#endif
+#ifdef PRTIM3
+#   define PRR_TIM3     _BV(PRTIM3)
+#else
+#   define PRR_TIM3     0
+#endif
+#ifdef PRTIM4
+#   define PRR_TIM4     _BV(PRTIM4)
+#else
+#   define PRR_TIM4     0
+#endif
+#ifdef PRUSART1
+#   define PRR_USART1   _BV(PRUSART1)
+#else
+#   define PRR_USART1   0
+#endif
+
+// Timer0 keeps time and USB wakes up from suspend: never gated
+#ifndef SUSPEND_PRR0
+#   define SUSPEND_PRR0 (PRR_ADC | PRR_SPI | PRR_TWI | PRR_TIM1)
+#endif
+#ifndef SUSPEND_PRR1
+#   define SUSPEND_PRR1 (PRR_TIM3 | PRR_TIM4 | PRR_USART1)
+#endif
+
+#ifdef SUSPEND_POWER_REPORT
+#   if (SUSPEND_PRR0 & PRR_ADC)
+#       pragma message "suspend: ADC gated"
+#   endif
+#   if (SUSPEND_PRR0 & PRR_SPI)
+#       pragma message "suspend: SPI gated"
+#   endif
+#   if (SUSPEND_PRR0 & PRR_TWI)
+#       pragma message "suspend: TWI gated"
+#   endif
+#   if (SUSPEND_PRR0 & PRR_TIM1)
+#       pragma message "suspend: Timer1 gated"
+#   endif
+#   if (SUSPEND_PRR1 & PRR_TIM3)
+#       pragma message "suspend: Timer3 gated"
+#   endif
+#   if (SUSPEND_PRR1 & PRR_TIM4)
+#       pragma message "suspend: Timer4 gated"
+#   endif
+#   if (SUSPEND_PRR1 & PRR_USART1)
+#       pragma message "suspend: USART1 gated"
+#   endif
+#   if defined(BODS) && defined(BODSE)
+#       pragma message "suspend: BOD disabled in sleep"
+#   else
+#       pragma message "suspend: BOD can't be disabled in sleep on this MCU"
+#   endif
+#endif
+
+static uint8_t saved_prr0, saved_prr1, saved_adcsra, saved_acsr;
+
+static void power_reduction_enter(void)
+{
+#ifdef ADCSRA
+    // ADC should be disabled before gated
+    saved_adcsra = ADCSRA;
+    ADCSRA &= ~_BV(ADEN);
+#endif
+#ifdef ACSR
+    saved_acsr = ACSR;
+    ACSR |= _BV(ACD);
+#endif
+#ifdef PRR0
+    saved_prr0 = PRR0;
+    PRR0 |= SUSPEND_PRR0;
+#endif
+#ifdef PRR1
+    saved_prr1 = PRR1;
+    PRR1 |= SUSPEND_PRR1;
+#endif
+}
+
+static void power_reduction_exit(void)
+{
+#ifdef PRR1
+    PRR1 = saved_prr1;
+#endif
+#ifdef PRR0
+    PRR0 = saved_prr0;
+#endif
+#ifdef ACSR
+    ACSR = saved_acsr;
+#endif
+#ifdef ADCSRA
+    ADCSRA = saved_adcsra;
+#endif
+}
+
+
 /* Power down MCU with watchdog timer
  * wdto: watchdog timer timeout defined in <avr/wdt.h>
  *          WDTO_15MS
@@ -54,17 +204,27 @@ static void power_down(uint8_t wdto)
     // Watchdog Interrupt Mode
     wdt_intr_enable(wdto);
 
-    // TODO: more power saving
-    // See PicoPower application note
-    // - I/O port input with pullup
-    // - prescale clock
-    // - BOD disable
-    // - Power Reduction Register PRR
+    power_reduction_enter();
+
     set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-    sleep_enable();
+    cli();
+#ifdef SUSPEND_WAKEUP_PCINT
+    // pin has changed after armed
+    if (!pin_changed)
+#endif
+    {
+        sleep_enable();
+#if defined(BODS) && defined(BODSE)
+        // timed sequence: sleep must follow within three cycles
+        sleep_bod_disable();
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
     sei();
-    sleep_cpu();
-    sleep_disable();
+
+    power_reduction_exit();
 
     // Disable watchdog after sleep
     wdt_disable();
@@ -93,15 +253,86 @@ static void idle(void)
 }
 
 
+/* Idle till next interrupt: timer tick(1ms) or USB
+ * With USB_IDLE_CLOCK_DIV(clock_div_t) system clock is divided while idling and
+ * compare value of timer is scaled down to keep 1ms tick. USB works since its
+ * PLL doesn't depend on system clock prescaler.
+ *
+ * Scaled compare value is rounded down, so a tick while idling is longer by
+ * IDLE_SLACK counts of undivided timer. Those and low bits of counter dropped
+ * by scaling are carried back to counter after idle.
+ *
+ * Interrupts run with the divided clock too, so USART baud rate and _delay_us
+ * in ISRs are wrong while idling. Protocols which need them can't be used.
+ */
+#ifdef USB_IDLE_CLOCK_DIV
+#   if defined(SERIAL_UART_RXD_VECT) || defined(SERIAL_SOFT_RXD_VECT) || \
+       defined(PS2_INT_VECT) || defined(PS2_USART_RX_VECT) || \
+       defined(IBMPC_INT_VECT) || defined(M0110_INT_VECT) || \
+       defined(NEWS_KBD_RX_VECT) || defined(ADB_USE_ICP) || \
+       defined(SERIAL_MOUSE_ENABLE)
+#       error "USB_IDLE_CLOCK_DIV can't be used with interrupt-driven protocol or UART."
+#   endif
+#define IDLE_DIV        (1 << USB_IDLE_CLOCK_DIV)
+#define IDLE_TOP        (TIMER_RAW_TOP >> USB_IDLE_CLOCK_DIV)
+#define IDLE_SLACK      ((IDLE_TOP + 1) * IDLE_DIV - (TIMER_RAW_TOP + 1))
+_Static_assert(IDLE_TOP >= 2, "USB_IDLE_CLOCK_DIV is too large for timer tick");
+
+static uint8_t idle_carry = 0;  // counts not put back to counter after last idle
+#endif
 void suspend_idle(uint8_t time)
 {
+    (void)time;
+#ifdef USB_IDLE_CLOCK_DIV
+    uint8_t sreg = SREG;
+    cli();
+    // pending tick is counted in idle() and is not one of divided clock
+    uint8_t ticks = timer_count;
+    if (TIFR0 & (1<<OCF0A)) ticks++;
+
+    clock_prescale_set(USB_IDLE_CLOCK_DIV);
+    uint8_t raw = TIMER_RAW;
+    uint8_t carry = idle_carry + (raw & (IDLE_DIV - 1));
+    raw >>= USB_IDLE_CLOCK_DIV;
+    // compare match is blocked after writing its value to counter
+    if (raw == IDLE_TOP) {
+        raw--;
+        carry += IDLE_DIV;
+    }
+    TIMER_RAW = raw;
+    OCR0A = IDLE_TOP;
+
     idle();
+
+    cli();
+    ticks = (uint8_t)timer_count - ticks;
+    if (TIFR0 & (1<<OCF0A)) ticks++;
+    uint16_t count = ((uint16_t)TIMER_RAW << USB_IDLE_CLOCK_DIV) + carry + ticks * IDLE_SLACK;
+    OCR0A = TIMER_RAW_TOP;
+    while (count > TIMER_RAW_TOP) {
+        count -= TIMER_RAW_TOP + 1;
+        timer_count++;
+    }
+    idle_carry = 0;
+    if (count == TIMER_RAW_TOP) {
+        count--;
+        idle_carry = 1;
+    }
+    TIMER_RAW = count;
+    clock_prescale_set(clock_div_1);
+    SREG = sreg;
+#else
+    idle();
+#endif
 }
 
 void suspend_power_down(void)
 {
 #ifdef NO_SUSPEND_POWER_DOWN
-    ;
+#   if defined(SLEEP_LED_ENABLE) && defined(SLEEP_LED_PWM)
+    // hardware PWM of sleep LED keeps running in idle
+    idle();
+#   endif
 #elif defined(SUSPEND_MODE_NOPOWERSAVE)
     ;
 #elif defined(SUSPEND_MODE_STANDBY)
@@ -109,17 +340,37 @@ void suspend_power_down(void)
 #elif defined(SUSPEND_MODE_IDLE)
     idle();
 #else
+#   ifdef SUSPEND_WAKEUP_PCINT
+    pin_changed = false;
+    armed = matrix_wakeup_arm();
+    if (armed) {
+        power_down(SUSPEND_WAKEUP_WDTO);
+        matrix_wakeup_disarm();
+        if (pin_changed) wakeup_pin++; else wakeup_wdt++;
+        return;
+    }
+#   endif
     power_down(WDTO_15MS);
 #endif
 }
 
 bool suspend_wakeup_condition(void)
 {
+#ifdef SUSPEND_WAKEUP_PCINT
+    // no key moved while armed
+    if (armed && !pin_changed) return false;
+    wakeup_scan++;
+#endif
     matrix_power_up();
     matrix_scan();
     matrix_power_down();
     for (uint8_t r = 0; r < MATRIX_ROWS; r++) {
-        if (matrix_get_row(r)) return true;
+        if (matrix_get_row(r)) {
+#ifdef SUSPEND_WAKEUP_PCINT
+            if (wakeup_pin) wakeup_latency = timer_elapsed(pin_changed_time);
+#endif
+            return true;
+        }
     }
     return false;
 }
@@ -127,6 +378,11 @@ bool suspend_wakeup_condition(void)
 // run immediately after wakeup
 void suspend_wakeup_init(void)
 {
+#ifdef SUSPEND_WAKEUP_PCINT
+    dprintf("suspend: pin:%u wdt:%u scan:%u latency:%ums\n",
+            wakeup_pin, wakeup_wdt, wakeup_scan, wakeup_latency);
+    wakeup_pin = wakeup_wdt = wakeup_scan = wakeup_latency = 0;
+#endif
     // clear keyboard state
     matrix_clear();
     clear_keyboard();
@@ -145,7 +401,17 @@ ISR(WDT_vect)
             timer_count += 15 + 2;  // WDTO_15MS + 2(from observation)
             break;
         default:
-            ;
+            // nominal: 2048 cycles of 128kHz oscillator for WDTO_15MS
+            timer_count += (uint32_t)16 << wdt_timeout;
     }
 }
 #endif
+
+#ifdef SUSPEND_WAKEUP_PCINT
+ISR(PCINT0_vect)
+{
+    // timer has stopped while power down
+    if (!pin_changed) pin_changed_time = timer_read();
+    pin_changed = true;
+}
+#endif
@@ -0,0 +1,334 @@
+#ifndef TOPRE_H
+#define TOPRE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include "print.h"
+#include "debug.h"
+#include "util.h"
+#include "timer.h"
+#include "matrix.h"
+#ifdef UNIMAP_ENABLE
+#include "unimap.h"
+#endif
+
+
+/*
+ * Topre capacitive matrix scan
+ *
+ * Shared by HHKB, FC660C and FC980C controllers. Include this in matrix scan
+ * file of the keyboard after its pin functions:
+ *
+ *   KEY_SELECT(row, col)   select key
+ *   KEY_ENABLE/UNABLE()    start/end sensing of selected key
+ *   KEY_STATE()            sense output: 0 while key is on
+ *   KEY_HYS_ON/OFF()       hysteresis control: asserted when key was on
+ *
+ * Timing(us) from key selection:
+ *
+ *   select -> TOPRE_SELECT -> KEY_HYS_ON -> TOPRE_HYS -> KEY_ENABLE
+ *   -> TOPRE_SETTLE -> read -> TOPRE_HOLD -> KEY_UNABLE
+ *   -> TOPRE_RECOVERY..TOPRE_RECOVERY_MAX until KEY_STATE returns to idle
+ *
+ * TOPRE_RECOVERY_MIN is the same as TOPRE_RECOVERY_MAX unless board lowers it,
+ * as KEY_STATE of key not pressed is not proved to go idle earlier.
+ *
+ * Next key is selected at KEY_UNABLE so that TOPRE_SELECT overlaps recovery.
+ *
+ * Board can tune recovery at run time with these defined before include:
+ *
+ *   TOPRE_RECOVERY         recovery minimum in use(us), may be a variable
+ *                          within TOPRE_RECOVERY_MIN..MAX
+ *   TOPRE_RECOVERED(us)    called after a key read on, with time KEY_STATE
+ *                          took to return to idle after KEY_UNABLE
+ *
+ * With unimap only keys in 'unimap_trans' are scanned and empty positions
+ * of matrix are skipped.
+ *
+ * KEY_STATE is valid only in 20us after KEY_ENABLE. A key read later than
+ * that is read again after the scan, up to TOPRE_RETRY passes, or keeps its
+ * previous state.
+ */
+#if (1000000/TIMER_RAW_FREQ > 20)
+#   error "Timer resolution(>20us) is not enough for Topre matrix scan."
+#endif
+
+#ifndef TOPRE_SELECT
+#define TOPRE_SELECT        5
+#endif
+#ifndef TOPRE_HYS
+#define TOPRE_HYS           10
+#endif
+#ifndef TOPRE_SETTLE
+#define TOPRE_SETTLE        5
+#endif
+#ifndef TOPRE_HOLD
+#define TOPRE_HOLD          5
+#endif
+// NOTE: KEY_STATE keep its state in 20us after KEY_ENABLE.
+#ifndef TOPRE_RECOVERY_MAX
+#define TOPRE_RECOVERY_MAX  75
+#endif
+#ifndef TOPRE_RECOVERY_MIN
+#define TOPRE_RECOVERY_MIN  TOPRE_RECOVERY_MAX
+#endif
+#ifndef TOPRE_RECOVERY
+#define TOPRE_RECOVERY      TOPRE_RECOVERY_MIN
+#endif
+#ifndef TOPRE_RECOVERED
+#define TOPRE_RECOVERED(us) ((void)(us))
+#endif
+#ifndef TOPRE_RETRY
+#define TOPRE_RETRY         2       // passes to read keys again
+#endif
+
+#if (TOPRE_RECOVERY_MIN > TOPRE_RECOVERY_MAX)
+#   error "TOPRE_RECOVERY_MIN should not exceed TOPRE_RECOVERY_MAX."
+#endif
+#if (TOPRE_SELECT > TOPRE_RECOVERY_MIN)
+#   error "TOPRE_SELECT should not exceed TOPRE_RECOVERY_MIN."
+#endif
+
+
+#ifdef UNIMAP_ENABLE
+extern const uint8_t unimap_trans[MATRIX_ROWS][MATRIX_COLS];
+#endif
+
+// keys to scan
+static matrix_row_t topre_populated[MATRIX_ROWS];
+static uint8_t topre_keys;
+
+// statistics for console
+static uint32_t topre_stat_us;      // time in topre_scan()
+static uint16_t topre_stat_max;     // us, longest scan
+static uint16_t topre_stat_scans;
+static uint16_t topre_stat_guard;   // reads hit 20us guard
+static uint16_t topre_stat_fail;    // keys failed after retries
+
+
+/* Time in us from timer_count and TIMER_RAW */
+static uint32_t topre_time_us(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ms = timer_count;
+    uint8_t raw = TIMER_RAW;
+    // compare match not serviced yet
+    if ((TIFR0 & (1<<OCF0A)) && raw < TIMER_RAW_TOP/2) ms++;
+    SREG = sreg;
+    return ms * 1000 + raw * (1000000/TIMER_RAW_FREQ);
+}
+
+/*
+ * Moves row/col/bit to populated key at or after the position.
+ * Returns false at end of matrix.
+ */
+static inline bool topre_seek(uint8_t *row, uint8_t *col, matrix_row_t *bit)
+{
+    while (*row < MATRIX_ROWS) {
+        matrix_row_t rest = topre_populated[*row] & (matrix_row_t)-*bit;
+        if (rest) {
+            while (!(rest & *bit)) {
+                *bit <<= 1;
+                (*col)++;
+            }
+            return true;
+        }
+        (*row)++;
+        *col = 0;
+        *bit = 1;
+    }
+    return false;
+}
+
+static inline bool topre_seek_next(uint8_t *row, uint8_t *col, matrix_row_t *bit)
+{
+    *bit <<= 1;
+    (*col)++;
+    if (!*bit) {
+        (*row)++;
+        *col = 0;
+        *bit = 1;
+    }
+    return topre_seek(row, col, bit);
+}
+
+/* Call after KEY_INIT and power on of matrix */
+static void topre_init(void)
+{
+    topre_keys = 0;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+#ifdef UNIMAP_ENABLE
+        topre_populated[row] = 0;
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            if (pgm_read_byte(&unimap_trans[row][col]) != UNIMAP_NO) {
+                topre_populated[row] |= ((matrix_row_t)1<<col);
+            }
+        }
+#else
+        topre_populated[row] = (matrix_row_t)(((matrix_row_t)1<<(MATRIX_COLS-1)<<1) - 1);
+#endif
+        topre_keys += bitpop16(topre_populated[row]);
+    }
+}
+
+/* Reads selected key: 1: on, 0: off, -1: invalid */
+static int8_t topre_read(bool prev)
+{
+    int8_t on;
+
+    // Not sure this is needed. This just emulates HHKB controller's behaviour.
+    if (prev) {
+        KEY_HYS_ON();
+    }
+    _delay_us(TOPRE_HYS);
+
+    // NOTE: KEY_STATE is valid only in 20us after KEY_ENABLE.
+    // If V-USB interrupts in this section we could lose 40us or so
+    // and would read invalid value from KEY_STATE.
+    uint8_t last = TIMER_RAW;
+
+    KEY_ENABLE();
+
+    // Wait for KEY_STATE outputs its value.
+    _delay_us(TOPRE_SETTLE);
+
+    on = (KEY_STATE() ? 0 : 1);
+
+    // Ignore if this code region execution time elapses more than 20us.
+    // MEMO: 20[us] * (TIMER_RAW_FREQ / 1000000)[count per us]
+    // MEMO: then change above using this rule: a/(b/c) = a*1/(b/c) = a*(c/b)
+    if (TIMER_DIFF_RAW(TIMER_RAW, last) > 20/(1000000/TIMER_RAW_FREQ)) {
+        on = -1;
+        topre_stat_guard++;
+    }
+
+    _delay_us(TOPRE_HOLD);
+    KEY_HYS_OFF();
+    KEY_UNABLE();
+    return on;
+}
+
+/*
+ * Waits until KEY_STATE returns to idle state.
+ * Returns time(us) KEY_STATE was seen busy.
+ */
+static uint8_t topre_recover(void)
+{
+    uint8_t t = 0, busy = 0;
+    while (true) {
+        if (!KEY_STATE()) busy = t + 1;
+        if (t >= TOPRE_RECOVERY && (busy <= t || t >= TOPRE_RECOVERY_MAX)) break;
+        _delay_us(1);
+        t++;
+    }
+    return busy;
+}
+
+/*
+ * Scans populated keys into 'matrix' from previous state 'prev'.
+ * Returns true if any key changed.
+ */
+static bool topre_scan(matrix_row_t *matrix, const matrix_row_t *prev)
+{
+    matrix_row_t retry[MATRIX_ROWS];
+    bool retry_any = false;
+    bool changed = false;
+    uint32_t start = topre_time_us();
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix[row] = prev[row];
+        retry[row] = 0;
+    }
+
+    uint8_t row = 0, col = 0;
+    matrix_row_t bit = 1;
+    bool more = topre_seek(&row, &col, &bit);
+    if (more) {
+        KEY_SELECT(row, col);
+        _delay_us(TOPRE_SELECT);
+    }
+    while (more) {
+        uint8_t r = row;
+        matrix_row_t b = bit;
+        int8_t on = topre_read(prev[r] & b);
+
+        // select next key during recovery
+        more = topre_seek_next(&row, &col, &bit);
+        if (more) {
+            KEY_SELECT(row, col);
+        }
+        uint8_t busy = topre_recover();
+
+        if (on < 0) {
+            retry[r] |= b;
+            retry_any = true;
+        } else if (on) {
+            matrix[r] |= b;
+            TOPRE_RECOVERED(busy);
+        } else {
+            matrix[r] &= ~b;
+        }
+    }
+
+    // read again only keys which hit the guard, or keep their previous state
+    for (uint8_t pass = 0; retry_any && pass < TOPRE_RETRY; pass++) {
+        retry_any = false;
+        for (row = 0; row < MATRIX_ROWS; row++) {
+            if (!retry[row]) continue;
+            bit = 1;
+            for (col = 0; col < MATRIX_COLS; col++, bit <<= 1) {
+                if (!(retry[row] & bit)) continue;
+
+                KEY_SELECT(row, col);
+                _delay_us(TOPRE_SELECT);
+                int8_t on = topre_read(prev[row] & bit);
+                uint8_t busy = topre_recover();
+
+                if (on < 0) {
+                    retry_any = true;
+                    continue;
+                }
+                retry[row] &= ~bit;
+                if (on) {
+                    matrix[row] |= bit;
+                    TOPRE_RECOVERED(busy);
+                } else {
+                    matrix[row] &= ~bit;
+                }
+            }
+        }
+    }
+
+    for (row = 0; row < MATRIX_ROWS; row++) {
+        topre_stat_fail += bitpop16(retry[row]);
+        if (matrix[row] ^ prev[row]) changed = true;
+    }
+    uint32_t t = topre_time_us() - start;
+    if (topre_stat_scans < UINT16_MAX) {
+        topre_stat_scans++;
+        topre_stat_us += t;
+    }
+    if (t > topre_stat_max) topre_stat_max = (t > UINT16_MAX ? UINT16_MAX : t);
+    return changed;
+}
+
+/* Prints scan statistics since last call */
+static void topre_print(void)
+{
+    xprintf("keys:%u settle:%uus recovery:%uus scan:%luus max:%uus guard:%u fail:%u\n",
+            topre_keys, TOPRE_SETTLE, (uint8_t)TOPRE_RECOVERY,
+            (topre_stat_scans ? topre_stat_us / topre_stat_scans : 0),
+            topre_stat_max, topre_stat_guard, topre_stat_fail);
+    topre_stat_us = 0;
+    topre_stat_max = 0;
+    topre_stat_scans = 0;
+    topre_stat_guard = 0;
+    topre_stat_fail = 0;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+
+#include "matrix.h"
+#include "chibios/matrix_gpt.h"
+
+
+#ifndef MATRIX_GPT_DRIVER
+#   error "MATRIX_GPT_DRIVER is required for MATRIX_SCAN_GPT."
+#endif
+#ifndef MATRIX_GPT_FREQUENCY
+#   define MATRIX_GPT_FREQUENCY 1000000
+#endif
+#ifndef MATRIX_SCAN_RATE
+#   define MATRIX_SCAN_RATE     1000
+#endif
+
+// timer ticks per row
+#define MATRIX_GPT_INTERVAL (MATRIX_GPT_FREQUENCY / MATRIX_SCAN_RATE / MATRIX_ROWS)
+#if (MATRIX_GPT_INTERVAL < 2)
+#   error "MATRIX_SCAN_RATE is too high for MATRIX_GPT_FREQUENCY."
+#endif
+
+/* snapshots: written by interrupt, 'ready' is the latest complete one */
+static matrix_row_t snapshot[2][MATRIX_ROWS];
+static uint32_t snapshot_time[2];
+static volatile uint8_t ready;
+static volatile uint8_t count;      // complete scans
+static uint8_t writing;
+static uint8_t row;
+static uint8_t count_read;
+
+static void matrix_gpt_tick(GPTDriver *gptp)
+{
+    (void)gptp;
+
+    snapshot[writing][row] = matrix_gpt_read_cols();
+    matrix_gpt_unselect_row(row);
+
+    if (++row >= MATRIX_ROWS) {
+        row = 0;
+        snapshot_time[writing] = TIME_I2MS(chVTGetSystemTimeX());
+        ready = writing;
+        writing ^= 1;
+        count++;
+    }
+    matrix_gpt_select_row(row);
+}
+
+static const GPTConfig matrix_gpt_config = {
+    .frequency = MATRIX_GPT_FREQUENCY,
+    .callback  = matrix_gpt_tick,
+};
+
+void matrix_gpt_start(void)
+{
+    row = 0;
+    writing = 0;
+    count_read = count;
+    matrix_gpt_select_row(row);
+
+    gptStart(&MATRIX_GPT_DRIVER, &matrix_gpt_config);
+    gptStartContinuous(&MATRIX_GPT_DRIVER, MATRIX_GPT_INTERVAL);
+}
+
+void matrix_gpt_stop(void)
+{
+    gptStopTimer(&MATRIX_GPT_DRIVER);
+    gptStop(&MATRIX_GPT_DRIVER);
+    matrix_gpt_unselect_row(row);
+}
+
+bool matrix_gpt_get(matrix_row_t *rows, uint32_t *time)
+{
+    bool updated;
+
+    // lock is short and keeps interrupt from completing another scan meanwhile
+    chSysLock();
+    updated = (count != count_read);
+    if (updated) {
+        count_read = count;
+        memcpy(rows, snapshot[ready], sizeof(snapshot[0]));
+        *time = snapshot_time[ready];
+    }
+    chSysUnlock();
+    return updated;
+}
@@ -0,0 +1,37 @@
+#ifndef MATRIX_GPT_H
+#define MATRIX_GPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+
+/*
+ * Background matrix scan by GPT(general purpose timer)
+ *
+ * Enable with MATRIX_SCAN_GPT = yes in Makefile and set in config.h:
+ *
+ *   MATRIX_GPT_DRIVER      GPT driver to use, enabled in mcuconf.h
+ *   MATRIX_GPT_FREQUENCY   timer clock(Hz), default 1MHz
+ *   MATRIX_SCAN_RATE       full matrix scans per second, default 1000
+ *
+ * Timer interrupt reads columns of the row strobed on the previous tick and
+ * strobes next row, so pins settle for a tick while main loop works instead
+ * of waiting. A complete scan is stored in one of two snapshots with its
+ * time, and main loop takes the latest one.
+ *
+ * Board provides these, called in interrupt context.
+ */
+void matrix_gpt_select_row(uint8_t row);
+void matrix_gpt_unselect_row(uint8_t row);
+matrix_row_t matrix_gpt_read_cols(void);
+
+void matrix_gpt_start(void);
+void matrix_gpt_stop(void);
+
+/*
+ * Copies the latest complete scan to rows and its time(ms) to time.
+ * Returns false if no scan is completed since last call.
+ */
+bool matrix_gpt_get(matrix_row_t *rows, uint32_t *time);
+
+#endif
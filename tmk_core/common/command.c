@@ -49,6 +49,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #   include "usbdrv.h"
 #endif
 
+#ifdef KEYBOARD_THREADS
+#   include "keyboard_threads.h"
+#endif
+
 
 static bool command_common(uint8_t code);
 static void command_common_help(void);
@@ -353,6 +357,10 @@ static bool command_common(uint8_t code)
 #   if USB_COUNT_SOF
             print_val_hex8(usbSofCount);
 #   endif
+#endif
+
+#ifdef KEYBOARD_THREADS
+            keyboard_threads_print();
 #endif
             break;
 #ifdef NKRO_ENABLE
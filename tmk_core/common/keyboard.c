@@ -93,16 +93,16 @@ void keyboard_init(void)
 }
 
 /*
- * Do keyboard routine jobs: scan matrix, light LEDs, ...
- * This is repeatedly called as fast as possible.
+ * Scans matrix and calls 'event' for each key changed since last call.
+ * When 'event' returns false the key is taken as unchanged and the scan stops;
+ * next call goes on from the key in order.
  */
-void keyboard_task(void)
+void keyboard_scan(bool (*event)(keyevent_t))
 {
     static matrix_row_t matrix_prev[MATRIX_ROWS];
 #ifdef MATRIX_HAS_GHOST
     static matrix_row_t matrix_ghost[MATRIX_ROWS];
 #endif
-    static uint8_t led_status = 0;
     matrix_row_t matrix_row = 0;
     matrix_row_t matrix_change = 0;
 
@@ -134,8 +134,8 @@ void keyboard_task(void)
                         .pressed = (matrix_row & col_mask),
                         .time = (timer_read() | 1) /* time should not be 0 */
                     };
-                    action_exec(e);
-                    hook_matrix_change(e);
+                    // stop here so that later keys don't get ahead of this
+                    if (!event(e)) return;
                     // record a processed key
                     matrix_prev[r] ^= col_mask;
 
@@ -146,13 +146,17 @@ void keyboard_task(void)
             }
         }
     }
-    // call with pseudo tick event when no real key event.
-    action_exec(TICK);
-
-//MATRIX_LOOP_END:
+}
 
-    hook_keyboard_loop();
+bool keyboard_event(keyevent_t event)
+{
+    action_exec(event);
+    hook_matrix_change(event);
+    return true;
+}
 
+void keyboard_mouse_task(void)
+{
 #ifdef MOUSEKEY_ENABLE
     // mousekey repeat & acceleration
     mousekey_task();
@@ -169,6 +173,11 @@ void keyboard_task(void)
 #ifdef ADB_MOUSE_ENABLE
         adb_mouse_task();
 #endif
+}
+
+void keyboard_leds_task(void)
+{
+    static uint8_t led_status = 0;
 
     // update LED
     if (led_status != host_keyboard_leds()) {
@@ -178,6 +187,26 @@ void keyboard_task(void)
     }
 }
 
+/*
+ * Do keyboard routine jobs: scan matrix, light LEDs, ...
+ * This is repeatedly called as fast as possible.
+ */
+void keyboard_task(void)
+{
+    keyboard_scan(keyboard_event);
+
+    // call with pseudo tick event when no real key event.
+    action_exec(TICK);
+
+//MATRIX_LOOP_END:
+
+    hook_keyboard_loop();
+
+    keyboard_mouse_task();
+
+    keyboard_leds_task();
+}
+
 void keyboard_set_leds(uint8_t leds)
 {
     led_set(leds);
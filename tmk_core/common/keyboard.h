@@ -64,6 +64,11 @@ void keyboard_setup(void);
 void keyboard_init(void);
 /* it runs repeatedly in main loop */
 void keyboard_task(void);
+/* keyboard_task() split up for protocols running them in separate threads */
+void keyboard_scan(bool (*event)(keyevent_t));
+bool keyboard_event(keyevent_t event);
+void keyboard_mouse_task(void);
+void keyboard_leds_task(void);
 /* it runs when host LED status is updated */
 void keyboard_set_leds(uint8_t leds);
 
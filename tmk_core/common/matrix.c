@@ -93,3 +93,6 @@ bool matrix_has_ghost_in_row(uint8_t row)
 
 __attribute__ ((weak)) void matrix_power_up(void) {}
 __attribute__ ((weak)) void matrix_power_down(void) {}
+
+__attribute__ ((weak)) bool matrix_wakeup_arm(void) { return false; }
+__attribute__ ((weak)) void matrix_wakeup_disarm(void) {}
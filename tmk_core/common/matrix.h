@@ -72,6 +72,11 @@ bool matrix_has_ghost_in_row(uint8_t row);
 void matrix_power_up(void);
 void matrix_power_down(void);
 
+/* wakeup from suspend by pin change(optional): select all rows and enable
+ * pin change interrupt of columns; false when a key is on or not supported */
+bool matrix_wakeup_arm(void);
+void matrix_wakeup_disarm(void);
+
 #ifdef __cplusplus
 }
 #endif
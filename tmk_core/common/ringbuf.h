@@ -4,70 +4,84 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// NOTE: buffer size must be 2^n and up to 255. size_mask should be 2^n - 1 due to using &(AND) instead of %(modulo)
-typedef struct {
-    uint8_t *buffer;
-    uint8_t head;
-    uint8_t tail;
-    uint8_t size_mask;
-} ringbuf_t;
+/*
+ * Single-producer single-consumer ring buffer
+ *
+ * RINGBUF_DEFINE(name, type, size) defines a static instance 'name' of
+ * element 'type' and its functions:
+ *
+ *   bool    name_put(type data)    producer: false when full
+ *   bool    name_get(type *data)   consumer: false when empty
+ *   bool    name_is_empty(void)
+ *   bool    name_is_full(void)
+ *   uint8_t name_count(void)
+ *   void    name_reset(void)       consumer: discard all data
+ *
+ * Size must be 2^n and up to 256; one cell is never used to tell full from empty.
+ *
+ * No lock is needed as long as one context(ISR) only puts and the other only
+ * gets: head is written by producer only and tail by consumer only, both are
+ * 8-bit so that they are read and written atomically on AVR and Cortex-M.
+ * Data is stored before head moves and read before tail moves.
+ *
+ * Define RINGBUF_OVERFLOW_COUNT to count data lost on full in 'name.overflow'.
+ */
+#define RINGBUF_BARRIER()   __asm__ __volatile__ ("" ::: "memory")
 
-static inline void ringbuf_init(ringbuf_t *buf, uint8_t *array, uint8_t size);
-static inline int16_t ringbuf_get(ringbuf_t *buf);
-static inline bool ringbuf_put(ringbuf_t *buf, uint8_t data);
-static inline void ringbuf_write(ringbuf_t *buf, uint8_t data);
-static inline bool ringbuf_is_empty(ringbuf_t *buf);
-static inline bool ringbuf_is_full(ringbuf_t *buf);
-static inline void ringbuf_reset(ringbuf_t *buf);
+#ifdef RINGBUF_OVERFLOW_COUNT
+#   define RINGBUF_OVERFLOW_FIELD   volatile uint8_t overflow;
+#   define RINGBUF_OVERFLOW(name)   do { if (name.overflow != 0xFF) name.overflow++; } while (0)
+#else
+#   define RINGBUF_OVERFLOW_FIELD
+#   define RINGBUF_OVERFLOW(name)
+#endif
 
-static inline void ringbuf_init(ringbuf_t *buf, uint8_t *array, uint8_t size)
-{
-    buf->buffer = array;
-    buf->head = 0;
-    buf->tail = 0;
-    buf->size_mask = size - 1;
-}
-static inline int16_t ringbuf_get(ringbuf_t *buf)
-{
-    if (ringbuf_is_empty(buf)) return -1;
-    uint8_t data = buf->buffer[buf->tail];
-    buf->tail++;
-    buf->tail &= buf->size_mask;
-    return  data;
-}
-static inline bool ringbuf_put(ringbuf_t *buf, uint8_t data)
-{
-    if (ringbuf_is_full(buf)) {
-        return false;
-    }
-    buf->buffer[buf->head] = data;
-    buf->head++;
-    buf->head &= buf->size_mask;
-    return true;
-}
-// this overrides data in buffer when it is full
-static inline void ringbuf_write(ringbuf_t *buf, uint8_t data)
-{
-    buf->buffer[buf->head] = data;
-    buf->head++;
-    buf->head &= buf->size_mask;
-    // eat tail: override data yet to be consumed
-    if (buf->head == buf->tail) {
-        buf->tail++;
-        buf->tail &= buf->size_mask;
-    }
-}
-static inline bool ringbuf_is_empty(ringbuf_t *buf)
-{
-    return (buf->head == buf->tail);
-}
-static inline bool ringbuf_is_full(ringbuf_t *buf)
-{
-    return (((buf->head + 1) & buf->size_mask) == buf->tail);
-}
-static inline void ringbuf_reset(ringbuf_t *buf)
-{
-    buf->head = 0;
-    buf->tail = 0;
+#define RINGBUF_DEFINE(name, type, size) \
+_Static_assert((size) && (size) <= 256 && !((size) & ((size) - 1)), #name ": size must be 2^n and up to 256"); \
+static struct { \
+    type buffer[size]; \
+    volatile uint8_t head; \
+    volatile uint8_t tail; \
+    RINGBUF_OVERFLOW_FIELD \
+} name; \
+static inline __attribute__((unused)) bool name##_put(type data) \
+{ \
+    uint8_t head = name.head; \
+    uint8_t next = (head + 1) & ((size) - 1); \
+    if (next == name.tail) { \
+        RINGBUF_OVERFLOW(name); \
+        return false; \
+    } \
+    name.buffer[head] = data; \
+    RINGBUF_BARRIER(); \
+    name.head = next; \
+    return true; \
+} \
+static inline __attribute__((unused)) bool name##_get(type *data) \
+{ \
+    uint8_t tail = name.tail; \
+    if (tail == name.head) return false; \
+    RINGBUF_BARRIER(); \
+    *data = name.buffer[tail]; \
+    RINGBUF_BARRIER(); \
+    name.tail = (tail + 1) & ((size) - 1); \
+    return true; \
+} \
+static inline __attribute__((unused)) bool name##_is_empty(void) \
+{ \
+    return (name.head == name.tail); \
+} \
+static inline __attribute__((unused)) bool name##_is_full(void) \
+{ \
+    return (((name.head + 1) & ((size) - 1)) == name.tail); \
+} \
+static inline __attribute__((unused)) uint8_t name##_count(void) \
+{ \
+    return (name.head - name.tail) & ((size) - 1); \
+} \
+static inline __attribute__((unused)) void name##_reset(void) \
+{ \
+    name.tail = name.head; \
 }
+
 #endif
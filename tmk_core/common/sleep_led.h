@@ -1,6 +1,10 @@
 #ifndef SLEEP_LED_H
 #define SLEEP_LED_H
 
+/* LED on timer PWM output: see avr/sleep_led.c */
+#if defined(SLEEP_LED_PWM_OC1A) || defined(SLEEP_LED_PWM_OC1B) || defined(SLEEP_LED_PWM_OC1C)
+#   define SLEEP_LED_PWM
+#endif
 
 void sleep_led_init(void);
 void sleep_led_enable(void);
@@ -0,0 +1,124 @@
+/*
+ * Ring buffer stress test
+ *
+ * A producer thread stands in for ISR and puts sequence numbers as fast as it can while
+ * main thread gets them, on two instances at once. Every number must come out in order;
+ * numbers put on full buffer are lost and counted by both the producer and
+ * RINGBUF_OVERFLOW_COUNT.
+ *
+ * ringbuf.h has only compiler barriers, which is enough on single core MCU and on x86
+ * host(stores are not reordered). Build and run on host:
+ *     $ make
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define RINGBUF_OVERFLOW_COUNT
+#include "ringbuf.h"
+
+#define ITEMS   5000000UL
+
+RINGBUF_DEFINE(rb_small, uint16_t, 8)
+RINGBUF_DEFINE(rb_large, uint32_t, 256)
+
+typedef struct {
+    const char *name;
+    bool (*put)(uint32_t n);
+    bool (*get)(uint32_t *n);
+    volatile uint8_t *overflow;
+    uint32_t mask;              // element can hold sequence numbers of this mask
+    uint32_t size;
+    volatile uint32_t lost;     // put failed on full
+    volatile bool done;
+} stress_t;
+
+static bool small_put(uint32_t n) { return rb_small_put(n); }
+static bool small_get(uint32_t *n) { uint16_t d; if (!rb_small_get(&d)) return false; *n = d; return true; }
+static bool large_put(uint32_t n) { return rb_large_put(n); }
+static bool large_get(uint32_t *n) { return rb_large_get(n); }
+
+static stress_t tests[] = {
+    { "uint16_t x 8",   small_put, small_get, &rb_small.overflow, 0xFFFF, 8 },
+    { "uint32_t x 256", large_put, large_get, &rb_large.overflow, 0xFFFFFFFF, 256 },
+};
+
+static void *producer(void *arg)
+{
+    stress_t *t = arg;
+    uint32_t rand_state = (uintptr_t)t;
+    uint32_t burst = 0;
+    for (uint32_t n = 0; n < ITEMS; n++) {
+        if (!t->put(n & t->mask)) t->lost++;
+        // data comes in bursts of random length, sometimes more than buffer can hold
+        if (!burst--) {
+            rand_state = rand_state * 1103515245 + 12345;
+            burst = (rand_state >> 16) % (t->size * 2);
+            sched_yield();
+        }
+    }
+    t->done = true;
+    return NULL;
+}
+
+/* consumer: returns number of errors */
+static uint32_t consume(stress_t *t)
+{
+    uint32_t errors = 0, received = 0, skipped = 0;
+    uint32_t expected = 0;
+    for (;;) {
+        bool done = t->done;
+        uint32_t n;
+        if (!t->get(&n)) {
+            if (done) break;
+            sched_yield();
+            continue;
+        }
+        // distance from expected number is count of data lost on full
+        uint32_t gap = (n - expected) & t->mask;
+        if (gap > t->lost - skipped) {
+            if (errors++ < 10) printf("%s: %lu after %lu\n", t->name, (unsigned long)n, (unsigned long)expected);
+        }
+        skipped += gap;
+        expected = (n + 1) & t->mask;
+        received++;
+    }
+    // data lost after the last one received is not skipped
+    if (received + t->lost != ITEMS || skipped > t->lost) {
+        printf("%s: received:%lu lost:%lu skipped:%lu\n", t->name,
+               (unsigned long)received, (unsigned long)t->lost, (unsigned long)skipped);
+        errors++;
+    }
+    if (*t->overflow != (t->lost > 0xFF ? 0xFF : t->lost)) {
+        printf("%s: overflow count:%u lost:%lu\n", t->name, *t->overflow, (unsigned long)t->lost);
+        errors++;
+    }
+    printf("%-14s %lu items %lu lost %lu errors\n", t->name,
+           (unsigned long)ITEMS, (unsigned long)t->lost, (unsigned long)errors);
+    return errors;
+}
+
+static void *consumer(void *arg)
+{
+    return (void *)(uintptr_t)consume(arg);
+}
+
+int main(void)
+{
+    pthread_t prod[2], cons;
+    void *ret;
+    uint32_t errors;
+
+    for (int i = 0; i < 2; i++) pthread_create(&prod[i], NULL, producer, &tests[i]);
+    // second instance is consumed in another thread
+    pthread_create(&cons, NULL, consumer, &tests[1]);
+    errors = consume(&tests[0]);
+    pthread_join(cons, &ret);
+    errors += (uint32_t)(uintptr_t)ret;
+    for (int i = 0; i < 2; i++) pthread_join(prod[i], NULL);
+
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? 1 : 0;
+}
@@ -61,6 +61,19 @@ static inline void place_bit1(void);
 static inline void send_byte(uint8_t data);
 static inline uint16_t wait_data_lo(uint16_t us);
 static inline uint16_t wait_data_hi(uint16_t us);
+static inline void talk_command(uint8_t addr, uint8_t reg);
+static inline void talk_wait(void);
+
+static bool srq = false;
+
+#ifdef ADB_USE_ICP
+static volatile bool icp_busy;
+static inline void icp_start(void);
+static uint8_t icp_decode(uint8_t *buf, uint8_t len);
+#else
+static uint8_t talk_data[8];
+static uint8_t talk_len;
+#endif
 
 
 void adb_host_init(void)
@@ -92,6 +105,12 @@ uint16_t adb_host_kbd_recv(uint8_t addr)
     return adb_host_talk(addr, ADB_REG_0);
 }
 
+/* Service Request was issued during last Talk, some other device has data to send. */
+bool adb_host_srq(void)
+{
+    return srq;
+}
+
 #ifdef ADB_MOUSE_ENABLE
 __attribute__ ((weak))
 void adb_mouse_init(void) {
@@ -104,16 +123,58 @@ void adb_mouse_task(void) {
 }
 #endif
 
+/*
+ * Talk without waiting for data
+ *
+ * adb_host_talk_start() sends Talk command and returns soon, adb_host_talk_result() returns
+ * length of the data later, or -1 while device is still sending. With ADB_USE_ICP data is
+ * captured in background, otherwise it is received in adb_host_talk_start() and kept.
+ * Collect the result before starting next Talk.
+ */
+void adb_host_talk_start(uint8_t addr, uint8_t reg)
+{
+#ifdef ADB_USE_ICP
+    talk_wait();
+    cli();
+    talk_command(addr, reg);
+    // edges are captured in background and USB interrupts are served meanwhile
+    icp_start();
+    sei();
+#else
+    talk_len = adb_host_talk_buf(addr, reg, talk_data, sizeof(talk_data));
+#endif
+}
+
+int8_t adb_host_talk_result(uint8_t *buf, uint8_t len)
+{
+#ifdef ADB_USE_ICP
+    if (icp_busy) return -1;
+#endif
+    for (int8_t i =0; i < len; i++) buf[i] = 0;
+#ifdef ADB_USE_ICP
+    return icp_decode(buf, len);
+#else
+    for (uint8_t i = 0; i < len && i < talk_len; i++) buf[i] = talk_data[i];
+    return talk_len;
+#endif
+}
+
 // This sends Talk command to read data from register and returns length of the data.
+#ifdef ADB_USE_ICP
+uint8_t adb_host_talk_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+{
+    int8_t n;
+    adb_host_talk_start(addr, reg);
+    while ((n = adb_host_talk_result(buf, len)) < 0) ;
+    return n;
+}
+#else
 uint8_t adb_host_talk_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
 {
     for (int8_t i =0; i < len; i++) buf[i] = 0;
 
     cli();
-    attention();
-    send_byte((addr<<4) | ADB_CMD_TALK | reg);
-    place_bit0();               // Stopbit(0)
-    // TODO: Service Request(Srq):
+    talk_command(addr, reg);
     // Device holds low part of comannd stopbit for 140-260us
     //
     // Command:
@@ -211,6 +272,7 @@ error:
     sei();
     return n/8;
 }
+#endif
 
 uint16_t adb_host_talk(uint8_t addr, uint8_t reg)
 {
@@ -223,6 +285,7 @@ uint16_t adb_host_talk(uint8_t addr, uint8_t reg)
 
 void adb_host_listen_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
 {
+    talk_wait();
     cli();
     attention();
     send_byte((addr<<4) | ADB_CMD_LISTEN | reg);
@@ -246,6 +309,7 @@ void adb_host_listen(uint8_t addr, uint8_t reg, uint8_t data_h, uint8_t data_l)
 
 void adb_host_flush(uint8_t addr)
 {
+    talk_wait();
     cli();
     attention();
     send_byte((addr<<4) | ADB_CMD_FLUSH);
@@ -316,6 +380,24 @@ static inline void send_byte(uint8_t data)
     }
 }
 
+// call with interrupt disabled
+static inline void talk_command(uint8_t addr, uint8_t reg)
+{
+    attention();
+    send_byte((addr<<4) | ADB_CMD_TALK | reg);
+    place_bit0();               // Stopbit(0)
+    // Service Request(Srq): device still holds line low after stop bit
+    srq = !data_in();
+}
+
+// bus is not free until device finishes data of Talk started in background
+static inline void talk_wait(void)
+{
+#ifdef ADB_USE_ICP
+    while (icp_busy) ;
+#endif
+}
+
 // These are carefully coded to take 6 cycles of overhead.
 // inline asm approach became too convoluted
 static inline uint16_t wait_data_lo(uint16_t us)
@@ -341,6 +423,99 @@ static inline uint16_t wait_data_hi(uint16_t us)
 }
 
 
+#ifdef ADB_USE_ICP
+/*
+ * Receive with Timer1 input capture
+ *
+ * Timer latches time of each edge on data line(ICP1) in hardware and ISR just
+ * stores length of the phase between edges. Data is decoded after transaction
+ * ends, when line doesn't change for a while.
+ *
+ * Phases captured after command stop bit:
+ *   [end of Srq(low)] Tlt(high), start bit(low, high), data bits(low, high)...,
+ *   stop bit(low)
+ */
+#ifdef SLEEP_LED_ENABLE
+#   error "ADB_USE_ICP: Timer1 is also used by SLEEP_LED_ENABLE"
+#endif
+
+#define ICP_PRESCALER   64
+#define ICP_TICKS(us)   ((uint16_t)((F_CPU / ICP_PRESCALER / 1000000.0) * (us)))
+// Srq, Tlt, start bit, 8 bytes and stop bit
+#define ICP_PHASES_MAX  (1 + 1 + 2 + 8*8*2 + 1)
+
+static volatile uint8_t icp_phase[ICP_PHASES_MAX];  // in timer ticks
+static volatile uint8_t icp_count;
+static uint8_t  icp_first;                  // 1 when capture starts in Srq
+static uint16_t icp_last;
+
+static inline void icp_stop(void)
+{
+    TIMSK1 &= ~((1<<ICIE1) | (1<<OCIE1B));
+    icp_busy = false;
+}
+
+// call with interrupt disabled
+static inline void icp_start(void)
+{
+    icp_count = 0;
+    icp_busy = true;
+    TCCR1A = 0;
+    TCCR1B = (1<<ICNC1) | (1<<CS11) | (1<<CS10);    // prescaler 64
+    // wait for rising edge if Srq still holds line low
+    icp_first = (data_in() ? 0 : 1);
+    if (icp_first) TCCR1B |= (1<<ICES1);
+    icp_last = TCNT1;
+    OCR1B = icp_last + ICP_TICKS(500);              // Srq or Tlt
+    TIFR1 = (1<<ICF1) | (1<<OCF1B);
+    TIMSK1 |= (1<<ICIE1) | (1<<OCIE1B);
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+    uint16_t t = ICR1;
+    TCCR1B ^= (1<<ICES1);   // opposite edge next
+    TIFR1 = (1<<ICF1);
+
+    uint16_t d = t - icp_last;
+    icp_last = t;
+    if (icp_count >= ICP_PHASES_MAX) {
+        icp_stop();
+        return;
+    }
+    icp_phase[icp_count++] = (d > 255 ? 255 : d);
+
+    // line stays high after stop bit, or no start bit
+    OCR1B = t + (icp_count <= icp_first ? ICP_TICKS(500) : ICP_TICKS(150));
+    TIFR1 = (1<<OCF1B);
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+    icp_stop();
+}
+
+static uint8_t icp_decode(uint8_t *buf, uint8_t len)
+{
+    if (icp_count < icp_first + 3) return 0;    // No data from device(not error)
+
+    const volatile uint8_t *p = icp_phase + icp_first + 3;  // skip Tlt and start bit
+    uint8_t phases = icp_count - icp_first - 3;
+    uint8_t n = 0; // bit count
+    for (uint8_t i = 0; i + 1 < phases; i += 2, n++) {
+        if (n/8 >= len) continue; // can't store in buf
+
+        // bit1 is shorter low than high
+        buf[n/8] <<= 1;
+        if (p[i] < p[i + 1]) {
+            buf[n/8] |= 1;
+        }
+    }
+    return n/8;
+}
+#endif
+
+
 /*
 ADB Protocol
 ============
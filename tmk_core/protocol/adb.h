@@ -99,8 +99,11 @@ POSSIBILITY OF SUCH DAMAGE.
 void     adb_host_init(void);
 bool     adb_host_psw(void);
 uint16_t adb_host_kbd_recv(uint8_t addr);
+bool     adb_host_srq(void);
 uint16_t adb_host_talk(uint8_t addr, uint8_t reg);
 uint8_t  adb_host_talk_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
+void     adb_host_talk_start(uint8_t addr, uint8_t reg);
+int8_t  adb_host_talk_result(uint8_t *buf, uint8_t len);
 void     adb_host_listen(uint8_t addr, uint8_t reg, uint8_t data_h, uint8_t data_l);
 void     adb_host_listen_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
 void     adb_host_flush(uint8_t addr);
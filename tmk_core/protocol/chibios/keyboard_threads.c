@@ -0,0 +1,182 @@
+/*
+ * Scan and report threads for TMK keyboard on ChibiOS
+ * See keyboard_threads.h
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "usb_main.h"
+
+/* TMK includes */
+#include "keyboard.h"
+#include "action.h"
+#include "action_util.h"
+#include "mousekey.h"
+#include "timer.h"
+#include "print.h"
+#include "debug.h"
+#include "hook.h"
+#define RINGBUF_OVERFLOW_COUNT
+#include "ringbuf.h"
+#include "keyboard_threads.h"
+
+
+#ifndef KEYBOARD_SCAN_INTERVAL
+#define KEYBOARD_SCAN_INTERVAL  1
+#endif
+#ifndef KEYBOARD_SCAN_PRIO
+#define KEYBOARD_SCAN_PRIO      (NORMALPRIO + 2)
+#endif
+#ifndef KEYBOARD_REPORT_PRIO
+#define KEYBOARD_REPORT_PRIO    (NORMALPRIO + 1)
+#endif
+#ifndef KEYBOARD_MOUSE_PRIO
+#define KEYBOARD_MOUSE_PRIO     (NORMALPRIO - 1)
+#endif
+
+/* events to report thread */
+#define EVT_KEY     EVENT_MASK(0)
+#define EVT_WAKEUP  EVENT_MASK(1)
+
+/* key events from scan thread to report thread */
+RINGBUF_DEFINE(events, keyevent_t, 32);
+
+/* action state shared by report and mouse threads */
+static MUTEX_DECL(action_mtx);
+
+static thread_t *scan_tp;
+static thread_t *report_tp;
+static thread_t *mouse_tp;
+
+/* statistics */
+static volatile uint32_t scan_count;
+static volatile uint32_t report_count;
+static volatile uint32_t mouse_count;
+static volatile uint8_t events_max;
+static uint32_t stats_time;
+
+
+/* Scan thread: producer of key events; key comes again on next scan when full */
+static bool put_event(keyevent_t e) {
+  return events_put(e);
+}
+
+static THD_WORKING_AREA(waScanThread, 512);
+static THD_FUNCTION(scanThread, arg) {
+  (void)arg;
+  chRegSetThreadName("scan");
+
+  systime_t time = chVTGetSystemTimeX();
+  while(true) {
+    if(USB_DRIVER.state == USB_SUSPENDED) {
+      print("[s]");
+      while(USB_DRIVER.state == USB_SUSPENDED) {
+        hook_usb_suspend_loop();
+      }
+      /* Woken up: report thread resends reports */
+      chEvtSignal(report_tp, EVT_WAKEUP);
+      time = chVTGetSystemTimeX();
+    }
+
+    keyboard_scan(put_event);
+    scan_count++;
+
+    uint8_t n = events_count();
+    if(n) {
+      if(n > events_max) events_max = n;
+      chEvtSignal(report_tp, EVT_KEY);
+    }
+
+    time = chThdSleepUntilWindowed(time, chTimeAddX(time, TIME_MS2I(KEYBOARD_SCAN_INTERVAL)));
+  }
+}
+
+/* Report thread: consumer of key events */
+static THD_WORKING_AREA(waReportThread, 1024);
+static THD_FUNCTION(reportThread, arg) {
+  (void)arg;
+  chRegSetThreadName("report");
+
+  while(true) {
+    /* wakes up on key event or for tick at least every scan interval */
+    eventmask_t evt = chEvtWaitAnyTimeout(ALL_EVENTS, TIME_MS2I(KEYBOARD_SCAN_INTERVAL));
+
+    chMtxLock(&action_mtx);
+    if(evt & EVT_WAKEUP) {
+      // variables have been already cleared
+      send_keyboard_report();
+#ifdef MOUSEKEY_ENABLE
+      mousekey_send();
+#endif /* MOUSEKEY_ENABLE */
+    }
+
+    keyevent_t e;
+    while(events_get(&e)) {
+      keyboard_event(e);
+    }
+    // call with pseudo tick event when no real key event.
+    action_exec(TICK);
+
+    hook_keyboard_loop();
+    keyboard_leds_task();
+    chMtxUnlock(&action_mtx);
+
+    report_count++;
+  }
+}
+
+void keyboard_threads_main(void) {
+  stats_time = timer_read32();
+  report_tp = chThdCreateStatic(waReportThread, sizeof(waReportThread), KEYBOARD_REPORT_PRIO, reportThread, NULL);
+  scan_tp = chThdCreateStatic(waScanThread, sizeof(waScanThread), KEYBOARD_SCAN_PRIO, scanThread, NULL);
+
+  /* Mouse loop */
+  mouse_tp = chThdGetSelfX();
+  chThdSetPriority(KEYBOARD_MOUSE_PRIO);
+  while(true) {
+    chMtxLock(&action_mtx);
+    keyboard_mouse_task();
+    chMtxUnlock(&action_mtx);
+    mouse_count++;
+    chThdSleepMilliseconds(1);
+  }
+}
+
+#if CH_DBG_STATISTICS == TRUE
+/* CPU time of the thread in 0.1% of all threads since startup */
+static uint16_t thread_load(thread_t *tp) {
+  uint64_t total = 0;
+  thread_t *t = chRegFirstThread();
+  do {
+    total += t->stats.cumulative;
+    t = chRegNextThread(t);
+  } while(t != NULL);
+  return total ? (uint16_t)(tp->stats.cumulative * 1000 / total) : 0;
+}
+#endif
+
+void keyboard_threads_print(void) {
+  uint32_t t = timer_read32();
+  uint32_t elapsed = t - stats_time;
+  stats_time = t;
+  if(!elapsed) elapsed = 1;
+
+  xprintf("scan: %lu/s report: %lu/s mouse: %lu/s\n",
+          (uint32_t)((uint64_t)scan_count * 1000 / elapsed),
+          (uint32_t)((uint64_t)report_count * 1000 / elapsed),
+          (uint32_t)((uint64_t)mouse_count * 1000 / elapsed));
+  scan_count = report_count = mouse_count = 0;
+
+  xprintf("events: %u max: %u full: %u\n", events_count(), events_max, events.overflow);
+  events_max = 0;
+  events.overflow = 0;
+
+#if CH_DBG_STATISTICS == TRUE
+  uint16_t scan = thread_load(scan_tp);
+  uint16_t report = thread_load(report_tp);
+  uint16_t mouse = thread_load(mouse_tp);
+  xprintf("cpu scan: %u.%u%% report: %u.%u%% mouse: %u.%u%%\n",
+          scan / 10, scan % 10, report / 10, report % 10, mouse / 10, mouse % 10);
+#endif
+}
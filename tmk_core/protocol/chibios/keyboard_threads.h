@@ -0,0 +1,32 @@
+/*
+ * Scan and report threads for TMK keyboard on ChibiOS
+ *
+ * Enabled with KEYBOARD_THREADS = yes in Makefile.
+ *
+ * keyboard_task() is split up into threads so that a report waiting for
+ * USB transmit doesn't stall matrix scan and vice versa:
+ *   - scan thread: scans matrix every KEYBOARD_SCAN_INTERVAL ms and queues
+ *     key events; highest priority of the three.
+ *   - report thread: takes key events from the queue and runs actions,
+ *     hooks and LED update; sends reports to host.
+ *   - main thread: goes on at lower priority for mouse tasks.
+ * The event queue is a single-producer single-consumer ring buffer and needs
+ * no lock; when it is full the key and keys after it are left to next scan
+ * in order. Report and mouse threads share a mutex over action state.
+ *
+ * Options in config.h:
+ *   KEYBOARD_SCAN_INTERVAL     scan period(ms), default 1
+ *   KEYBOARD_SCAN_PRIO         default NORMALPRIO+2
+ *   KEYBOARD_REPORT_PRIO       default NORMALPRIO+1
+ *   KEYBOARD_MOUSE_PRIO        default NORMALPRIO-1
+ */
+#ifndef _KEYBOARD_THREADS_H_
+#define _KEYBOARD_THREADS_H_
+
+/* starts scan and report threads and runs mouse loop, never returns */
+void keyboard_threads_main(void);
+
+/* prints loop counts, queue depth and CPU usage of threads to console */
+void keyboard_threads_print(void);
+
+#endif /* _KEYBOARD_THREADS_H_ */
@@ -36,6 +36,9 @@
 #endif
 #include "suspend.h"
 #include "hook.h"
+#ifdef KEYBOARD_THREADS
+#include "keyboard_threads.h"
+#endif
 
 
 /* -------------------------
@@ -141,6 +144,11 @@ int main(void) {
 
   hook_late_init();
 
+#ifdef KEYBOARD_THREADS
+  /* Scan and report in their own threads, this thread goes on for mouse */
+  keyboard_threads_main();
+#endif
+
   /* Main loop */
   while(true) {
 
@@ -0,0 +1,93 @@
+/* Host stub of ChibiOS kernel: see ch.h */
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include "ch.h"
+#include "hal.h"
+
+USBDriver USBD1 = { USB_ACTIVE };
+
+static __thread thread_t *self;
+static thread_t main_thread = { .mtx = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void *thread_start(void *arg)
+{
+    thread_t *tp = arg;
+    self = tp;
+    tp->func(tp->arg);
+    return NULL;
+}
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, void (*pf)(void *), void *arg)
+{
+    (void)wsp; (void)size; (void)prio;
+    thread_t *tp = calloc(1, sizeof(thread_t));
+    pthread_mutex_init(&tp->mtx, NULL);
+    pthread_cond_init(&tp->cond, NULL);
+    tp->func = pf;
+    tp->arg = arg;
+    pthread_create(&tp->pthread, NULL, thread_start, tp);
+    return tp;
+}
+
+thread_t *chThdGetSelfX(void)
+{
+    return self ? self : &main_thread;
+}
+
+tprio_t chThdSetPriority(tprio_t newprio)
+{
+    return newprio;
+}
+
+void chRegSetThreadName(const char *name)
+{
+    (void)name;
+}
+
+systime_t chVTGetSystemTimeX(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void chThdSleepMilliseconds(uint32_t ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) && errno == EINTR) ;
+}
+
+systime_t chThdSleepUntilWindowed(systime_t prev, systime_t next)
+{
+    systime_t now = chVTGetSystemTimeX();
+    if (now - prev < next - prev) chThdSleepMilliseconds(next - now);
+    return next;
+}
+
+void chEvtSignal(thread_t *tp, eventmask_t events)
+{
+    pthread_mutex_lock(&tp->mtx);
+    tp->events |= events;
+    pthread_cond_signal(&tp->cond);
+    pthread_mutex_unlock(&tp->mtx);
+}
+
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, sysinterval_t timeout)
+{
+    thread_t *tp = chThdGetSelfX();
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long)timeout * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&tp->mtx);
+    while (!(tp->events & events)) {
+        if (pthread_cond_timedwait(&tp->cond, &tp->mtx, &ts) == ETIMEDOUT) break;
+    }
+    eventmask_t got = tp->events & events;
+    tp->events &= ~got;
+    pthread_mutex_unlock(&tp->mtx);
+    return got;
+}
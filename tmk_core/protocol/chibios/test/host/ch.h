@@ -0,0 +1,55 @@
+/*
+ * Host stub of ChibiOS kernel API used by keyboard_threads.c, on pthreads
+ *
+ * System time is in milliseconds. Priorities are not applied; host scheduler
+ * decides which thread runs.
+ */
+#ifndef HOST_CH_H
+#define HOST_CH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define TRUE                1
+#define FALSE               0
+#define NORMALPRIO          128
+#define CH_DBG_STATISTICS   FALSE
+
+typedef uint32_t systime_t;
+typedef uint32_t sysinterval_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t tprio_t;
+typedef pthread_mutex_t mutex_t;
+
+#define ALL_EVENTS          ((eventmask_t)-1)
+#define EVENT_MASK(eid)     ((eventmask_t)1 << (eid))
+#define TIME_MS2I(ms)       ((sysinterval_t)(ms))
+
+typedef struct thread {
+    pthread_t pthread;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    eventmask_t events;
+    void (*func)(void *);
+    void *arg;
+} thread_t;
+
+#define THD_WORKING_AREA(s, n)  char s[n]
+#define THD_FUNCTION(tname, arg) void tname(void *arg)
+#define MUTEX_DECL(name)        mutex_t name = PTHREAD_MUTEX_INITIALIZER
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, void (*pf)(void *), void *arg);
+thread_t *chThdGetSelfX(void);
+tprio_t chThdSetPriority(tprio_t newprio);
+void chRegSetThreadName(const char *name);
+systime_t chVTGetSystemTimeX(void);
+#define chTimeAddX(systime, interval)   ((systime_t)((systime) + (interval)))
+systime_t chThdSleepUntilWindowed(systime_t prev, systime_t next);
+void chThdSleepMilliseconds(uint32_t ms);
+void chEvtSignal(thread_t *tp, eventmask_t events);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, sysinterval_t timeout);
+#define chMtxLock(mp)       pthread_mutex_lock(mp)
+#define chMtxUnlock(mp)     pthread_mutex_unlock(mp)
+
+#endif
@@ -0,0 +1,14 @@
+/* Host stub of ChibiOS HAL: only USB driver state */
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+
+typedef enum { USB_STOP, USB_READY, USB_SELECTED, USB_ACTIVE, USB_SUSPENDED } usbstate_t;
+typedef uint8_t usbep_t;
+typedef struct {
+    volatile usbstate_t state;
+} USBDriver;
+extern USBDriver USBD1;
+
+#endif
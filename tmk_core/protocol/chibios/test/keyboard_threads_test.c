@@ -0,0 +1,189 @@
+/*
+ * Scan and report thread handoff test
+ *
+ * Runs keyboard_threads_main() of keyboard_threads.c with real keyboard_scan() of
+ * keyboard.c on pthreads(host/ch.h) while a typist thread toggles keys of the matrix
+ * at random. Actions stall now and then as a report waiting for USB transmit does,
+ * so that the event queue fills up and keys are left to next scan. Every key must
+ * come in order, alternating press and release, and key state made of events must
+ * be the matrix after the typist stops. USB suspend and wakeup is also made once in
+ * the middle; report must be sent again after wakeup.
+ *
+ * Build and run on host:
+ *     $ make
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* host replacements of print */
+#define PRINT_H__
+#define xprintf(...)        do { } while (0)
+#define print(s)            do { } while (0)
+#define println(s)          do { } while (0)
+
+#include "../keyboard_threads.c"
+#include "keyboard.c"
+
+debug_config_t debug_config;
+
+
+/* matrix: written by typist, read by scan thread */
+static pthread_mutex_t matrix_mtx = PTHREAD_MUTEX_INITIALIZER;
+static matrix_row_t typed[MATRIX_ROWS];
+static matrix_row_t scanned[MATRIX_ROWS];
+
+void matrix_setup(void) {}
+void matrix_init(void) {}
+void matrix_print(void) {}
+uint8_t matrix_scan(void)
+{
+    pthread_mutex_lock(&matrix_mtx);
+    memcpy(scanned, typed, sizeof(scanned));
+    pthread_mutex_unlock(&matrix_mtx);
+    return 1;
+}
+matrix_row_t matrix_get_row(uint8_t row) { return scanned[row]; }
+
+void timer_init(void) {}
+uint32_t timer_read32(void) { return chVTGetSystemTimeX(); }
+/* starts near wraparound so that event time wraps in the run */
+static uint16_t timer_base;
+uint16_t timer_read(void) { return chVTGetSystemTimeX() + timer_base; }
+uint8_t host_keyboard_leds(void) { return 0; }
+
+static uint32_t rand_state = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8) % n;
+}
+
+/* report thread side: key state made of events */
+static matrix_row_t state[MATRIX_ROWS];
+static uint16_t last_time;
+static uint32_t received, ticks, stalls, resent, errors;
+static volatile int inside;         // action state is used by one thread at a time
+static uint32_t stall_rand = 7;
+
+static void enter(void)
+{
+    if (__atomic_add_fetch(&inside, 1, __ATOMIC_SEQ_CST) != 1) {
+        if (errors++ < 10) printf("action state is used by two threads\n");
+    }
+}
+static void leave(void)
+{
+    __atomic_sub_fetch(&inside, 1, __ATOMIC_SEQ_CST);
+}
+
+void action_exec(keyevent_t e)
+{
+    enter();
+    if (IS_NOEVENT(e)) {
+        ticks++;
+        leave();
+        return;
+    }
+    received++;
+    matrix_row_t mask = (matrix_row_t)1 << e.key.col;
+    if (!!(state[e.key.row] & mask) == e.pressed) {
+        if (errors++ < 10) printf("event %u: key %u,%u %s twice\n", received, e.key.row, e.key.col,
+                                  e.pressed ? "pressed" : "released");
+    }
+    state[e.key.row] ^= mask;
+    if (received > 1 && (uint16_t)(e.time - last_time) >= 0x8000) {
+        if (errors++ < 10) printf("event %u: time %u before %u\n", received, e.time, last_time);
+    }
+    last_time = e.time;
+
+    // report waits for USB transmit
+    stall_rand = stall_rand * 1103515245 + 12345;
+    if (((stall_rand >> 8) % 200) == 0) {
+        stalls++;
+        usleep(5000 + (stall_rand >> 16) % 15000);
+    }
+    leave();
+}
+
+void hook_matrix_change(keyevent_t event) { (void)event; }
+void hook_keyboard_loop(void) {}
+void hook_keyboard_leds_change(uint8_t led_status) { (void)led_status; }
+void hook_usb_suspend_loop(void) { chThdSleepMilliseconds(1); }
+void send_keyboard_report(void) { resent++; }
+void mousekey_task(void) { enter(); leave(); }
+void mousekey_send(void) {}
+
+
+static void *keyboard_thread(void *arg)
+{
+    (void)arg;
+    keyboard_threads_main();
+    return NULL;
+}
+
+/* toggles keys at random for 'ms' */
+static uint32_t type(uint32_t ms)
+{
+    uint32_t toggled = 0;
+    uint32_t end = chVTGetSystemTimeX() + ms;
+    while ((int32_t)(end - chVTGetSystemTimeX()) > 0) {
+        uint8_t row = rnd(MATRIX_ROWS), col = rnd(MATRIX_COLS);
+        pthread_mutex_lock(&matrix_mtx);
+        typed[row] ^= (matrix_row_t)1 << col;
+        pthread_mutex_unlock(&matrix_mtx);
+        toggled++;
+        usleep(rnd(200));
+    }
+    return toggled;
+}
+
+int main(void)
+{
+    pthread_t kbd;
+    timer_base = 0xF000 - (uint16_t)chVTGetSystemTimeX();
+    pthread_create(&kbd, NULL, keyboard_thread, NULL);
+
+    uint32_t toggled = type(2000);
+    USBD1.state = USB_SUSPENDED;
+    toggled += type(50);
+    USBD1.state = USB_ACTIVE;
+    toggled += type(2000);
+
+    // queue drains and keys left on full come on next scans
+    usleep(500000);
+    chMtxLock(&action_mtx);
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (state[row] != typed[row]) {
+            if (errors++ < 10) printf("row %u: %02X expected %02X\n", row, state[row], typed[row]);
+        }
+    }
+    if (events_count()) {
+        errors++;
+        printf("%u events left in queue\n", events_count());
+    }
+    uint8_t full = events.overflow;
+    chMtxUnlock(&action_mtx);
+
+    printf("toggled: %u received: %u ticks: %u stalls: %u\n", toggled, received, ticks, stalls);
+    printf("scan: %u report: %u mouse: %u events max: %u full: %u resent: %u\n",
+           scan_count, report_count, mouse_count, events_max, full, resent);
+    if (!received || !ticks || !mouse_count) {
+        errors++;
+        printf("thread does not run\n");
+    }
+    if (!full) {
+        errors++;
+        printf("queue has never been full\n");
+    }
+    if (!resent) {
+        errors++;
+        printf("report is not sent after wakeup\n");
+    }
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    exit(errors ? 1 : 0);
+}
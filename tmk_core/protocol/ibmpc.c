@@ -49,17 +49,13 @@ POSSIBILITY OF SUCH DAMAGE.
 
 
 #define WAIT(stat, us, err) do { \
-    if (!wait_##stat(us)) { \
-        ibmpc_error = err; \
+    if (!wait_##stat(host, us)) { \
+        host->error = err; \
         goto ERROR; \
     } \
 } while (0)
 
 
-volatile uint16_t ibmpc_isr_debug = 0;
-volatile uint8_t ibmpc_protocol = IBMPC_PROTOCOL_NO;
-volatile uint8_t ibmpc_error = IBMPC_ERR_NONE;
-
 /* 2-byte buffer for data received from keyboard
  * buffer states:
  *      FFFF: empty
@@ -67,50 +63,150 @@ volatile uint8_t ibmpc_error = IBMPC_ERR_NONE;
  *      sstt: two data
  *      eeFF: error
  * where ss, tt and ee are 0x00-0xFE. 0xFF means empty or no data in buffer.
+ *
+ * isr_pending: Protocol of frame which may be complete; XT_Clone/XT_IBM-done or still midway.
+ * It is resolved with interval to next clock falling edge, instead of waiting
+ * for the edge in ISR. IBMPC_PROTOCOL_NO when nothing is pending.
+ *
+ * edge_ms, edge_raw: time of last clock falling edge; low byte of millisecond counter and TIMER_RAW
+ */
+ibmpc_t ibmpc_host[IBMPC_PORTS] = {
+    IBMPC_PORT_CONFIG(),
+#ifdef IBMPC_SECONDARY
+    IBMPC_PORT_CONFIG(2),
+#endif
+};
+
+/* Next clock edge within this interval means that the frame continues.
+ * Roughly what former busy-wait loops in ISR allowed for the next edge.
+ */
+#ifndef IBMPC_EDGE_GAP_US
+#define IBMPC_EDGE_GAP_US   120
+#endif
+#define EDGE_GAP_TICKS      ((uint16_t)((uint32_t)IBMPC_EDGE_GAP_US * (TIMER_RAW_FREQ / 1000) / 1000))
+
+#ifdef TIFR0
+#define TIMER_RAW_TIFR      TIFR0
+#else
+#define TIMER_RAW_TIFR      TIFR
+#endif
+
+/* Low byte of millisecond counter at TIMER_RAW value 'raw'.
+ * Call with interrupt disabled; this counts a tick whose Timer0 ISR is still pending.
  */
-static volatile uint16_t recv_data = 0xFFFF;
-/* internal state of receiving data */
-static volatile uint16_t isr_state = 0x8000;
-static uint8_t timer_start = 0;
+static inline uint8_t edge_ms_now(uint8_t raw)
+{
+    uint8_t t;
+#if defined(__AVR__)
+    // use only the least byte of millisecond timer
+    asm("lds %0, %1" : "=r" (t) : "p" (&timer_count));
+    //t = (uint8_t)timer_count;    // compiler uses four registers instead of one
+#else
+    t = (uint8_t)timer_count;   // host simulator: test/ibmpc_sim.c
+#endif
+    if ((TIMER_RAW_TIFR & (1<<OCF0A)) && raw < TIMER_RAW_TOP/2) t++;
+    return t;
+}
+
+/* Interval from last clock falling edge in TIMER_RAW ticks, 0xFFFF if it is over 1ms */
+static inline uint16_t edge_elapsed(ibmpc_t *host, uint8_t ms, uint8_t raw)
+{
+    uint8_t d = ms - host->edge_ms;
+    if (d > 1) return 0xFFFF;
+    int16_t e = d * (TIMER_RAW_TOP + 1) + raw - host->edge_raw;
+    // millisecond tick can be missed while Timer0 ISR is interrupted
+    if (e < 0) e += TIMER_RAW_TOP + 1;
+    return e;
+}
+
+#define LO8(w)  (*((uint8_t *)&(w)))
+#define HI8(w)  (*(((uint8_t *)&(w))+1))
+/* store received data or error into buffer and clear for next data */
+static inline void isr_done(ibmpc_t *host)
+{
+    if ((host->isr_state & 0x00FF) == 0x00FF) {
+        // receive error code 0xFF
+        host->error = IBMPC_ERR_FF;
+        // error: eeFF
+        host->recv_data = (IBMPC_ERR_FF<<8) | 0x00FF;
+    } else if (HI8(host->recv_data) != 0xFF && LO8(host->recv_data) != 0xFF) {
+        // buffer full
+        host->error = IBMPC_ERR_FULL;
+        host->recv_data = (IBMPC_ERR_FULL<<8) | 0x00FF;
+    } else {
+        // store data
+        host->recv_data = host->recv_data<<8;
+        host->recv_data |= host->isr_state & 0xFF;
+        host->recv_ms = host->edge_ms;
+    }
+    // clear for next data
+    host->isr_state = 0x8000;
+}
 
-void ibmpc_host_init(void)
+/* pending frame is done: XT_Clone-done or XT_IBM-done */
+static inline void isr_pending_done(ibmpc_t *host)
 {
-    // initialize reset pin to HiZ
-    IBMPC_RST_HIZ();
-    inhibit();
-    IBMPC_INT_INIT();
-    IBMPC_INT_OFF();
+    host->isr_debug = host->isr_state;
+    host->isr_state = host->isr_state>>8;
+    host->protocol = host->isr_pending;
+    host->isr_pending = IBMPC_PROTOCOL_NO;
+    isr_done(host);
 }
 
-void ibmpc_host_enable(void)
+/* interrupt for clock line: falling edge of INTn */
+static inline void int_init(ibmpc_t *host)
 {
-    IBMPC_INT_ON();
-    idle();
+    EICRA |= host->int_isc;
 }
 
-void ibmpc_host_disable(void)
+/* NOTE: clear flag and enabling to ditch unwanted interrupt */
+static inline void int_on(ibmpc_t *host)
 {
-    IBMPC_INT_OFF();
-    inhibit();
+    EIFR  |= host->int_mask;
+    EIMSK |= host->int_mask;
 }
 
-int16_t ibmpc_host_send(uint8_t data)
+static inline void int_off(ibmpc_t *host)
+{
+    EIMSK &= ~host->int_mask;
+}
+
+void ibmpc_host_init(ibmpc_t *host)
+{
+    inhibit(host);
+    int_init(host);
+    int_off(host);
+}
+
+void ibmpc_host_enable(ibmpc_t *host)
+{
+    int_on(host);
+    idle(host);
+}
+
+void ibmpc_host_disable(ibmpc_t *host)
+{
+    int_off(host);
+    inhibit(host);
+}
+
+int16_t ibmpc_host_send(ibmpc_t *host, uint8_t data)
 {
     bool parity = true;
-    ibmpc_error = IBMPC_ERR_NONE;
+    host->error = IBMPC_ERR_NONE;
 
     dprintf("w%02X ", data);
 
-    IBMPC_INT_OFF();
+    int_off(host);
 
     /* terminate a transmission if we have */
-    inhibit();
+    inhibit(host);
     wait_us(100);    // [5]p.54
 
     /* 'Request to Send' and Start bit */
-    data_lo();
+    data_lo(host);
     wait_us(100);
-    clock_hi();     // [5]p.54 [clock low]>100us [5]p.50
+    clock_hi(host);     // [5]p.54 [clock low]>100us [5]p.50
     WAIT(clock_lo, 10000, 1);   // [5]p.53, -10ms [5]p.50
 
     /* Data bit[2-9] */
@@ -118,9 +214,9 @@ int16_t ibmpc_host_send(uint8_t data)
         wait_us(15);
         if (data&(1<<i)) {
             parity = !parity;
-            data_hi();
+            data_hi(host);
         } else {
-            data_lo();
+            data_lo(host);
         }
         WAIT(clock_hi, 50, 2);
         WAIT(clock_lo, 50, 3);
@@ -128,15 +224,15 @@ int16_t ibmpc_host_send(uint8_t data)
 
     /* Parity bit */
     wait_us(15);
-    if (parity) { data_hi(); } else { data_lo(); }
+    if (parity) { data_hi(host); } else { data_lo(host); }
     WAIT(clock_hi, 50, 4);
     WAIT(clock_lo, 50, 5);
 
     /* Stop bit */
     wait_us(15);
-    data_hi();
+    data_hi(host);
     WAIT(clock_hi, 50, 6);
-    if (ibmpc_protocol == IBMPC_PROTOCOL_AT_Z150) { goto RECV; }
+    if (host->protocol == IBMPC_PROTOCOL_AT_Z150) { goto RECV; }
     WAIT(clock_lo, 50, 7);
 
     /* Ack */
@@ -148,36 +244,86 @@ int16_t ibmpc_host_send(uint8_t data)
 
 RECV:
     // clear buffer to get response correctly
-    recv_data = 0xFFFF;
-    ibmpc_host_isr_clear();
+    host->recv_data = 0xFFFF;
+    ibmpc_host_isr_clear(host);
 
-    idle();
-    IBMPC_INT_ON();
-    return ibmpc_host_recv_response();
+    idle(host);
+    int_on(host);
+    return ibmpc_host_recv_response(host);
 ERROR:
-    ibmpc_error |= IBMPC_ERR_SEND;
-    idle();
-    IBMPC_INT_ON();
+    host->error |= IBMPC_ERR_SEND;
+    idle(host);
+    int_on(host);
     return -1;
 }
 
+/*
+ * Starts sending data to keyboard without waiting for it
+ *
+ * Request to Send is made here and keyboard clocks in data, parity and stop bit
+ * in ISR. Response is received as usual with ibmpc_host_recv() after
+ * ibmpc_host_sending() turns false. Keyboard should start clocking within
+ * 10ms([5]p.50); if it doesn't, abort with ibmpc_host_isr_clear() and
+ * ibmpc_host_enable().
+ */
+void ibmpc_host_send_start(ibmpc_t *host, uint8_t data)
+{
+    bool parity = true;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (data&(1<<i)) parity = !parity;
+    }
+
+    dprintf("w%02X ", data);
+
+    int_off(host);
+
+    /* terminate a transmission if we have */
+    inhibit(host);
+    wait_us(100);    // [5]p.54
+
+    // clear buffer to get response correctly, protocol is needed in ISR
+    uint8_t protocol = host->protocol;
+    ibmpc_host_isr_clear(host);
+    host->protocol = protocol;
+    host->send_frame = data | (parity ? 0x100 : 0) | 0x200;
+    host->send_bit = 1;
+
+    /* 'Request to Send' and Start bit */
+    data_lo(host);
+    wait_us(100);
+    int_on(host);
+    clock_hi(host);     // [5]p.54 [clock low]>100us [5]p.50
+}
+
 /*
  * Receive data from keyboard
  */
-int16_t ibmpc_host_recv(void)
+int16_t ibmpc_host_recv(ibmpc_t *host)
 {
     uint16_t data = 0;
     uint8_t ret = 0xFF;
 
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        data = recv_data;
+        // no more clock edge: pending frame is complete
+        if (host->isr_pending) {
+            uint8_t raw = TIMER_RAW;
+            if (edge_elapsed(host, edge_ms_now(raw), raw) >= EDGE_GAP_TICKS) {
+                isr_pending_done(host);
+            }
+        }
+
+        data = host->recv_data;
+        if ((data & 0x00FF) != 0x00FF) {
+            uint8_t latency = (uint8_t)timer_count - host->recv_ms;
+            if (latency > host->recv_latency_max) host->recv_latency_max = latency;
+        }
 
         // remove data from buffer:
         // FFFF(empty)      -> FFFF
         // FFss(one data)   -> FFFF
         // sstt(two data)   -> FFtt
         // eeFF(errror)     -> FFFF
-        recv_data = data | (((data&0xFF00) == 0xFF00) ? 0x00FF : 0xFF00);
+        host->recv_data = data | (((data&0xFF00) == 0xFF00) ? 0x00FF : 0xFF00);
     }
 
     if ((data&0x00FF) == 0x00FF) {
@@ -185,11 +331,13 @@ int16_t ibmpc_host_recv(void)
         switch (data>>8) {
             case IBMPC_ERR_FF:
                 // 0xFF(Overrun/Error) from keyboard
+                host->error_count++;
                 dprintf("!FF! ");
                 ret = 0xFF;
                 break;
             case IBMPC_ERR_FULL:
                 // buffer full
+                host->error_count++;
                 dprintf("!FULL! ");
                 ret = 0xFF;
                 break;
@@ -198,6 +346,7 @@ int16_t ibmpc_host_recv(void)
                 return -1;
             default:
                 // other errors
+                host->error_count++;
                 dprintf("e%02X ", data>>8);
                 return -1;
         }
@@ -212,64 +361,104 @@ int16_t ibmpc_host_recv(void)
         }
     }
 
-    //dprintf("i%04X ", ibmpc_isr_debug); ibmpc_isr_debug = 0;
+    host->recv_count++;
+    //dprintf("i%04X ", host->isr_debug); host->isr_debug = 0;
     dprintf("r%02X ", ret);
     return ret;
 }
 
-int16_t ibmpc_host_recv_response(void)
+int16_t ibmpc_host_recv_response(ibmpc_t *host)
 {
     // Command may take 25ms/20ms at most([5]p.46, [3]p.21)
     uint8_t retry = 25;
     int16_t data = -1;
-    while (retry-- && (data = ibmpc_host_recv()) == -1) {
+    while (retry-- && (data = ibmpc_host_recv(host)) == -1) {
         wait_ms(1);
     }
     return data;
 }
 
-void ibmpc_host_isr_clear(void)
+void ibmpc_host_isr_clear(ibmpc_t *host)
 {
-    ibmpc_isr_debug = 0;
-    ibmpc_protocol = 0;
-    ibmpc_error = 0;
-    isr_state = 0x8000;
-    recv_data = 0xFFFF;
+    host->isr_debug = 0;
+    host->protocol = 0;
+    host->error = 0;
+    host->isr_state = 0x8000;
+    host->isr_pending = IBMPC_PROTOCOL_NO;
+    host->recv_data = 0xFFFF;
+    host->send_bit = 0;
+}
+
+/* Clock falling edge while sending: data bit 1-8, parity 9, stop bit 10 and ack 11.
+ * Keyboard samples data line at rising edge. Not inlined to keep receive path of ISR short.
+ */
+static void isr_send(ibmpc_t *host, uint8_t dbit) __attribute__((noinline));
+static void isr_send(ibmpc_t *host, uint8_t dbit)
+{
+    uint8_t n = host->send_bit;
+    if (n <= 10) {
+        if (host->send_frame & 1) {
+            data_hi(host);
+        } else {
+            data_lo(host);
+        }
+        host->send_frame = host->send_frame>>1;
+        host->send_bit = n + 1;
+        // Zenith Z-150 AT doesn't clock ack
+        if (n < 10 || host->protocol != IBMPC_PROTOCOL_AT_Z150) return;
+    } else if (dbit) {
+        // keyboard doesn't pull data line for ack
+        host->error = IBMPC_ERR_SEND | 8;
+    }
+    host->send_bit = 0;
 }
 
-#define LO8(w)  (*((uint8_t *)&(w)))
-#define HI8(w)  (*(((uint8_t *)&(w))+1))
 // NOTE: With this ISR data line can be read within 2us after clock falling edge.
 // To read data line early as possible:
 // write naked ISR with asembly code to read the line and call C func to do other job?
-ISR(IBMPC_INT_VECT)
+// ISR body shared by ports: inlined into each vector so that constant instance address is used.
+static inline void isr(ibmpc_t *host, uint8_t dbit) __attribute__((always_inline));
+static inline void isr(ibmpc_t *host, uint8_t dbit)
 {
-    uint8_t dbit;
-    dbit = IBMPC_DATA_PIN&(1<<IBMPC_DATA_BIT);
+    if (host->send_bit) {
+        isr_send(host, dbit);
+        return;
+    }
+
+    uint8_t raw = TIMER_RAW;
+    uint8_t t = edge_ms_now(raw);
+
+    // Pending frame: this edge continues the frame or starts next one
+    if (host->isr_pending) {
+        if (edge_elapsed(host, t, raw) < EDGE_GAP_TICKS) {
+            // XT_IBM-error-midway or AT-midway
+            host->isr_pending = IBMPC_PROTOCOL_NO;
+        } else {
+            isr_pending_done(host);
+        }
+    }
+    host->edge_ms = t;
+    host->edge_raw = raw;
 
     // Timeout check
-    uint8_t t;
-    // use only the least byte of millisecond timer
-    asm("lds %0, %1" : "=r" (t) : "p" (&timer_count));
-    //t = (uint8_t)timer_count;    // compiler uses four registers instead of one
-    if (isr_state == 0x8000) {
-        timer_start = t;
+    if (host->isr_state == 0x8000) {
+        host->timer_start = t;
     } else {
         // This gives 2.0ms at least before timeout
-        if ((uint8_t)(t - timer_start) >= 3) {
-            ibmpc_isr_debug = isr_state;
-            ibmpc_error = IBMPC_ERR_TIMEOUT;
+        if ((uint8_t)(t - host->timer_start) >= 3) {
+            host->isr_debug = host->isr_state;
+            host->error = IBMPC_ERR_TIMEOUT;
             goto ERROR;
 
             // timeout error recovery - start receiving new data
             // it seems to work somehow but may not under unstable situation
-            //timer_start = t;
-            //isr_state = 0x8000;
+            //host->timer_start = t;
+            //host->isr_state = 0x8000;
         }
     }
 
-    isr_state = isr_state>>1;
-    if (dbit) isr_state |= 0x8000;
+    host->isr_state = host->isr_state>>1;
+    if (dbit) host->isr_state |= 0x8000;
 
     // isr_state: state of receiving data from keyboard
     //
@@ -303,7 +492,7 @@ ISR(IBMPC_INT_VECT)
     // ^1: AT and XT_IBM takes same state.
     // ^2: AT and XT_IBM takes same state in case that AT b0 is 1,
     // we have to check AT stop bit to discriminate between the two protocol.
-    switch (isr_state & 0xFF) {
+    switch (host->isr_state & 0xFF) {
         case 0b00000000:
         case 0b10000000:
         case 0b01000000:    // ^1
@@ -312,49 +501,25 @@ ISR(IBMPC_INT_VECT)
             goto NEXT;
             break;
         case 0b11000000:    // ^3
-            {
-                uint8_t us = 100;
-                // wait for rising and falling edge of b7 of XT_IBM
-                while (!(IBMPC_CLOCK_PIN&(1<<IBMPC_CLOCK_BIT)) && us) { wait_us(1); us--; }
-                while (  IBMPC_CLOCK_PIN&(1<<IBMPC_CLOCK_BIT)  && us) { wait_us(1); us--; }
-
-                if (us) {
-                    // XT_IBM-error: read start(0) as 1
-                    goto NEXT;
-                } else {
-                    // XT_Clone-done
-                    ibmpc_isr_debug = isr_state;
-                    isr_state = isr_state>>8;
-                    ibmpc_protocol = IBMPC_PROTOCOL_XT_CLONE;
-                    goto DONE;
-                }
-            }
+            // XT_Clone-done or XT_IBM-error: read start(0) as 1
+            // next clock edge comes soon in XT_IBM-error, this is resolved on the edge or
+            // in ibmpc_host_recv() when no edge comes.
+            host->isr_pending = IBMPC_PROTOCOL_XT_CLONE;
+            goto NEXT;
             break;
         case 0b11100000:
             // XT_IBM-error-done
-            ibmpc_isr_debug = isr_state;
-            isr_state = isr_state>>8;
-            ibmpc_protocol = IBMPC_PROTOCOL_XT_ERROR;
+            host->isr_debug = host->isr_state;
+            host->isr_state = host->isr_state>>8;
+            host->protocol = IBMPC_PROTOCOL_XT_ERROR;
             goto DONE;
             break;
         case 0b10100000:    // ^2
-            {
-                uint8_t us = 100;
-                // wait for rising and falling edge of AT stop bit to discriminate between XT and AT
-                while (!(IBMPC_CLOCK_PIN&(1<<IBMPC_CLOCK_BIT)) && us) { wait_us(1); us--; }
-                while (  IBMPC_CLOCK_PIN&(1<<IBMPC_CLOCK_BIT)  && us) { wait_us(1); us--; }
-
-                if (us) {
-                    // found stop bit: AT-midway - process the stop bit in next ISR
-                    goto NEXT;
-                } else {
-                    // no stop bit: XT_IBM-done
-                    ibmpc_isr_debug = isr_state;
-                    isr_state = isr_state>>8;
-                    ibmpc_protocol = IBMPC_PROTOCOL_XT_IBM;
-                    goto DONE;
-                }
-             }
+            // XT_IBM-done or AT-midway
+            // AT stop bit follows soon in AT-midway, this is resolved on the edge or
+            // in ibmpc_host_recv() when no edge comes.
+            host->isr_pending = IBMPC_PROTOCOL_XT_IBM;
+            goto NEXT;
             break;
         case 0b00010000:
         case 0b10010000:
@@ -362,16 +527,16 @@ ISR(IBMPC_INT_VECT)
         case 0b11010000:
             // AT-done
             // TODO: parity check?
-            ibmpc_isr_debug = isr_state;
+            host->isr_debug = host->isr_state;
             // stop bit check
-            if (isr_state & 0x8000) {
-                ibmpc_protocol = IBMPC_PROTOCOL_AT;
+            if (host->isr_state & 0x8000) {
+                host->protocol = IBMPC_PROTOCOL_AT;
             } else {
                 // Zenith Z-150 AT(beige/white lable) asserts stop bit as low
                 // https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol#zenith-z-150-beige
-                ibmpc_protocol = IBMPC_PROTOCOL_AT_Z150;
+                host->protocol = IBMPC_PROTOCOL_AT_Z150;
             }
-            isr_state = isr_state>>6;
+            host->isr_state = host->isr_state>>6;
             goto DONE;
             break;
         case 0b01100000:
@@ -381,41 +546,39 @@ ISR(IBMPC_INT_VECT)
         case 0b11110000:
         default:            // xxxx_oooo(any 1 in low nibble)
             // Illegal
-            ibmpc_isr_debug = isr_state;
-            ibmpc_error = IBMPC_ERR_ILLEGAL;
+            host->isr_debug = host->isr_state;
+            host->error = IBMPC_ERR_ILLEGAL;
             goto ERROR;
             break;
     }
 
 ERROR:
     // error: eeFF
-    recv_data = (ibmpc_error<<8) | 0x00FF;
-    goto CLEAR;
+    host->recv_data = (host->error<<8) | 0x00FF;
+    host->isr_state = 0x8000;
+    goto NEXT;
 DONE:
-    if ((isr_state & 0x00FF) == 0x00FF) {
-        // receive error code 0xFF
-        ibmpc_error = IBMPC_ERR_FF;
-        goto ERROR;
-    }
-    if (HI8(recv_data) != 0xFF && LO8(recv_data) != 0xFF) {
-        // buffer full
-        ibmpc_error = IBMPC_ERR_FULL;
-        goto ERROR;
-    }
-    // store data
-    recv_data = recv_data<<8;
-    recv_data |= isr_state & 0xFF;
-CLEAR:
-    // clear for next data
-    isr_state = 0x8000;
+    isr_done(host);
 NEXT:
     return;
 }
 
+ISR(IBMPC_INT_VECT)
+{
+    isr(&ibmpc_host[0], IBMPC_DATA_PIN&(1<<IBMPC_DATA_BIT));
+}
+
+#ifdef IBMPC_SECONDARY
+ISR(IBMPC_INT_VECT2)
+{
+    isr(&ibmpc_host[1], IBMPC_DATA_PIN2&(1<<IBMPC_DATA_BIT2));
+}
+#endif
+
 /* send LED state to keyboard */
-void ibmpc_host_set_led(uint8_t led)
+void ibmpc_host_set_led(ibmpc_t *host, uint8_t led)
 {
-    if (0xFA == ibmpc_host_send(0xED)) {
-        ibmpc_host_send(led);
+    if (0xFA == ibmpc_host_send(host, 0xED)) {
+        ibmpc_host_send(host, led);
     }
 }
@@ -92,18 +92,88 @@ POSSIBILITY OF SUCH DAMAGE.
 #define IBMPC_LED_CAPS_LOCK   2
 
 
-extern volatile uint16_t ibmpc_isr_debug;
-extern volatile uint8_t ibmpc_protocol;
-extern volatile uint8_t ibmpc_error;
+/* Number of ports: secondary port is enabled with IBMPC_SECONDARY and its pin configuration */
+#ifdef IBMPC_SECONDARY
+#define IBMPC_PORTS     2
+#else
+#define IBMPC_PORTS     1
+#endif
+
+
+/*
+ * Host instance for a port: pins, ISR states and statistics
+ */
+typedef struct {
+    /* clock and data lines */
+    volatile uint8_t *clock_port;
+    volatile uint8_t *clock_pin;
+    volatile uint8_t *clock_ddr;
+    uint8_t clock_mask;
+    volatile uint8_t *data_port;
+    volatile uint8_t *data_pin;
+    volatile uint8_t *data_ddr;
+    uint8_t data_mask;
+    /* external interrupt for clock line: (1<<INTn) and ISCn1 bit of EICRA for falling edge */
+    uint8_t int_mask;
+    uint8_t int_isc;
+
+    volatile uint16_t isr_debug;
+    volatile uint8_t protocol;
+    volatile uint8_t error;
+
+    /* 2-byte buffer for data received from keyboard: see ibmpc.c */
+    volatile uint16_t recv_data;
+    /* internal state of receiving data */
+    volatile uint16_t isr_state;
+    volatile uint8_t isr_pending;
+    uint8_t timer_start;
+    uint8_t edge_ms;
+    uint8_t edge_raw;
+
+    /* sending data to keyboard in ISR: see ibmpc_host_send_start() */
+    volatile uint16_t send_frame;   // data, parity and stop bit to put on next edges
+    volatile uint8_t send_bit;      // number of next clock edge 1-11, 0 when not sending
 
-void ibmpc_host_init(void);
-void ibmpc_host_enable(void);
-void ibmpc_host_disable(void);
-int16_t ibmpc_host_send(uint8_t data);
-int16_t ibmpc_host_recv_response(void);
-int16_t ibmpc_host_recv(void);
-void ibmpc_host_isr_clear(void);
-void ibmpc_host_set_led(uint8_t usb_led);
+    /* statistics */
+    volatile uint8_t recv_ms;       // time when data was stored into buffer
+    uint8_t recv_latency_max;       // max time from storing data to ibmpc_host_recv() in ms
+    uint16_t recv_count;
+    uint16_t error_count;
+} ibmpc_t;
+
+/* Instance initializer with pin configuration of port n: IBMPC_CLOCK_PORT##n and so on */
+#define IBMPC_PORT_CONFIG(n) { \
+    .clock_port = &IBMPC_CLOCK_PORT##n, \
+    .clock_pin  = &IBMPC_CLOCK_PIN##n,  \
+    .clock_ddr  = &IBMPC_CLOCK_DDR##n,  \
+    .clock_mask = (1<<IBMPC_CLOCK_BIT##n), \
+    .data_port  = &IBMPC_DATA_PORT##n,  \
+    .data_pin   = &IBMPC_DATA_PIN##n,   \
+    .data_ddr   = &IBMPC_DATA_DDR##n,   \
+    .data_mask  = (1<<IBMPC_DATA_BIT##n), \
+    .int_mask   = (1<<IBMPC_INT_BIT##n), \
+    .int_isc    = IBMPC_INT_ISC##n,     \
+    .recv_data  = 0xFFFF,               \
+    .isr_state  = 0x8000,               \
+}
+
+extern ibmpc_t ibmpc_host[IBMPC_PORTS];
+
+void ibmpc_host_init(ibmpc_t *host);
+void ibmpc_host_enable(ibmpc_t *host);
+void ibmpc_host_disable(ibmpc_t *host);
+int16_t ibmpc_host_send(ibmpc_t *host, uint8_t data);
+void ibmpc_host_send_start(ibmpc_t *host, uint8_t data);
+int16_t ibmpc_host_recv_response(ibmpc_t *host);
+int16_t ibmpc_host_recv(ibmpc_t *host);
+void ibmpc_host_isr_clear(ibmpc_t *host);
+void ibmpc_host_set_led(ibmpc_t *host, uint8_t usb_led);
+
+/* true while keyboard is clocking in data of ibmpc_host_send_start() */
+static inline bool ibmpc_host_sending(ibmpc_t *host)
+{
+    return host->send_bit;
+}
 
 
 /*--------------------------------------------------------------------
@@ -113,92 +183,92 @@ void ibmpc_host_set_led(uint8_t usb_led);
 /*
  * Clock
  */
-static inline void clock_lo(void)
+static inline void clock_lo(ibmpc_t *host)
 {
-    IBMPC_CLOCK_PORT &= ~(1<<IBMPC_CLOCK_BIT);
-    IBMPC_CLOCK_DDR  |=  (1<<IBMPC_CLOCK_BIT);
+    *host->clock_port &= ~host->clock_mask;
+    *host->clock_ddr  |=  host->clock_mask;
 }
 
-static inline void clock_hi(void)
+static inline void clock_hi(ibmpc_t *host)
 {
     /* input with pull up */
-    IBMPC_CLOCK_DDR  &= ~(1<<IBMPC_CLOCK_BIT);
-    IBMPC_CLOCK_PORT |=  (1<<IBMPC_CLOCK_BIT);
+    *host->clock_ddr  &= ~host->clock_mask;
+    *host->clock_port |=  host->clock_mask;
 }
 
-static inline bool clock_in(void)
+static inline bool clock_in(ibmpc_t *host)
 {
-    IBMPC_CLOCK_DDR  &= ~(1<<IBMPC_CLOCK_BIT);
-    IBMPC_CLOCK_PORT |=  (1<<IBMPC_CLOCK_BIT);
+    *host->clock_ddr  &= ~host->clock_mask;
+    *host->clock_port |=  host->clock_mask;
     wait_us(1);
-    return IBMPC_CLOCK_PIN&(1<<IBMPC_CLOCK_BIT);
+    return *host->clock_pin & host->clock_mask;
 }
 
 /*
  * Data
  */
-static inline void data_lo(void)
+static inline void data_lo(ibmpc_t *host)
 {
-    IBMPC_DATA_PORT &= ~(1<<IBMPC_DATA_BIT);
-    IBMPC_DATA_DDR  |=  (1<<IBMPC_DATA_BIT);
+    *host->data_port &= ~host->data_mask;
+    *host->data_ddr  |=  host->data_mask;
 }
 
-static inline void data_hi(void)
+static inline void data_hi(ibmpc_t *host)
 {
     /* input with pull up */
-    IBMPC_DATA_DDR  &= ~(1<<IBMPC_DATA_BIT);
-    IBMPC_DATA_PORT |=  (1<<IBMPC_DATA_BIT);
+    *host->data_ddr  &= ~host->data_mask;
+    *host->data_port |=  host->data_mask;
 }
 
-static inline bool data_in(void)
+static inline bool data_in(ibmpc_t *host)
 {
-    IBMPC_DATA_DDR  &= ~(1<<IBMPC_DATA_BIT);
-    IBMPC_DATA_PORT |=  (1<<IBMPC_DATA_BIT);
+    *host->data_ddr  &= ~host->data_mask;
+    *host->data_port |=  host->data_mask;
     wait_us(1);
-    return IBMPC_DATA_PIN&(1<<IBMPC_DATA_BIT);
+    return *host->data_pin & host->data_mask;
 }
 #endif
 
 
-static inline uint16_t wait_clock_lo(uint16_t us)
+static inline uint16_t wait_clock_lo(ibmpc_t *host, uint16_t us)
 {
-    while (clock_in()  && us) { asm(""); wait_us(1); us--; }
+    while (clock_in(host)  && us) { asm(""); wait_us(1); us--; }
     return us;
 }
-static inline uint16_t wait_clock_hi(uint16_t us)
+static inline uint16_t wait_clock_hi(ibmpc_t *host, uint16_t us)
 {
-    while (!clock_in() && us) { asm(""); wait_us(1); us--; }
+    while (!clock_in(host) && us) { asm(""); wait_us(1); us--; }
     return us;
 }
-static inline uint16_t wait_data_lo(uint16_t us)
+static inline uint16_t wait_data_lo(ibmpc_t *host, uint16_t us)
 {
-    while (data_in() && us)  { asm(""); wait_us(1); us--; }
+    while (data_in(host) && us)  { asm(""); wait_us(1); us--; }
     return us;
 }
-static inline uint16_t wait_data_hi(uint16_t us)
+static inline uint16_t wait_data_hi(ibmpc_t *host, uint16_t us)
 {
-    while (!data_in() && us)  { asm(""); wait_us(1); us--; }
+    while (!data_in(host) && us)  { asm(""); wait_us(1); us--; }
     return us;
 }
 
 /* idle state that device can send */
-static inline void idle(void)
+static inline void idle(ibmpc_t *host)
 {
-    clock_hi();
-    data_hi();
+    clock_hi(host);
+    data_hi(host);
 }
 
 /* inhibit device to send(AT), soft reset(XT) */
-static inline void inhibit(void)
+static inline void inhibit(ibmpc_t *host)
 {
-    clock_lo();
-    data_hi();
+    clock_lo(host);
+    data_hi(host);
 }
 
 /* inhibit device to send(XT) */
-static inline void inhibit_xt(void)
+static inline void inhibit_xt(ibmpc_t *host)
 {
-    clock_hi();
-    data_lo();
+    clock_hi(host);
+    data_lo(host);
 }
 #endif
@@ -36,6 +36,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "host_driver.h"
 #include "iwrap.h"
 #include "print.h"
+#include "timer.h"
+#include "util.h"
 
 
 /* iWRAP MUX mode utils. 3.10 HID raw mode(iWRAP_HID_Application_Note.pdf) */
@@ -51,6 +53,56 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 static uint8_t connected = 0;
 //static uint8_t channel = 1;
 
+/* Link power mode
+ *
+ * Link is in active mode while typing and goes to sniff mode after
+ * IWRAP_SNIFF_TIMEOUT ms without report, then sniff subrating after
+ * IWRAP_SUBRATE_TIMEOUT ms. In sniff mode the module can transmit only at
+ * sniff anchor points, so mouse motion is accumulated and sent once per sniff
+ * interval. Key(keyboard, consumer and mouse button) switches the link to
+ * active before its report goes out.
+ *
+ * Sniff interval is in baseband slots(0.625ms); see 'SNIFF' and 'SSR' in
+ * iWRAP User Guide.
+ */
+#ifndef IWRAP_SNIFF_TIMEOUT
+#   define IWRAP_SNIFF_TIMEOUT      500
+#endif
+#ifndef IWRAP_SUBRATE_TIMEOUT
+#   define IWRAP_SUBRATE_TIMEOUT    2000
+#endif
+#ifndef IWRAP_SNIFF_MAX
+#   define IWRAP_SNIFF_MAX          40
+#endif
+#ifndef IWRAP_SNIFF_MIN
+#   define IWRAP_SNIFF_MIN          20
+#endif
+#ifndef IWRAP_SUBRATE_LATENCY
+#   define IWRAP_SUBRATE_LATENCY    160
+#endif
+#define IWRAP_SNIFF_INTERVAL        (IWRAP_SNIFF_MAX * 5 / 8)   // ms
+
+enum { LINK_ACTIVE, LINK_SNIFF, LINK_SUBRATE };
+static uint8_t link_mode = LINK_ACTIVE;
+static uint32_t link_mode_time = 0;
+static uint16_t last_report = 0;
+static uint32_t link_time[3];       // ms in each mode
+
+/* first key in sniff mode */
+static uint16_t wakeup_start;
+static uint16_t wakeup_count = 0;
+static uint16_t wakeup_latency = 0; // ms, last
+static uint16_t wakeup_max = 0;     // ms
+
+/* mouse motion accumulated in sniff mode */
+#if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
+static report_mouse_t mouse_batch;
+static bool mouse_pending = false;
+static uint16_t mouse_batch_time = 0;
+static uint16_t mouse_batched = 0;  // reports merged into another
+static uint8_t mouse_buttons = 0;   // last sent
+#endif
+
 /* iWRAP buffer */
 #define MUX_BUF_SIZE 64
 static char buf[MUX_BUF_SIZE];
@@ -267,12 +319,30 @@ void iwrap_sleep(void)
     iwrap_mux_send("SLEEP");
 }
 
+static void link_mode_set(uint8_t mode)
+{
+    uint32_t t = timer_read32();
+    link_time[link_mode] += TIMER_DIFF_32(t, link_mode_time);
+    link_mode_time = t;
+    link_mode = mode;
+}
+
 void iwrap_sniff(void)
 {
+    iwrap_mux_send("SNIFF " STR(IWRAP_SNIFF_MAX) " " STR(IWRAP_SNIFF_MIN) " 1 8");
+    link_mode_set(LINK_SNIFF);
 }
 
 void iwrap_subrate(void)
 {
+    iwrap_mux_send("SSR " STR(IWRAP_SUBRATE_LATENCY) " 0 0 0");
+    link_mode_set(LINK_SUBRATE);
+}
+
+void iwrap_active(void)
+{
+    iwrap_mux_send("ACTIVE 0");
+    link_mode_set(LINK_ACTIVE);
 }
 
 bool iwrap_failed(void)
@@ -288,6 +358,21 @@ uint8_t iwrap_connected(void)
     return connected;
 }
 
+void iwrap_print_stats(void)
+{
+    link_mode_set(link_mode);
+    print("link mode: ");
+    print(link_mode == LINK_ACTIVE ? "active\n" :
+          link_mode == LINK_SNIFF ? "sniff\n" : "subrate\n");
+    xprintf("time(ms) active: %lu sniff: %lu subrate: %lu\n",
+            link_time[LINK_ACTIVE], link_time[LINK_SNIFF], link_time[LINK_SUBRATE]);
+    xprintf("first key: %u latency(ms) last: %u max: %u\n",
+            wakeup_count, wakeup_latency, wakeup_max);
+#if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
+    xprintf("mouse batched: %u\n", mouse_batched);
+#endif
+}
+
 uint8_t iwrap_check_connection(void)
 {
     iwrap_mux_send("LIST");
@@ -327,9 +412,50 @@ static uint8_t keyboard_leds(void) {
     return 0;
 }
 
+static void mouse_flush(void);
+
+/* Key event: link goes active first so that the report doesn't wait for
+ * sniff anchor point. Returns true if link was in sniff mode. */
+static bool link_wakeup(void)
+{
+    last_report = timer_read();
+    if (link_mode == LINK_ACTIVE) return false;
+
+    wakeup_start = last_report;
+    iwrap_active();
+    mouse_flush();
+    wakeup_count++;
+    return true;
+}
+
+/* latency added to the first key by mode change */
+static void wakeup_done(bool woke)
+{
+    if (!woke) return;
+    wakeup_latency = timer_elapsed(wakeup_start);
+    if (wakeup_latency > wakeup_max) wakeup_max = wakeup_latency;
+}
+
+void iwrap_task(void)
+{
+    if (!connected) return;
+
+#if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
+    if (mouse_pending && timer_elapsed(mouse_batch_time) >= IWRAP_SNIFF_INTERVAL)
+        mouse_flush();
+#endif
+
+    uint16_t idle = timer_elapsed(last_report);
+    if (link_mode == LINK_ACTIVE && idle > IWRAP_SNIFF_TIMEOUT)
+        iwrap_sniff();
+    else if (link_mode == LINK_SNIFF && idle > IWRAP_SUBRATE_TIMEOUT)
+        iwrap_subrate();
+}
+
 static void send_keyboard(report_keyboard_t *report)
 {
     if (!iwrap_connected() && !iwrap_check_connection()) return;
+    bool woke = link_wakeup();
     MUX_HEADER(0x01, 0x0c);
     // HID raw mode header
     xmit(0x9f);
@@ -345,12 +471,13 @@ static void send_keyboard(report_keyboard_t *report)
     xmit(report->keys[4]);
     xmit(report->keys[5]);
     MUX_FOOTER(0x01);
+    wakeup_done(woke);
 }
 
-static void send_mouse(report_mouse_t *report)
-{
 #if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
-    if (!iwrap_connected() && !iwrap_check_connection()) return;
+static void mouse_xmit(report_mouse_t *report)
+{
+    mouse_buttons = report->buttons;
     MUX_HEADER(0x01, 0x09);
     // HID raw mode header
     xmit(0x9f);
@@ -363,6 +490,55 @@ static void send_mouse(report_mouse_t *report)
     xmit(report->v);
     xmit(report->h);
     MUX_FOOTER(0x01);
+}
+
+static int8_t add_clamp(int8_t a, int8_t b)
+{
+    int16_t r = a + b;
+    return (r > 127) ? 127 : (r < -127) ? -127 : r;
+}
+#endif
+
+static void mouse_flush(void)
+{
+#if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
+    if (!mouse_pending) return;
+    mouse_pending = false;
+    mouse_xmit(&mouse_batch);
+#endif
+}
+
+static void send_mouse(report_mouse_t *report)
+{
+#if defined(MOUSEKEY_ENABLE) || defined(PS2_MOUSE_ENABLE)
+    if (!iwrap_connected() && !iwrap_check_connection()) return;
+
+    if (report->buttons != mouse_buttons) {
+        // button is a key
+        bool woke = link_wakeup();
+        mouse_xmit(report);
+        wakeup_done(woke);
+        return;
+    }
+
+    last_report = timer_read();
+    if (link_mode == LINK_ACTIVE) {
+        mouse_xmit(report);
+        return;
+    }
+
+    // sniff mode: motion in an interval goes out in a report
+    if (mouse_pending) {
+        mouse_batch.x = add_clamp(mouse_batch.x, report->x);
+        mouse_batch.y = add_clamp(mouse_batch.y, report->y);
+        mouse_batch.v = add_clamp(mouse_batch.v, report->v);
+        mouse_batch.h = add_clamp(mouse_batch.h, report->h);
+        mouse_batched++;
+    } else {
+        mouse_batch = *report;
+        mouse_batch_time = last_report;
+        mouse_pending = true;
+    }
 #endif
 }
 
@@ -382,6 +558,7 @@ static void send_consumer(uint16_t data)
     if (!iwrap_connected() && !iwrap_check_connection()) return;
     if (data == last_data) return;
     last_data = data;
+    bool woke = link_wakeup();
 
     // 3.10 HID raw mode(iWRAP_HID_Application_Note.pdf)
     switch (data) {
@@ -465,5 +642,6 @@ static void send_consumer(uint16_t data)
     xmit(bits2);
     xmit(bits3);
     MUX_FOOTER(0x01);
+    wakeup_done(woke);
 #endif
 }
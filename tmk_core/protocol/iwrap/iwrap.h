@@ -42,6 +42,9 @@ void iwrap_unpair(void);
 void iwrap_sleep(void);
 void iwrap_sniff(void);
 void iwrap_subrate(void);
+void iwrap_active(void);
+void iwrap_task(void);
+void iwrap_print_stats(void);
 bool iwrap_failed(void);
 uint8_t iwrap_connected(void);
 uint8_t iwrap_check_connection(void);
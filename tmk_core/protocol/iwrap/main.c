@@ -183,6 +183,7 @@ int main(void)
 
         // TODO: suspend.h
         if (host_get_driver() == iwrap_driver()) {
+            iwrap_task();
             if (sleeping && !insomniac) {
                 _delay_ms(1);   // wait for UART to send
                 iwrap_sleep();
@@ -263,6 +264,7 @@ static bool console_command(uint8_t c)
             print("u: USB mode. switch to USB.\n");
             print("w: BT mode. switch to Bluetooth.\n");
 #endif
+            print("s: link mode statistics.\n");
             print("k: kill first connection.\n");
             print("Del: unpair first pairing.\n");
             print("\n");
@@ -302,6 +304,9 @@ static bool console_command(uint8_t c)
             PCICR  |= 0b00000010;
             return 1;
 #endif
+        case 's':
+            iwrap_print_stats();
+            return 1;
         case 'k':
             print("kill\n");
             iwrap_kill();
@@ -96,13 +96,7 @@ host_driver_t lufa_driver = {
  ******************************************************************************/
 #ifdef CONSOLE_ENABLE
 #define SENDBUF_SIZE 256
-static uint8_t sbuf[SENDBUF_SIZE];
-static ringbuf_t sendbuf = {
-    .buffer = sbuf,
-    .head = 0,
-    .tail = 0,
-    .size_mask = SENDBUF_SIZE - 1
-};
+RINGBUF_DEFINE(sendbuf, uint8_t, SENDBUF_SIZE)
 
 // TODO: Around 2500ms delay often works anyhoo but proper startup would be better
 // 1000ms delay of hid_listen affects this probably
@@ -124,10 +118,10 @@ static bool console_putc(uint8_t c)
     if (!(SREG & (1<<SREG_I)))
         goto EXIT;
 
-    if (USB_DeviceState != DEVICE_STATE_Configured && !ringbuf_is_full(&sendbuf))
+    if (USB_DeviceState != DEVICE_STATE_Configured && !sendbuf_is_full())
         goto EXIT;
 
-    if (!console_is_ready() && !ringbuf_is_full(&sendbuf))
+    if (!console_is_ready() && !sendbuf_is_full())
         goto EXIT;
 
     /* Data lost considerations:
@@ -153,8 +147,10 @@ AGAIN:
     }
 
     // write from buffer to endpoint bank
-    while (!ringbuf_is_empty(&sendbuf) && Endpoint_IsReadWriteAllowed()) {
-        Endpoint_Write_8(ringbuf_get(&sendbuf));
+    while (!sendbuf_is_empty() && Endpoint_IsReadWriteAllowed()) {
+        uint8_t d;
+        sendbuf_get(&d);
+        Endpoint_Write_8(d);
 
         // clear bank when it is full
         if (!Endpoint_IsReadWriteAllowed() && Endpoint_IsINReady()) {
@@ -164,7 +160,7 @@ AGAIN:
     }
 
     // write c to bank directly if there is no others in buffer
-    if (ringbuf_is_empty(&sendbuf) && Endpoint_IsReadWriteAllowed()) {
+    if (sendbuf_is_empty() && Endpoint_IsReadWriteAllowed()) {
         Endpoint_Write_8(c);
         done = true;
     }
@@ -188,7 +184,7 @@ AGAIN:
      * once timeout this is disabled until host receives actually,
      * otherwise this will block or make main loop execution sluggish.
      */
-    if (ringbuf_is_full(&sendbuf) && timeout) {
+    if (sendbuf_is_full() && timeout) {
         uint16_t curr = timer_read();
         if (curr != prev) {
             timeout--;
@@ -200,7 +196,7 @@ AGAIN:
 EXIT_RESTORE_EP:
     Endpoint_SelectEndpoint(ep);
 EXIT:
-    return ringbuf_put(&sendbuf, c);
+    return sendbuf_put(c);
 }
 
 static void console_flush(void)
@@ -220,8 +216,10 @@ static void console_flush(void)
     }
 
     // write from buffer to endpoint bank
-    while (!ringbuf_is_empty(&sendbuf) && Endpoint_IsReadWriteAllowed()) {
-        Endpoint_Write_8(ringbuf_get(&sendbuf));
+    while (!sendbuf_is_empty() && Endpoint_IsReadWriteAllowed()) {
+        uint8_t d;
+        sendbuf_get(&d);
+        Endpoint_Write_8(d);
 
         // clear bank when it is full
         if (!Endpoint_IsReadWriteAllowed() && Endpoint_IsINReady()) {
@@ -651,6 +649,16 @@ static void setup_mcu(void)
     clock_prescale_set(clock_div_1);
 }
 
+#ifdef USB_IDLE_SLEEP
+static bool matrix_is_idle(void)
+{
+    for (uint8_t r = 0; r < MATRIX_ROWS; r++) {
+        if (matrix_get_row(r)) return false;
+    }
+    return true;
+}
+#endif
+
 static void setup_usb(void)
 {
     // Leonardo needs. Without this USB device is not recognized.
@@ -721,6 +729,13 @@ int main(void)
 #if !defined(INTERRUPT_CONTROL_ENDPOINT)
         USB_USBTask();
 #endif
+
+#ifdef USB_IDLE_SLEEP
+        // no key is on: sleep till next timer tick or USB interrupt
+        if (USB_DeviceState == DEVICE_STATE_Configured && matrix_is_idle()) {
+            suspend_idle(0);
+        }
+#endif
     }
 }
 
@@ -42,6 +42,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <util/delay.h>
 #include "m0110.h"
 #include "debug.h"
+#include "timer.h"
+#ifdef M0110_USE_INT
+#include <util/atomic.h>
+#include "ringbuf.h"
+#endif
 
 
 static inline uint8_t raw2scan(uint8_t raw);
@@ -88,12 +93,63 @@ static inline void request(void);
 
 uint8_t m0110_error = 0;
 
+/* latency statistics */
+uint16_t m0110_gap_max = 0;
+uint16_t m0110_block_max = 0;
+uint16_t m0110_error_count = 0;
+
+
+#ifdef M0110_USE_INT
+/*
+ * Interrupt-driven host
+ *
+ * Clock edge interrupt shifts command out and response in, and response is
+ * put into ring buffer. Next command is started by interrupt 80us after the
+ * response, so that one exchange is always in flight regardless of main loop.
+ * Inquiry is used as keyboard responds to it immediately on key event or with
+ * NULL after 0.25s; Instant is used for second byte of keypad/shift sequence.
+ * m0110_recv_key() starts command only after error or when ring buffer was full.
+ *
+ * Host holds last bit of command for 80us before releasing data line. The hold
+ * and the wait before next command are ended by Timer0 compare B interrupt
+ * instead of busy wait in the ISR.
+ * Timer0 is system timer and runs in CTC mode with OCR0A, OCR0B is free.
+ */
+#ifndef M0110_TIMEOUT
+#define M0110_TIMEOUT       500     // ms: no response to command
+#endif
+#ifndef M0110_BACKOFF_MAX
+#define M0110_BACKOFF_MAX   1000    // ms: max wait before retry on error
+#endif
+
+#define HOLD_TICKS          ((uint16_t)(80UL * TIMER_RAW_FREQ / 1000000) + 1)
+
+enum { M0110_IDLE, M0110_SEND, M0110_HOLD, M0110_RECV, M0110_WAIT };
+static volatile uint8_t state = M0110_IDLE;
+static volatile uint8_t last_raw = M0110_NULL;
+static volatile uint16_t recv_ms;
+static uint8_t  shift_data;
+static uint8_t  shift_bit;
+static uint16_t cmd_ms;
+static uint16_t backoff = 0;
+
+RINGBUF_DEFINE(rbuf, uint8_t, 8);
+
+static void task(void);
+static bool raw_get(uint8_t *raw);
+#endif
 
 void m0110_init(void)
 {
     idle();
     _delay_ms(1000);
 
+#ifdef M0110_USE_INT
+    recv_ms = timer_read();
+    M0110_INT_INIT();
+    M0110_INT_ON();
+#endif
+
 /* Not needed to initialize in fact.
     uint8_t data;
     m0110_send(M0110_MODEL);
@@ -125,6 +181,7 @@ uint8_t m0110_send(uint8_t data)
     idle();
     return 1;
 ERROR:
+    m0110_error_count++;
     print("m0110_send err: "); phex(m0110_error); print("\n");
     _delay_ms(500);
     idle();
@@ -148,6 +205,7 @@ uint8_t m0110_recv(void)
     idle();
     return data;
 ERROR:
+    m0110_error_count++;
     print("m0110_recv err: "); phex(m0110_error); print("\n");
     _delay_ms(500);
     idle();
@@ -199,13 +257,47 @@ During Calc key is hold:
     *b: Shift(d) event is ignored.
     *c: Arrow/Calc(d) event is ignored.
 */
+#ifdef M0110_USE_INT
+/* raw bytes received but not decoded yet */
+static uint8_t raws[4];
+static uint8_t raw_count = 0;
+
+static bool raw_get(uint8_t *raw)
+{
+    if (!raw_count) return false;
+    *raw = raws[0];
+    for (uint8_t i = 1; i < raw_count; i++) raws[i - 1] = raws[i];
+    raw_count--;
+    return true;
+}
+
+#define RAW()   ({ uint8_t _r = M0110_NULL; raw_get(&_r); _r; })
+#else
+#define RAW()   instant()
+#endif
+
+static uint8_t recv_key(void);
+
 uint8_t m0110_recv_key(void)
+{
+    uint16_t t = timer_read();
+    uint8_t key = recv_key();
+    t = timer_elapsed(t);
+    if (t > m0110_block_max) m0110_block_max = t;
+    return key;
+}
+
+static uint8_t recv_key(void)
 {
     static uint8_t keybuf = 0x00;
     static uint8_t keybuf2 = 0x00;
     static uint8_t rawbuf = 0x00;
     uint8_t raw, raw2, raw3;
 
+#ifdef M0110_USE_INT
+    task();
+#endif
+
     if (keybuf) {
         raw = keybuf;
         keybuf = 0x00;
@@ -217,15 +309,40 @@ uint8_t m0110_recv_key(void)
         return raw;
     }
 
+#ifdef M0110_USE_INT
+    // put back Shift of previous sequence
+    if (rawbuf) {
+        for (uint8_t i = raw_count; i > 0; i--) raws[i] = raws[i - 1];
+        raws[0] = rawbuf;
+        raw_count++;
+        rawbuf = 0x00;
+    }
+    while (raw_count < sizeof(raws) && rbuf_get(&raws[raw_count])) {
+        // NULL is meaningful only in middle of sequence
+        if (raws[raw_count] != M0110_NULL) {
+            debug_hex(raws[raw_count]); debug(" ");
+            raw_count++;
+        } else if (raw_count) {
+            raw_count++;
+        }
+    }
+
+    // wait until whole sequence is received
+    uint8_t need = 1;
+    if (raw_count >= 1 && (KEY(raws[0]) == M0110_KEYPAD || KEY(raws[0]) == M0110_SHIFT)) need = 2;
+    if (raw_count >= 2 && KEY(raws[0]) == M0110_SHIFT && KEY(raws[1]) == M0110_KEYPAD) need = 3;
+    if (raw_count < need) return M0110_NULL;
+#endif
+
     if (rawbuf) {
         raw = rawbuf;
         rawbuf = 0x00;
     } else {
-        raw = instant();  // Use INSTANT for better response. Should be INQUIRY ?
+        raw = RAW();  // Use INSTANT for better response. Should be INQUIRY ?
     }
     switch (KEY(raw)) {
         case M0110_KEYPAD:
-            raw2 = instant();
+            raw2 = RAW();
             switch (KEY(raw2)) {
                 case M0110_ARROW_UP:
                 case M0110_ARROW_DOWN:
@@ -242,7 +359,7 @@ uint8_t m0110_recv_key(void)
             return (raw2scan(raw2) | M0110_KEYPAD_OFFSET);
             break;
         case M0110_SHIFT:
-            raw2 = instant();
+            raw2 = RAW();
             switch (KEY(raw2)) {
                 case M0110_SHIFT:
                     // Case: 5-8,C,G,H
@@ -251,7 +368,7 @@ uint8_t m0110_recv_key(void)
                     break;
                 case M0110_KEYPAD:
                     // Shift + Arrow, Calc, or etc.
-                    raw3 = instant();
+                    raw3 = RAW();
                     switch (KEY(raw3)) {
                         case M0110_ARROW_UP:
                         case M0110_ARROW_DOWN:
@@ -304,6 +421,127 @@ uint8_t m0110_recv_key(void)
 }
 
 
+#ifdef M0110_USE_INT
+/* Timer0 compare B interrupt after ticks */
+static inline void compb_start(uint16_t ticks)
+{
+    uint16_t t = TIMER_RAW + ticks;
+    if (t > TIMER_RAW_TOP) t -= TIMER_RAW_TOP + 1;
+    OCR0B = t;
+    TIFR0 = (1<<OCF0B);
+    TIMSK0 |= (1<<OCIE0B);
+}
+
+/* Start command for next byte. Interrupts must be masked. */
+static void start(void)
+{
+    uint8_t raw = last_raw;
+    shift_data = (KEY(raw) == M0110_KEYPAD || KEY(raw) == M0110_SHIFT) ? M0110_INSTANT : M0110_INQUIRY;
+    shift_bit = 0;
+    cmd_ms = timer_read();
+
+    uint16_t gap = cmd_ms - recv_ms;
+    if (gap > m0110_gap_max) m0110_gap_max = gap;
+
+    state = M0110_SEND;
+    request();
+}
+
+/* Start command when interrupt couldn't, or recover from missing response */
+static void task(void)
+{
+    bool error = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (state == M0110_IDLE) {
+            if (!(m0110_error && timer_elapsed(cmd_ms) < backoff) && !rbuf_is_full()) {
+                start();
+            }
+        } else if (timer_elapsed(cmd_ms) > M0110_TIMEOUT) {
+            TIMSK0 &= ~(1<<OCIE0B);
+            m0110_error = (state == M0110_SEND ? 1 : 2);
+            state = M0110_IDLE;
+            last_raw = M0110_NULL;
+            idle();
+
+            // retry later without blocking
+            backoff = (backoff ? backoff * 2 : 10);
+            if (backoff > M0110_BACKOFF_MAX) backoff = M0110_BACKOFF_MAX;
+            cmd_ms = timer_read();
+            recv_ms = cmd_ms + backoff;
+            m0110_error_count++;
+            error = true;
+        }
+    }
+    if (error) {
+        print("m0110 err: "); phex(m0110_error); print("\n");
+    }
+}
+
+ISR(M0110_INT_VECT)
+{
+    bool clock = M0110_CLOCK_PIN & (1<<M0110_CLOCK_BIT);
+
+    switch (state) {
+        case M0110_SEND:
+            if (!clock) {
+                // place bit while clock is low
+                if (shift_data & 0x80) {
+                    data_hi();
+                } else {
+                    data_lo();
+                }
+            } else {
+                // keyboard reads bit on rising edge
+                shift_data <<= 1;
+                if (++shift_bit == 8) {
+                    // hold last bit for 80us
+                    compb_start(HOLD_TICKS);
+                    state = M0110_HOLD;
+                }
+            }
+            break;
+        case M0110_RECV:
+            if (clock) {
+                shift_data <<= 1;
+                if (M0110_DATA_PIN & (1<<M0110_DATA_BIT)) {
+                    shift_data |= 1;
+                }
+                if (++shift_bit == 8) {
+                    rbuf_put(shift_data);
+                    last_raw = shift_data;
+                    recv_ms = timer_read();
+                    m0110_error = 0;
+                    backoff = 0;
+                    // next command after keyboard releases data line
+                    compb_start(HOLD_TICKS);
+                    state = M0110_WAIT;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+    TIMSK0 &= ~(1<<OCIE0B);
+    if (state == M0110_HOLD) {
+        data_hi();
+        shift_bit = 0;
+        state = M0110_RECV;
+    } else if (state == M0110_WAIT) {
+        // left to m0110_recv_key() until ring buffer has room
+        if (rbuf_is_full()) {
+            state = M0110_IDLE;
+        } else {
+            start();
+        }
+    }
+}
+#endif
+
 static inline uint8_t raw2scan(uint8_t raw) {
     return (raw == M0110_NULL) ?  M0110_NULL : (
                 (raw == M0110_ERROR) ?  M0110_ERROR : (
@@ -320,8 +558,13 @@ static inline uint8_t inquiry(void)
 
 static inline uint8_t instant(void)
 {
+    static uint16_t recv_ms;
+    uint16_t gap = timer_elapsed(recv_ms);
+    if (gap > m0110_gap_max) m0110_gap_max = gap;
+
     m0110_send(M0110_INSTANT);
     uint8_t data = m0110_recv();
+    recv_ms = timer_read();
     if (data != M0110_NULL) {
         debug_hex(data); debug(" ");
     }
@@ -80,6 +80,19 @@ POSSIBILITY OF SUCH DAMAGE.
 
 
 extern uint8_t m0110_error;
+/* longest time(ms) keyboard was left without command in flight */
+extern uint16_t m0110_gap_max;
+/* longest time(ms) m0110_recv_key() held main loop */
+extern uint16_t m0110_block_max;
+extern uint16_t m0110_error_count;
+
+/* Interrupt on clock edges(both rising and falling) is required with M0110_USE_INT:
+ * M0110_INT_INIT(), M0110_INT_ON(), M0110_INT_OFF() and M0110_INT_VECT.
+ * Timer0 compare B interrupt is also used to end command.
+ * m0110_send() and m0110_recv() must not be used in that case. */
+#if defined(M0110_USE_INT) && !defined(M0110_INT_VECT)
+#   error "M0110 clock interrupt setting is required in config.h"
+#endif
 
 /* host role */
 void m0110_init(void);
@@ -42,7 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdbool.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
-#include "pbuff.h"
+#include "ringbuf.h"
 #include "ps2.h"
 #include "ps2_io.h"
 #include "print.h"
@@ -58,6 +58,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 uint8_t ps2_error = PS2_ERR_NONE;
 
+/* data received by interrupt */
+#define PBUF_SIZE 32
+RINGBUF_DEFINE(pbuf, uint8_t, PBUF_SIZE)
+
 void ps2_host_init(void)
 {
     idle();
@@ -127,18 +131,21 @@ uint8_t ps2_host_recv_response(void)
 {
     // Command may take 25ms/20ms at most([5]p.46, [3]p.21)
     uint8_t retry = 25;
-    while (retry-- && !pbuf_has_data()) {
+    while (retry-- && pbuf_is_empty()) {
         _delay_ms(1);
     }
-    return pbuf_dequeue();
+    uint8_t data = 0;
+    pbuf_get(&data);
+    return data;
 }
 
 /* get data received by interrupt */
 uint8_t ps2_host_recv(void)
 {
-    if (pbuf_has_data()) {
+    uint8_t data;
+    if (pbuf_get(&data)) {
         ps2_error = PS2_ERR_NONE;
-        return pbuf_dequeue();
+        return data;
     } else {
         ps2_error = PS2_ERR_NODATA;
         return 0;
@@ -196,7 +203,7 @@ ISR(PS2_INT_VECT)
         case STOP:
             if (!data_in())
                 goto ERROR;
-            pbuf_enqueue(data);
+            pbuf_put(data);
             goto DONE;
             break;
         default:
@@ -29,11 +29,29 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 static report_mouse_t mouse_report = {};
 
+/* Device ID: 0x00 standard, 0x03 wheel, 0x04 wheel and 5-button */
+static uint8_t mouse_id = PS2_MOUSE_ID_STANDARD;
+
 
 static void print_usb_data(void);
+static void process_packet(uint8_t ext_buttons);
+
+
+#ifdef PS2_MOUSE_STREAM_MODE
+static uint8_t set_sample_rate(uint8_t rate)
+{
+    uint8_t rcv = ps2_host_send(PS2_MOUSE_SET_SAMPLE_RATE);
+    if (rcv != PS2_ACK) return rcv;
+    return ps2_host_send(rate);
+}
 
+static uint8_t read_device_id(void)
+{
+    if (ps2_host_send(PS2_MOUSE_GET_DEVICE_ID) != PS2_ACK) return PS2_MOUSE_ID_STANDARD;
+    return ps2_host_recv_response();
+}
+#endif
 
-/* supports only 3 button mouse at this time */
 uint8_t ps2_mouse_init(void) {
     uint8_t rcv;
 
@@ -56,10 +74,35 @@ uint8_t ps2_mouse_init(void) {
     print("ps2_mouse_init: read DevID: ");
     phex(rcv); phex(ps2_error); print("\n");
 
+#ifdef PS2_MOUSE_STREAM_MODE
+    // IntelliMouse: sample rate 200, 100, 80 enables wheel(ID 0x03)
+    set_sample_rate(200); set_sample_rate(100); set_sample_rate(80);
+    mouse_id = read_device_id();
+    if (mouse_id == PS2_MOUSE_ID_WHEEL) {
+        // IntelliMouse Explorer: sample rate 200, 200, 80 enables 5-button(ID 0x04)
+        set_sample_rate(200); set_sample_rate(200); set_sample_rate(80);
+        mouse_id = read_device_id();
+    }
+    if (mouse_id != PS2_MOUSE_ID_WHEEL && mouse_id != PS2_MOUSE_ID_5BUTTON) {
+        mouse_id = PS2_MOUSE_ID_STANDARD;
+    }
+    print("ps2_mouse_init: DevID: ");
+    phex(mouse_id); print("\n");
+
+    rcv = set_sample_rate(PS2_MOUSE_SAMPLE_RATE);
+    print("ps2_mouse_init: set sample rate: ");
+    phex(rcv); phex(ps2_error); print("\n");
+
+    // send Enable Data Reporting; mouse sends packets by itself from now on
+    rcv = ps2_host_send(PS2_MOUSE_ENABLE_REPORTING);
+    print("ps2_mouse_init: send 0xF4: ");
+    phex(rcv); phex(ps2_error); print("\n");
+#else
     // send Set Remote mode
     rcv = ps2_host_send(0xF0);
     print("ps2_mouse_init: send 0xF0: ");
     phex(rcv); phex(ps2_error); print("\n");
+#endif
 
     return 0;
 }
@@ -68,12 +111,53 @@ uint8_t ps2_mouse_init(void) {
 #define Y_IS_NEG  (mouse_report.buttons & (1<<PS2_MOUSE_Y_SIGN))
 #define X_IS_OVF  (mouse_report.buttons & (1<<PS2_MOUSE_X_OVFLW))
 #define Y_IS_OVF  (mouse_report.buttons & (1<<PS2_MOUSE_Y_OVFLW))
+#ifdef PS2_MOUSE_STREAM_MODE
 void ps2_mouse_task(void)
 {
-    enum { SCROLL_NONE, SCROLL_BTN, SCROLL_SENT };
-    static uint8_t scroll_state = SCROLL_NONE;
-    static uint8_t buttons_prev = 0;
+    static uint8_t packet[4];
+    static uint8_t index = 0;
+    static uint16_t last_time = 0;
+    uint8_t size = (mouse_id == PS2_MOUSE_ID_STANDARD ? 3 : 4);
+
+    /* discard partial packet when rest of it doesn't come in time */
+    if (index && TIMER_DIFF_16(timer_read(), last_time) > PS2_MOUSE_PACKET_TIMEOUT) {
+        if (debug_mouse) print("ps2_mouse: packet timeout\n");
+        index = 0;
+    }
+
+    /* assemble packets from bytes received by interrupt */
+    while (1) {
+        uint8_t rcv = ps2_host_recv();
+        if (ps2_error == PS2_ERR_NODATA) break;
 
+        // bit3 of first byte is always 1; use it to resync
+        if (index == 0 && !(rcv & (1<<3))) {
+            if (debug_mouse) { print("ps2_mouse: out of sync: "); phex(rcv); print("\n"); }
+            continue;
+        }
+        packet[index++] = rcv;
+        last_time = timer_read();
+        if (index < size) continue;
+        index = 0;
+
+        mouse_report.buttons = packet[0];
+        mouse_report.x = packet[1];
+        mouse_report.y = packet[2];
+        uint8_t ext_buttons = 0;
+        if (mouse_id == PS2_MOUSE_ID_5BUTTON) {
+            // 4-bit signed wheel
+            mouse_report.v = -(int8_t)((packet[3] & 0x08) ? (packet[3] | 0xF0) : (packet[3] & 0x0F));
+            if (packet[3] & (1<<4)) ext_buttons |= MOUSE_BTN4;
+            if (packet[3] & (1<<5)) ext_buttons |= MOUSE_BTN5;
+        } else if (mouse_id == PS2_MOUSE_ID_WHEEL) {
+            mouse_report.v = -(int8_t)packet[3];
+        }
+        process_packet(ext_buttons);
+    }
+}
+#else
+void ps2_mouse_task(void)
+{
     /* receives packet from mouse */
     uint8_t rcv;
     rcv = ps2_host_send(PS2_MOUSE_READ_DATA);
@@ -85,20 +169,40 @@ void ps2_mouse_task(void)
         if (debug_mouse) print("ps2_mouse: fail to get mouse packet\n");
         return;
     }
+    process_packet(0);
+}
+#endif
 
-    /* if mouse moves or buttons state changes */
-    if (mouse_report.x || mouse_report.y ||
-            ((mouse_report.buttons ^ buttons_prev) & PS2_MOUSE_BTN_MASK)) {
+#if PS2_MOUSE_SCROLL_BTN_MASK
+/* saturates to HID range -127 to 127 */
+static int8_t scroll_add(int8_t a, int8_t b)
+{
+    int16_t r = a + b;
+    return (r > 127) ? 127 : (r < -127) ? -127 : r;
+}
+#endif
+
+/* ext_buttons: 4th and 5th buttons in report format */
+static void process_packet(uint8_t ext_buttons)
+{
+    enum { SCROLL_NONE, SCROLL_BTN, SCROLL_SENT };
+    static uint8_t scroll_state = SCROLL_NONE;
+    static uint8_t buttons_prev = 0;
+
+    /* if mouse moves, wheel turns or buttons state changes */
+    if (mouse_report.x || mouse_report.y || mouse_report.v ||
+            (((mouse_report.buttons & PS2_MOUSE_BTN_MASK) | ext_buttons) != buttons_prev)) {
 
 #ifdef PS2_MOUSE_DEBUG
         xprintf("%ud ", timer_read());
         print("ps2_mouse raw: [");
         phex(mouse_report.buttons); print("|");
         print_hex8((uint8_t)mouse_report.x); print(" ");
-        print_hex8((uint8_t)mouse_report.y); print("]\n");
+        print_hex8((uint8_t)mouse_report.y); print(" ");
+        print_hex8((uint8_t)mouse_report.v); print("]\n");
 #endif
 
-        buttons_prev = mouse_report.buttons;
+        buttons_prev = (mouse_report.buttons & PS2_MOUSE_BTN_MASK) | ext_buttons;
 
         // PS/2 mouse data is '9-bit integer'(-256 to 255) which is comprised of sign-bit and 8-bit value.
         // bit: 8    7 ... 0
@@ -116,6 +220,7 @@ void ps2_mouse_task(void)
 
         // remove sign and overflow flags
         mouse_report.buttons &= PS2_MOUSE_BTN_MASK;
+        mouse_report.buttons |= ext_buttons;
 
         // invert coordinate of y to conform to USB HID mouse
         mouse_report.y = -mouse_report.y;
@@ -135,8 +240,9 @@ void ps2_mouse_task(void)
             if (mouse_report.x || mouse_report.y) {
                 scroll_state = SCROLL_SENT;
 
-                mouse_report.v = -mouse_report.y/(PS2_MOUSE_SCROLL_DIVISOR_V);
-                mouse_report.h =  mouse_report.x/(PS2_MOUSE_SCROLL_DIVISOR_H);
+                // add to wheel of the mouse itself
+                mouse_report.v = scroll_add(mouse_report.v, -mouse_report.y/(PS2_MOUSE_SCROLL_DIVISOR_V));
+                mouse_report.h = scroll_add(mouse_report.h,  mouse_report.x/(PS2_MOUSE_SCROLL_DIVISOR_H));
                 mouse_report.x = 0;
                 mouse_report.y = 0;
                 //host_mouse_send(&mouse_report);
@@ -205,7 +311,12 @@ static void print_usb_data(void)
  * Stream Mode: devices sends the data when it changs its state
  * Remote Mode: host polls the data periodically
  *
- * This code uses Remote Mode and polls the data with Read Data(0xEB).
+ * This code uses Stream Mode when PS/2 data is received by interrupt or USART,
+ * otherwise uses Remote Mode and polls the data with Read Data(0xEB).
+ *
+ * IntelliMouse extension:
+ * Set Sample Rate 200, 100, 80 then Get Device ID returns 0x03 with wheel.
+ * Set Sample Rate 200, 200, 80 then Get Device ID returns 0x04 with 5-button.
  *
  * Data format:
  * byte|7       6       5       4       3       2       1       0
@@ -213,4 +324,6 @@ static void print_usb_data(void)
  *    0|Yovflw  Xovflw  Ysign   Xsign   1       Middle  Right   Left
  *    1|                    X movement
  *    2|                    Y movement
+ *    3|                    Z movement(ID 0x03)
+ *    3|0       0       5th     4th     Z movement(4-bit)  (ID 0x04)
  */
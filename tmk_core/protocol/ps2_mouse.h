@@ -21,6 +21,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdbool.h>
 
 #define PS2_MOUSE_READ_DATA     0xEB
+#define PS2_MOUSE_ENABLE_REPORTING  0xF4
+#define PS2_MOUSE_SET_SAMPLE_RATE   0xF3
+#define PS2_MOUSE_GET_DEVICE_ID     0xF2
+
+#define PS2_MOUSE_ID_STANDARD   0x00
+#define PS2_MOUSE_ID_WHEEL      0x03
+#define PS2_MOUSE_ID_5BUTTON    0x04
+
+/*
+ * Remote Mode(default): mouse is polled with Read Data every task.
+ * Stream Mode: mouse sends packets by itself, received by interrupt. Define
+ * PS2_MOUSE_USE_STREAM_MODE to use it with PS2_USE_INT or PS2_USE_USART; wheel
+ * and 5-button IntelliMouse extensions are also enabled in Stream Mode.
+ * Busywait driver can't receive data without polling and uses Remote Mode.
+ */
+#ifdef PS2_MOUSE_USE_STREAM_MODE
+#   if !(defined(PS2_USE_INT) || defined(PS2_USE_USART))
+#       error "PS2_MOUSE_USE_STREAM_MODE requires PS2_USE_INT or PS2_USE_USART"
+#   endif
+#   define PS2_MOUSE_STREAM_MODE
+#endif
+/* samples/sec: 10, 20, 40, 60, 80, 100 or 200 */
+#ifndef PS2_MOUSE_SAMPLE_RATE
+#define PS2_MOUSE_SAMPLE_RATE   100
+#endif
+#if PS2_MOUSE_SAMPLE_RATE != 10 && PS2_MOUSE_SAMPLE_RATE != 20 && \
+    PS2_MOUSE_SAMPLE_RATE != 40 && PS2_MOUSE_SAMPLE_RATE != 60 && \
+    PS2_MOUSE_SAMPLE_RATE != 80 && PS2_MOUSE_SAMPLE_RATE != 100 && \
+    PS2_MOUSE_SAMPLE_RATE != 200
+#   error "PS2_MOUSE_SAMPLE_RATE: 10, 20, 40, 60, 80, 100 or 200"
+#endif
+/* discard partial packet after this(ms) */
+#ifndef PS2_MOUSE_PACKET_TIMEOUT
+#define PS2_MOUSE_PACKET_TIMEOUT    20
+#endif
 
 /*
  * Data format:
@@ -29,6 +64,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *    0|Yovflw  Xovflw  Ysign   Xsign   1       Middle  Right   Left
  *    1|                    X movement(0-255)
  *    2|                    Y movement(0-255)
+ *    3|                    Z movement(wheel ID 0x03)
+ *    3|0       0       5th     4th     Z movement(4-bit)  (5-button ID 0x04)
  */
 #define PS2_MOUSE_BTN_MASK      0x07
 #define PS2_MOUSE_BTN_LEFT      0
@@ -0,0 +1,4 @@
+/* adb.c with input capture receive for adb_sim.c */
+#include "adb_sim.h"
+#define ADB_USE_ICP
+#include "../adb.c"
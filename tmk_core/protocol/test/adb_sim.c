@@ -0,0 +1,183 @@
+/*
+ * ADB Talk receive simulator
+ *
+ * A device answers Talk commands on simulated data line: optional Service Request,
+ * Stop-to-Start time, start bit, 0-8 bytes and stop bit with bit cell and duty
+ * varied at random. The same answer is received by busy-wait Talk of adb.c and by
+ * input capture(ADB_USE_ICP), which is started with adb_host_talk_start() while
+ * simulated Timer1 captures edges and ISR latency is varied. Both must return what the
+ * device sent, and the same result.
+ *
+ * Bus timing:
+ * https://developer.apple.com/library/archive/technotes/hw/hw_01.html
+ *
+ * Build and run on host:
+ *     $ make adb
+ */
+#include <stdio.h>
+#include <string.h>
+#include "adb_sim.h"
+#include "adb.h"
+
+
+#define NS(us)      ((uint64_t)((us) * 1000))
+
+static uint64_t sim_ns;
+
+/* Device answer: line levels from stop bit of command, low at even index */
+#define DEV_EDGES_MAX   (2 + 2 + 8*8*2 + 2)
+static uint64_t dev_edge[DEV_EDGES_MAX];    // time of level change from stop bit
+static uint8_t  dev_edges;
+static uint64_t dev_t0;                     // start of command stop bit, 0 until it comes
+static uint8_t  host_falls;
+static bool     host_low;
+
+uint8_t sim_port, sim_ddr;
+
+static bool dev_low(uint64_t t)
+{
+    if (!dev_t0 || t < dev_t0) return false;
+    uint8_t i = 0;
+    while (i < dev_edges && t >= dev_t0 + dev_edge[i]) i++;
+    return i & 1;
+}
+
+uint8_t sim_pin(void)
+{
+    return (host_low || dev_low(sim_ns)) ? 0 : (1<<ADB_DATA_BIT);
+}
+
+/* Host changes line only before delay: device finds its command stop bit with 10th
+ * falling edge(attention, 8 command bits, stop bit). Each delay call takes 6 cycles of
+ * overhead as wait_data_lo/hi() loops of adb.c are coded for. */
+void sim_delay_us(double us)
+{
+    bool low = sim_ddr & (1<<ADB_DATA_BIT);
+    if (low && !host_low && ++host_falls == 10) dev_t0 = sim_ns;
+    host_low = low;
+    sim_ns += NS(us + 6 * 1000000.0 / F_CPU);
+}
+
+
+/* Timer1 at F_CPU/64, captures only edge selected with ICES1 */
+uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+uint16_t OCR1B, ICR1;
+static uint16_t tcnt1_offset;
+
+uint16_t sim_tcnt1(void)
+{
+    return sim_ns / (64 * 1000000000ULL / F_CPU) + tcnt1_offset;
+}
+
+static uint32_t rand_state = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8) % n;
+}
+
+/* run bus until capture stops: compare match B and captures in order of time */
+static void icp_run(void)
+{
+    uint8_t i = 0;
+    while (dev_t0 && i < dev_edges && dev_t0 + dev_edge[i] <= sim_ns) i++;
+    while (TIMSK1 & ((1<<ICIE1) | (1<<OCIE1B))) {
+        uint16_t ticks = (uint16_t)(OCR1B - sim_tcnt1());
+        uint64_t compare = sim_ns + ticks * (64 * 1000000000ULL / F_CPU);
+        uint64_t edge = (i < dev_edges ? dev_t0 + dev_edge[i] : UINT64_MAX);
+        if ((TIMSK1 & (1<<OCIE1B)) && compare <= edge) {
+            sim_ns = compare;
+            TIMER1_COMPB_vect();
+            continue;
+        }
+        if (edge == UINT64_MAX) break;
+        bool rising = i & 1;        // line goes high after low phase
+        i++;
+        sim_ns = edge;
+        if (!(TIMSK1 & (1<<ICIE1)) || rising != !!(TCCR1B & (1<<ICES1))) continue;
+        ICR1 = sim_tcnt1();
+        // ISR is called late when USB interrupt is served
+        sim_ns += NS(rnd(20));
+        TIMER1_CAPT_vect();
+    }
+}
+
+/* answer of device with bit cell and duty varied */
+static void dev_answer(bool srq, const uint8_t *data, uint8_t len)
+{
+    // busy-wait receive takes start bit up to 40us low
+    double t = 0, cell = 92 + rnd(17);
+    dev_edges = 0;
+    if (srq) {
+        // hold stop bit low for 300us in total
+        dev_edge[dev_edges++] = 0;
+        t = 260 + rnd(80);
+        dev_edge[dev_edges++] = NS(t);
+    } else {
+        t = 65;
+    }
+    if (!len) return;
+    t += 140 + rnd(121);            // Tlt: Stop-to-Start
+    for (int16_t n = -1; n <= len * 8; n++) {
+        // start bit(1), data bits and stop bit(0)
+        bool bit = (n < 0 ? 1 : n == len * 8 ? 0 : (data[n / 8] >> (7 - n % 8)) & 1);
+        double low = cell * (bit ? 0.35 : 0.65) + (int)rnd(3) - 1;
+        dev_edge[dev_edges++] = NS(t);
+        t += low;
+        dev_edge[dev_edges++] = NS(t);
+        t += cell - low;
+    }
+}
+
+static void bus_reset(void)
+{
+    dev_t0 = 0;
+    host_falls = 0;
+    host_low = false;
+    sim_ddr = 0;
+    sim_ns += NS(1000);
+}
+
+int main(void)
+{
+    uint32_t talks = 0, icp_errors = 0, wait_errors = 0, differ = 0;
+
+    adb_host_init();
+    for (uint32_t n = 0; n < 200000; n++) {
+        uint8_t data[8], len = rnd(9);
+        bool srq = rnd(4) == 0;
+        for (uint8_t i = 0; i < len; i++) data[i] = rnd(256);
+        dev_answer(srq, data, len);
+        talks++;
+
+        uint8_t wbuf[8], ibuf[8];
+        bus_reset();
+        uint8_t wlen = wait_talk_buf(ADB_ADDR_KEYBOARD, ADB_REG_0, wbuf, sizeof(wbuf));
+        bool wsrq = wait_srq();
+
+        bus_reset();
+        tcnt1_offset = rnd(0x10000);
+        adb_host_talk_start(ADB_ADDR_KEYBOARD, ADB_REG_0);
+        bool isrq = adb_host_srq();
+        int8_t ilen = adb_host_talk_result(ibuf, sizeof(ibuf));
+        if (ilen != -1) {
+            // capture goes on until line is quiet even if device is silent
+            if (icp_errors++ < 10) printf("talk %u: result %d before capture ends\n", talks, ilen);
+        }
+        icp_run();
+        ilen = adb_host_talk_result(ibuf, sizeof(ibuf));
+
+        if (wlen != len || wsrq != srq || memcmp(wbuf, data, len)) {
+            if (wait_errors++ < 10) printf("talk %u: busy-wait len:%u srq:%u expected len:%u srq:%u\n",
+                                           talks, wlen, wsrq, len, srq);
+        }
+        if (ilen != len || isrq != srq || memcmp(ibuf, data, len)) {
+            if (icp_errors++ < 10) printf("talk %u: ICP len:%d srq:%u expected len:%u srq:%u\n",
+                                          talks, ilen, isrq, len, srq);
+        }
+        if (ilen != wlen || isrq != wsrq || memcmp(ibuf, wbuf, wlen)) differ++;
+    }
+    printf("%u talks  busy-wait:%u errors  ICP:%u errors  differ:%u\n", talks, wait_errors, icp_errors, differ);
+    printf("%s\n", (wait_errors || icp_errors || differ) ? "FAIL" : "PASS");
+    return (wait_errors || icp_errors || differ) ? 1 : 0;
+}
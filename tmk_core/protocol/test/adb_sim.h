@@ -0,0 +1,52 @@
+/*
+ * ADB bus and Timer1 of host simulator: see adb_sim.c
+ *
+ * adb.c is built twice against this; adb_icp.c with ADB_USE_ICP and adb_wait.c with
+ * busy-wait receive.
+ */
+#ifndef ADB_SIM_H
+#define ADB_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define F_CPU               16000000UL
+
+/* host replacements of print */
+#define PRINT_H__
+#define xprintf(...)        do { } while (0)
+#define print(s)            do { } while (0)
+
+/* data line: host drives low with DDR, device drives low by itself */
+extern uint8_t sim_port, sim_ddr;
+uint8_t sim_pin(void);
+#define ADB_PORT            sim_port
+#define ADB_PIN             sim_pin()
+#define ADB_DDR             sim_ddr
+#define ADB_DATA_BIT        0
+
+/* time goes on only in delay */
+void sim_delay_us(double us);
+#define _delay_us(us)       sim_delay_us(us)
+
+/* Timer1 */
+extern uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern uint16_t OCR1B, ICR1;
+uint16_t sim_tcnt1(void);
+#define TCNT1               sim_tcnt1()
+#define CS10                0
+#define CS11                1
+#define ICES1               6
+#define ICNC1               7
+#define OCIE1B              2
+#define ICIE1               5
+#define OCF1B               2
+#define ICF1                5
+void TIMER1_CAPT_vect(void);
+void TIMER1_COMPB_vect(void);
+
+/* busy-wait build of adb.c */
+uint8_t wait_talk_buf(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
+bool wait_srq(void);
+
+#endif
@@ -0,0 +1,15 @@
+/* adb.c with busy-wait receive for adb_sim.c: API is renamed not to clash with adb_icp.c */
+#include "adb_sim.h"
+#define adb_host_init           wait_host_init
+#define adb_host_psw            wait_host_psw
+#define adb_host_kbd_recv       wait_kbd_recv
+#define adb_host_srq            wait_srq
+#define adb_host_talk_start     wait_talk_start
+#define adb_host_talk_result    wait_talk_result
+#define adb_host_talk_buf       wait_talk_buf
+#define adb_host_talk           wait_talk
+#define adb_host_listen_buf     wait_listen_buf
+#define adb_host_listen         wait_listen
+#define adb_host_flush          wait_flush
+#define adb_host_kbd_led        wait_kbd_led
+#include "../adb.c"
@@ -0,0 +1,10 @@
+/* Host replacement of <avr/interrupt.h> for protocol tests: vectors are plain functions
+ * called by the simulator, interrupts are not real. */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector, ...)    void vector(void)
+#define cli()
+#define sei()
+
+#endif
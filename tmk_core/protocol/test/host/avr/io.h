@@ -0,0 +1 @@
+/* Host stub of <avr/io.h>: registers are defined by each test */
@@ -0,0 +1 @@
+/* Host stub of <util/delay.h>: _delay_us() is defined by each test */
@@ -0,0 +1,227 @@
+/*
+ * IBM PC protocol framing simulator
+ *
+ * Feeds clock falling edges of AT, Zenith Z-150, XT_IBM and XT_Clone keyboards to the
+ * clock ISR of ibmpc.c with simulated Timer0 and checks that ibmpc_host_recv() returns
+ * every byte in order with the protocol of the keyboard. Frames which are ambiguous at
+ * 9th/10th edge(XT_Clone/XT_IBM-error and XT_IBM/AT-midway) are resolved only by interval
+ * to the next edge, so bit periods, gaps between frames, ISR latency and Timer0 ISR
+ * latency over the millisecond tick are varied at random.
+ *
+ * Edge timing follows the keyboard signals in the wiki:
+ * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-AT-Keyboard-Protocol
+ * https://github.com/tmk/tmk_keyboard/wiki/IBM-PC-XT-Keyboard-Protocol
+ *
+ * Build and run on host:
+ *     $ make ibmpc
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* host replacements of AVR, print and wait */
+#define PRINT_H__
+#define xprintf(...)        do { } while (0)
+#define print(s)            do { } while (0)
+#define println(s)          do { } while (0)
+#define wait_us(us)         do { } while (0)
+#define wait_ms(ms)         do { } while (0)
+#include "debug.h"
+debug_config_t debug_config;
+
+/* clock and data lines: only data line level at clock falling edge matters */
+static uint8_t sim_port, sim_ddr, sim_pin;
+static uint8_t EICRA, EIFR, EIMSK;
+#define IBMPC_CLOCK_PORT    sim_port
+#define IBMPC_CLOCK_PIN     sim_pin
+#define IBMPC_CLOCK_DDR     sim_ddr
+#define IBMPC_CLOCK_BIT     0
+#define IBMPC_DATA_PORT     sim_port
+#define IBMPC_DATA_PIN      sim_pin
+#define IBMPC_DATA_DDR      sim_ddr
+#define IBMPC_DATA_BIT      1
+#define IBMPC_INT_BIT       0
+#define IBMPC_INT_ISC       0
+#define IBMPC_INT_VECT      sim_clock_fall
+#define clock_lo(host)      ((void)(host))
+#define clock_hi(host)      ((void)(host))
+#define clock_in(host)      ((void)(host), true)
+#define data_lo(host)       ((void)(host))
+#define data_hi(host)       ((void)(host))
+#define data_in(host)       ((void)(host), true)
+
+/* Timer0 at 16MHz/64: CTC with OCR0A = TIMER_RAW_TOP, compare ISR counts milliseconds */
+#define TIMER_RAW_FREQ      250000UL
+#define TIMER_RAW_TOP       250
+#define TIMER_RAW           sim_raw()
+#define TIFR0               sim_tifr()
+#define OCF0A               1
+#define TICK_NS             (1000000000UL / TIMER_RAW_FREQ)
+volatile uint32_t timer_count;
+static uint64_t sim_ns;
+static uint32_t t0_latency_ns;      // Timer0 compare ISR is served this late
+
+static uint8_t sim_raw(void)
+{
+    return (sim_ns / TICK_NS) % (TIMER_RAW_TOP + 1);
+}
+
+/* compare flag is set while its ISR is not served yet */
+static uint8_t sim_tifr(void)
+{
+    uint32_t matches = (sim_ns / TICK_NS) / (TIMER_RAW_TOP + 1);
+    return matches != timer_count ? (1<<OCF0A) : 0;
+}
+
+static void sim_timer0(void)
+{
+    uint32_t matches = ((sim_ns > t0_latency_ns ? sim_ns - t0_latency_ns : 0) / TICK_NS) / (TIMER_RAW_TOP + 1);
+    timer_count = matches;
+}
+
+#include "../ibmpc.c"
+
+
+#define HOST    (&ibmpc_host[0])
+
+static uint32_t rand_state = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8) % n;
+}
+
+typedef struct {
+    const char *name;
+    uint8_t protocol;       // expected result
+    uint16_t period_min;    // clock period in us
+    uint16_t period_max;
+} kbd_t;
+
+/* clock period and ISR latency should stay under IBMPC_EDGE_GAP_US(120) */
+static const kbd_t kbds[] = {
+    { "AT",             IBMPC_PROTOCOL_AT,        60, 100 },
+    { "Z-150",          IBMPC_PROTOCOL_AT_Z150,   60, 100 },
+    { "XT_IBM",         IBMPC_PROTOCOL_XT_IBM,    85, 105 },
+    { "XT_IBM(error)",  IBMPC_PROTOCOL_XT_ERROR,  85, 105 },
+    { "XT_Clone",       IBMPC_PROTOCOL_XT_CLONE,  60, 105 },
+};
+
+/* bits sampled at clock falling edges of a frame */
+static uint8_t frame_bits(uint8_t protocol, uint8_t data, uint8_t *bits)
+{
+    uint8_t n = 0;
+    bool parity = true;
+    switch (protocol) {
+        case IBMPC_PROTOCOL_AT:
+        case IBMPC_PROTOCOL_AT_Z150:
+            bits[n++] = 0;
+            break;
+        case IBMPC_PROTOCOL_XT_IBM:
+            bits[n++] = 0;
+            bits[n++] = 1;
+            break;
+        case IBMPC_PROTOCOL_XT_ERROR:
+            // first start bit(0) is read as 1
+            bits[n++] = 1;
+            bits[n++] = 1;
+            break;
+        case IBMPC_PROTOCOL_XT_CLONE:
+            bits[n++] = 1;
+            break;
+    }
+    for (uint8_t i = 0; i < 8; i++) {
+        bits[n++] = (data >> i) & 1;
+        if ((data >> i) & 1) parity = !parity;
+    }
+    if (protocol == IBMPC_PROTOCOL_AT || protocol == IBMPC_PROTOCOL_AT_Z150) {
+        bits[n++] = parity;
+        bits[n++] = (protocol == IBMPC_PROTOCOL_AT ? 1 : 0);
+    }
+    return n;
+}
+
+/* received data is checked against sent data in order */
+#define QUEUE_SIZE  16
+static uint8_t queue[QUEUE_SIZE];
+static uint8_t queue_head, queue_tail;
+static uint32_t received, errors;
+static uint64_t next_poll_ns;
+
+static void poll(const kbd_t *kbd)
+{
+    int16_t r = ibmpc_host_recv(HOST);
+    if (r == -1) return;
+    received++;
+    if (queue_head == queue_tail) {
+        if (errors++ < 10) printf("%s: unexpected %02X\n", kbd->name, r);
+        return;
+    }
+    uint8_t expected = queue[queue_tail++ % QUEUE_SIZE];
+    if (r != expected || HOST->protocol != kbd->protocol) {
+        if (errors++ < 10) {
+            printf("%s: %02X(protocol:%02X) expected %02X(protocol:%02X) isr_debug:%04X\n",
+                   kbd->name, r, HOST->protocol, expected, kbd->protocol, HOST->isr_debug);
+        }
+    }
+}
+
+/* time goes on: Timer0 counts and matrix scan polls about every millisecond */
+static void advance(const kbd_t *kbd, uint64_t ns)
+{
+    while (next_poll_ns <= ns) {
+        sim_ns = next_poll_ns;
+        sim_timer0();
+        poll(kbd);
+        next_poll_ns += 800000 + rnd(400000);
+    }
+    sim_ns = ns;
+    sim_timer0();
+}
+
+static uint32_t run(const kbd_t *kbd, uint32_t frames)
+{
+    ibmpc_host_isr_clear(HOST);
+    queue_head = queue_tail = 0;
+    received = errors = 0;
+    next_poll_ns = sim_ns + 1000000;
+
+    for (uint32_t f = 0; f < frames; f++) {
+        uint8_t data = rnd(255);       // 0xFF is error code from keyboard and flushes buffer
+        uint8_t bits[12];
+        uint8_t n = frame_bits(kbd->protocol, data, bits);
+
+        // gap between frames, sometimes long enough that recv resolves pending frame
+        uint64_t t = sim_ns + (rnd(8) ? 200000 + rnd(2000000) : 5000000);
+        queue[queue_head++ % QUEUE_SIZE] = data;
+        t0_latency_ns = rnd(4) ? 0 : rnd(30000);
+        for (uint8_t i = 0; i < n; i++) {
+            if (i) t += (kbd->period_min + rnd(kbd->period_max - kbd->period_min + 1)) * 1000;
+            // ISR is called late when other interrupt is served
+            advance(kbd, t + rnd(8000));
+            sim_pin = (bits[i] ? (1<<IBMPC_DATA_BIT) : 0);
+            IBMPC_INT_VECT();
+        }
+    }
+    // no more edge: last frame is resolved in recv
+    advance(kbd, sim_ns + 5000000);
+    if (queue_head != queue_tail) {
+        errors += (uint8_t)(queue_head - queue_tail);
+        printf("%s: %u bytes not received\n", kbd->name, (uint8_t)(queue_head - queue_tail));
+    }
+    return errors;
+}
+
+#define FRAMES  200000
+
+int main(void)
+{
+    uint32_t total = 0;
+    for (uint8_t k = 0; k < sizeof(kbds) / sizeof(kbds[0]); k++) {
+        uint32_t e = run(&kbds[k], FRAMES);
+        printf("%-14s %u frames %u received %u errors\n", kbds[k].name, FRAMES, received, e);
+        total += e;
+    }
+    printf("%s\n", total ? "FAIL" : "PASS");
+    return total ? 1 : 0;
+}
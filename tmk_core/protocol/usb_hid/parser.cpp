@@ -25,3 +25,298 @@ void KBDReportParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *b
     ::memcpy(&report, buf, sizeof(report_keyboard_t));
     time_stamp = millis();
 }
+
+
+/*
+ * Report descriptor parser
+ *
+ * Short item: prefix(tag:4 type:2 size:2) and 0, 1, 2 or 4 bytes of data
+ * Long item:  0xFE, data size, tag and data
+ */
+void KBDReportDescParser::Reset()
+{
+    field_count = 0;
+    report_count = 0;
+    id_ifaces = 0;
+    iface = 0;
+    NewInterface();
+}
+
+void KBDReportDescParser::NewInterface()
+{
+    remain = 0;
+    skip = 0;
+    long_item = false;
+    usage_page = 0;
+    rpt_size = 0;
+    rpt_count = 0;
+    rpt_id = 0;
+    usage_set = false;
+    offset_count = 0;
+}
+
+void KBDReportDescParser::Finish()
+{
+    // fill in report length now that all items of this interface are known
+    for (uint8_t i = 0; i < field_count; i++) {
+        kbd_field_t *f = &fields[i];
+        if (f->iface == iface && f->report_len == 0) {
+            f->report_len = (*Offset(f->report_id) + 7) / 8 + (f->report_id ? 1 : 0);
+        }
+    }
+    iface++;
+    NewInterface();
+}
+
+uint16_t *KBDReportDescParser::Offset(uint8_t id)
+{
+    for (uint8_t i = 0; i < offset_count; i++) {
+        if (offsets[i].id == id) return &offsets[i].bits;
+    }
+    if (offset_count < KBD_REPORT_IDS_MAX) {
+        offsets[offset_count].id = id;
+        offsets[offset_count].bits = 0;
+        return &offsets[offset_count++].bits;
+    }
+    return &offsets[KBD_REPORT_IDS_MAX - 1].bits;
+}
+
+void KBDReportDescParser::Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset)
+{
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t c = pbuf[i];
+        if (skip) {
+            skip--;
+        } else if (long_item) {
+            // data size of long item, plus its tag
+            skip = c + 1;
+            long_item = false;
+        } else if (remain) {
+            data |= (uint32_t)c << shift;
+            shift += 8;
+            if (--remain == 0) Item();
+        } else if (c == 0xFE) {
+            long_item = true;
+        } else {
+            prefix = c;
+            remain = ((c & 0x03) == 0x03 ? 4 : (c & 0x03));
+            shift = 0;
+            data = 0;
+            if (remain == 0) Item();
+        }
+    }
+}
+
+void KBDReportDescParser::Item()
+{
+    switch (prefix & 0xFC) {
+        // Global
+        case 0x04: usage_page = data; break;
+        case 0x74: rpt_size = data; break;
+        case 0x94: rpt_count = data; break;
+        case 0x84:
+            rpt_id = data;
+            id_ifaces |= 1 << iface;
+            break;
+        // Local
+        case 0x08:  // Usage: first one is used as base of keycodes
+        case 0x18:  // Usage Minimum
+            if (!usage_set || (prefix & 0xFC) == 0x18) {
+                usage_min = data;
+                usage_set = true;
+            }
+            break;
+        // Main
+        case 0x80:
+            Input(data);
+            usage_set = false;
+            break;
+        case 0x90:  // Output
+        case 0xB0:  // Feature
+        case 0xA0:  // Collection
+        case 0xC0:  // End Collection
+            usage_set = false;
+            break;
+    }
+}
+
+void KBDReportDescParser::Input(uint8_t flags)
+{
+    uint16_t *bits = Offset(rpt_id);
+
+    // Keyboard page, not Constant
+    if (usage_page == 0x07 && !(flags & 0x01) && field_count < KBD_FIELDS_MAX) {
+        bool is_array = !(flags & 0x02);
+        if ((is_array && rpt_size == 8) || (!is_array && rpt_size == 1)) {
+            // fields of the same report share index
+            uint8_t report = report_count;
+            for (uint8_t i = 0; i < field_count; i++) {
+                if (fields[i].iface == iface && fields[i].report_id == rpt_id) {
+                    report = fields[i].report;
+                    break;
+                }
+            }
+            if (report < KBD_REPORTS_MAX) {
+                if (report == report_count) report_count++;
+                kbd_field_t *f = &fields[field_count++];
+                f->report = report;
+                f->report_id = rpt_id;
+                f->report_len = 0;
+                f->iface = iface;
+                f->is_array = is_array;
+                f->usage_min = (usage_set ? usage_min : 0);
+                f->count = rpt_count;
+                f->bit_offset = *bits;
+            }
+        }
+    }
+    *bits += rpt_size * rpt_count;
+}
+
+
+/*
+ * NKRO report parser
+ */
+static uint8_t get_bits8(const uint8_t *buf, uint16_t bit)
+{
+    uint8_t v = buf[bit / 8] >> (bit % 8);
+    if (bit % 8) v |= buf[bit / 8 + 1] << (8 - bit % 8);
+    return v;
+}
+
+void KBDNKROParser::Clear()
+{
+    ::memset(keys, 0, sizeof(keys));
+    time_stamp = millis();
+}
+
+uint16_t KBDNKROParser::get_row(uint8_t row)
+{
+    uint16_t bits = 0;
+    for (uint8_t r = 0; r < desc.report_count; r++) {
+        bits |= keys[r][row * 2] | (keys[r][row * 2 + 1] << 8);
+    }
+    return bits;
+}
+
+void KBDNKROParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf)
+{
+    xprintf("input %d:", hid->GetAddress());
+    for (uint8_t i = 0; i < len; i++) {
+        xprintf(" %02X", buf[i]);
+    }
+    xprintf("\r\n");
+
+    // find report with interface, report ID and length
+    uint8_t id = (is_rpt_id ? buf[0] : 0);
+    const kbd_field_t *rpt = NULL;
+    for (uint8_t i = 0; i < desc.field_count; i++) {
+        const kbd_field_t *f = &desc.fields[i];
+        if (f->iface == iface && f->report_id == id && f->report_len == len) {
+            rpt = f;
+            break;
+        }
+    }
+    if (!rpt) {
+        xprintf("Unknown report: ignored\r\n");
+        return;
+    }
+
+    const uint8_t *data = buf + (rpt->report_id ? 1 : 0);
+    uint8_t state[32] = {};
+    for (uint8_t i = 0; i < desc.field_count; i++) {
+        const kbd_field_t *f = &desc.fields[i];
+        if (f->report != rpt->report) continue;
+
+        for (uint8_t j = 0; j < f->count; j++) {
+            uint8_t code;
+            if (f->is_array) {
+                code = get_bits8(data, f->bit_offset + j * 8);
+                if (code == 0x00) continue;
+                // Rollover error
+                if (code == 0x01) {
+                    xprintf("Rollover error: ignored\r\n");
+                    return;
+                }
+                code += f->usage_min;
+            } else {
+                uint16_t bit = f->bit_offset + j;
+                if (!(data[bit / 8] & (1 << (bit % 8)))) continue;
+                code = f->usage_min + j;
+            }
+            state[code / 8] |= 1 << (code % 8);
+        }
+    }
+
+    ::memcpy(keys[rpt->report], state, sizeof(state));
+    time_stamp = millis();
+}
+
+
+/*
+ * Report protocol keyboard
+ */
+uint8_t HIDKeyboard::OnInitSuccessful()
+{
+    // Report descriptors are read later with ReadReportDescr() not to block in enumeration.
+    parser.desc.Reset();
+    parser.Clear();
+    SetReportParser(0, &parser);
+    desc_iface = 0;
+    return 0;
+}
+
+bool HIDKeyboard::ReadReportDescr()
+{
+    if (desc_iface >= maxHidInterfaces) return false;
+
+    // Read report descriptors of all interfaces, STALL is returned on non-existent one.
+    // GetReportDescr() is not used as it reads only 128 bytes, which is too short for NKRO keyboards.
+    uint8_t buf[64];
+    pUsb->ctrlReq(bAddress, 0x00, bmREQ_HID_REPORT, USB_REQUEST_GET_DESCRIPTOR, 0x00,
+                  HID_DESCRIPTOR_REPORT, desc_iface, 512, sizeof(buf), buf, &parser.desc);
+    parser.desc.Finish();
+
+    if (++desc_iface == maxHidInterfaces) {
+        xprintf("HIDKeyboard: %d reports %d fields\r\n", parser.desc.report_count, parser.desc.field_count);
+        ready = true;
+    }
+    return true;
+}
+
+uint8_t HIDKeyboard::Release()
+{
+    desc_iface = maxHidInterfaces;
+    ready = false;
+    return HIDUniversal::Release();
+}
+
+// HIDUniversal::Poll() doesn't tell parser which interface a report came from.
+uint8_t HIDKeyboard::Poll()
+{
+    if (!ready) return 0;
+
+    // poll at bInterval of endpoints as HIDUniversal::Poll() does
+    if ((int32_t)((uint32_t)millis() - qNextPollTime) < 0L) return 0;
+    qNextPollTime = (uint32_t)millis() + pollInterval;
+
+    uint8_t buf[64];
+    for (uint8_t i = 0; i < bNumIface; i++) {
+        uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
+        uint16_t read = epInfo[index].maxPktSize;
+        if (read > sizeof(buf)) read = sizeof(buf);
+
+        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
+        if (rcode) {
+            if (rcode != hrNAK) return rcode;
+            continue;
+        }
+        if (read == 0) continue;
+        // report descriptor is read only for interface 0 to maxHidInterfaces-1
+        if (hidInterfaces[i].bmInterface >= maxHidInterfaces) continue;
+
+        parser.iface = hidInterfaces[i].bmInterface;
+        parser.Parse(this, parser.desc.id_ifaces & (1 << parser.iface), read, buf);
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include "usbhid.h"
+#include "hiduniversal.h"
 #include "report.h"
 
 class KBDReportParser : public HIDReportParser
@@ -12,4 +13,95 @@ public:
     virtual void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
 };
 
+
+/*
+ * Report protocol keyboard
+ *
+ * Keyboard page(0x07) fields of input reports are read from report descriptor,
+ * both bitmap(NKRO) and array of keycodes(6KRO) are supported.
+ * A report is identified with interface it came from, its report ID and
+ * length, so that reports from boot and NKRO interfaces of a keyboard can be
+ * told apart.
+ */
+#define KBD_FIELDS_MAX      6
+#define KBD_REPORTS_MAX     2
+#define KBD_REPORT_IDS_MAX  4
+
+typedef struct {
+    uint8_t  report;        // index of report this field belongs to
+    uint8_t  report_id;     // 0: no report ID
+    uint8_t  report_len;    // report length in bytes including report ID
+    uint8_t  iface;
+    bool     is_array;      // array of keycodes or bitmap
+    uint8_t  usage_min;
+    uint8_t  count;         // bits of bitmap or elements of array
+    uint16_t bit_offset;    // position in report data after report ID
+} kbd_field_t;
+
+class KBDReportDescParser : public USBReadParser
+{
+public:
+    kbd_field_t fields[KBD_FIELDS_MAX];
+    uint8_t field_count;
+    uint8_t report_count;
+    uint8_t id_ifaces;      // bit of interfaces which use report ID
+
+    void Reset();
+    void Finish();  // call at end of each interface descriptor
+    virtual void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset);
+private:
+    // item being parsed
+    uint8_t prefix;
+    uint8_t remain;
+    uint8_t shift;
+    uint8_t skip;
+    bool long_item;
+    uint32_t data;
+    // global and local items
+    uint8_t iface;
+    uint16_t usage_page;
+    uint8_t rpt_size;
+    uint8_t rpt_count;
+    uint8_t rpt_id;
+    uint8_t usage_min;
+    bool usage_set;
+    // bits of input report so far for each report ID
+    struct { uint8_t id; uint16_t bits; } offsets[KBD_REPORT_IDS_MAX];
+    uint8_t offset_count;
+
+    void NewInterface();
+    void Item();
+    void Input(uint8_t flags);
+    uint16_t *Offset(uint8_t id);
+};
+
+class KBDNKROParser : public HIDReportParser
+{
+public:
+    KBDReportDescParser desc;
+    // key state of each report: bit (code & 7) of byte (code >> 3) for keycode
+    uint8_t keys[KBD_REPORTS_MAX][32];
+    uint16_t time_stamp;
+    uint8_t iface;          // interface of report given to Parse()
+
+    void Clear();
+    uint16_t get_row(uint8_t row);  // keycode row(code >> 4)
+    virtual void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+};
+
+class HIDKeyboard : public HIDUniversal
+{
+public:
+    KBDNKROParser parser;
+    HIDKeyboard(USB *p) : HIDUniversal(p), desc_iface(maxHidInterfaces), ready(false) {};
+    bool ReadReportDescr();     // reads one interface per call, false when nothing to read
+    virtual uint8_t Poll();
+    virtual uint8_t Release();
+protected:
+    virtual uint8_t OnInitSuccessful();
+private:
+    uint8_t desc_iface;         // interface of report descriptor to read next
+    bool ready;
+};
+
 #endif
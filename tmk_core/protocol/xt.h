@@ -67,5 +67,6 @@ POSSIBILITY OF SUCH DAMAGE.
 
 void xt_host_init(void);
 uint8_t xt_host_recv(void);
+uint8_t xt_host_overflow(void);
 
 #endif
@@ -46,13 +46,19 @@ POSSIBILITY OF SUCH DAMAGE.
 
 
 #define BUF_SIZE 16
-static uint8_t buf[BUF_SIZE];
-static ringbuf_t rb = {
-    .buffer = buf,
-    .head = 0,
-    .tail = 0,
-    .size_mask = BUF_SIZE - 1
-};
+RINGBUF_DEFINE(rb, uint8_t, BUF_SIZE)
+
+/* Inhibit keyboard when buffer has this many bytes and resume when drained to this.
+ * Gap between them keeps typematic burst from toggling inhibit on every byte. */
+#ifndef XT_BUF_INHIBIT
+#define XT_BUF_INHIBIT  (BUF_SIZE - 4)
+#endif
+#ifndef XT_BUF_RESUME
+#define XT_BUF_RESUME   (BUF_SIZE / 4)
+#endif
+
+/* data lost on full buffer; incremented only by ISR and wraps around */
+static volatile uint8_t overflow = 0;
 
 void xt_host_init(void)
 {
@@ -79,15 +85,26 @@ void xt_host_init(void)
 /* get data received by interrupt */
 uint8_t xt_host_recv(void)
 {
-    if (ringbuf_is_empty(&rb)) {
+    uint8_t d;
+    if (!rb_get(&d)) {
         return 0;
     } else {
-        int16_t d = ringbuf_get(&rb);
-        XT_DATA_IN();  // ready to receive from keyboard
+        if (rb_count() <= XT_BUF_RESUME) {
+            XT_DATA_IN();  // ready to receive from keyboard
+        }
         return d;
     }
 }
 
+/* number of bytes lost since last call */
+uint8_t xt_host_overflow(void)
+{
+    static uint8_t seen = 0;
+    uint8_t count = overflow - seen;
+    seen += count;
+    return count;
+}
+
 ISR(XT_INT_VECT)
 {
     /*
@@ -123,10 +140,11 @@ ISR(XT_INT_VECT)
             break;
     }
     if (state++ == BIT7) {
-        ringbuf_put(&rb, data);
-        if (ringbuf_is_full(&rb)) {
+        if (!rb_put(data)) {
+            overflow++;
+        }
+        if (rb_count() >= XT_BUF_INHIBIT) {
             XT_DATA_LO();  // inhibit keyboard sending
-            print("Full");
         }
         state = START;
         data = 0;
@@ -60,6 +60,17 @@ ifdef SLEEP_LED_ENABLE
     OPT_DEFS += -DNO_SUSPEND_POWER_DOWN
 endif
 
+ifdef MATRIX_SCAN_GPT
+    SRC += $(COMMON_DIR)/chibios/matrix_gpt.c
+    OPT_DEFS += -DMATRIX_SCAN_GPT
+    OPT_DEFS += -DHAL_USE_GPT=TRUE
+endif
+
+ifdef KEYBOARD_THREADS
+    SRC += $(TMK_DIR)/protocol/chibios/keyboard_threads.c
+    OPT_DEFS += -DKEYBOARD_THREADS
+endif
+
 ifdef BACKLIGHT_ENABLE
     SRC += $(COMMON_DIR)/backlight.c
     OPT_DEFS += -DBACKLIGHT_ENABLE